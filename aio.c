@@ -0,0 +1,231 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Asynchronous reads for kernels
+ *
+ * aio_submit() queues a read of len bytes from the current position of a
+ * file into a buffer and returns a handle straight away, moving the file
+ * position past the data as fread() would.  Requests are carried out one at
+ * a time, in the order they were submitted, by a load pipe (see loadpipe.c)
+ * so the card transfers whole runs of blocks straight into the buffer.
+ *
+ * There are no interrupts, so a request only moves on when aio_poll() or
+ * aio_wait() is called: each call finishes the transfer in progress if the
+ * card is done with it and starts the next one.  In between the caller is
+ * free to do other work.  Files on filesystems which cannot be mapped to
+ * blocks are read a chunk at a time by each call instead.
+ *
+ * Every request must be collected with aio_wait(), which returns its result
+ * and frees the handle.  fclose() finishes any requests still reading the
+ * file first.
+ *
+ * The card only transfers by DMA while the MMU and data cache are off (see
+ * sd_read_start()); after that each call reads its run with the CPU.  Either
+ * way the buffers, our own memory and the peripherals must stay identity
+ * mapped until the last request has been collected.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "aio.h"
+#include "loadpipe.h"
+#include "vfs.h"
+
+#define AIO_FREE	0
+#define AIO_QUEUED	1
+#define AIO_ACTIVE	2
+#define AIO_DONE	3
+
+struct aio_request
+{
+	int state;
+	uint32_t seq;		// submission order
+	FILE *fp;
+	uint8_t *dst;
+	long offset;
+	size_t len;
+	size_t done;
+	int error;
+};
+
+static struct aio_request requests[AIO_MAX_REQUESTS];
+static uint32_t next_seq = 0;
+static struct loadpipe lp;
+static struct aio_request *active = (void *)0;
+
+static struct aio_request *get_request(int handle)
+{
+	if((handle < 0) || (handle >= AIO_MAX_REQUESTS) ||
+			(requests[handle].state == AIO_FREE))
+		return (void *)0;
+	return &requests[handle];
+}
+
+// Stop the pipe of the active request and record how it went
+static void aio_finish()
+{
+	struct aio_request *r = active;
+	long pos = r->fp->pos;
+	if(loadpipe_end(&lp, "aio") != 0)
+		r->error = AIO_ERR_READ;
+	r->done = lp.ready;
+	if(r->done != r->len)
+		r->error = AIO_ERR_READ;
+	r->fp->pos = pos;
+	r->state = AIO_DONE;
+	active = (void *)0;
+}
+
+// Start the oldest queued request, if there is one
+static void aio_start_next()
+{
+	struct aio_request *next = (void *)0;
+	for(int i = 0; i < AIO_MAX_REQUESTS; i++)
+	{
+		struct aio_request *r = &requests[i];
+		if((r->state == AIO_QUEUED) &&
+				(!next || ((int32_t)(r->seq - next->seq) < 0)))
+			next = r;
+	}
+	if(!next)
+		return;
+
+	// The pipe reads from the file position; the caller's is put back
+	long pos = next->fp->pos;
+	next->fp->pos = next->offset;
+	next->state = AIO_ACTIVE;
+	active = next;
+	loadpipe_begin(&lp, next->fp, next->dst, next->len);
+	next->fp->pos = pos;
+}
+
+// Move the requests along as far as possible without waiting for the card.
+// If block is set, wait until the active request has finished.
+static void aio_progress(int block)
+{
+	if(!active)
+		aio_start_next();
+
+	while(active)
+	{
+		long pos = active->fp->pos;
+		size_t need = block ? active->len :
+			(lp.async ? 0 : lp.ready + 1);
+		active->done = loadpipe_wait(&lp, need);
+		active->fp->pos = pos;
+
+		if((active->done < active->len) && !lp.error)
+			return;
+		aio_finish();
+		aio_start_next();
+		if(block)
+			return;
+	}
+}
+
+// Queue a read of len bytes from the current position of stream into ptr,
+// which should be word aligned for the card to transfer into it directly.
+// Returns a handle or a negative error.
+int aio_submit(void *ptr, size_t len, FILE *stream)
+{
+	if(!stream || (!ptr && len))
+		return AIO_ERR_INVALID;
+
+	int handle = -1;
+	for(int i = 0; i < AIO_MAX_REQUESTS; i++)
+	{
+		if(requests[i].state == AIO_FREE)
+		{
+			handle = i;
+			break;
+		}
+	}
+	if(handle < 0)
+		return AIO_ERR_FULL;
+
+	if(len > (size_t)(stream->len - stream->pos))
+		len = (size_t)(stream->len - stream->pos);
+
+	struct aio_request *r = &requests[handle];
+	memset(r, 0, sizeof(struct aio_request));
+	r->state = AIO_QUEUED;
+	r->seq = next_seq++;
+	r->fp = stream;
+	r->dst = (uint8_t *)ptr;
+	r->offset = stream->pos;
+	r->len = len;
+	stream->pos += (long)len;
+
+	aio_progress(0);
+	return handle;
+}
+
+// Move the requests along and report on one.  *bytes (if not null) is set to
+// how much of its buffer has been filled, from the start.  Returns 1 if the
+// request has finished, 0 if not or a negative error.
+int aio_poll(int handle, size_t *bytes)
+{
+	struct aio_request *r = get_request(handle);
+	if(!r)
+		return AIO_ERR_INVALID;
+
+	aio_progress(0);
+	if(bytes)
+		*bytes = r->done;
+	if(r->state != AIO_DONE)
+		return 0;
+	return r->error ? r->error : 1;
+}
+
+// Wait for a request to finish and free its handle.  Returns the number of
+// bytes read or a negative error.
+long aio_wait(int handle)
+{
+	struct aio_request *r = get_request(handle);
+	if(!r)
+		return AIO_ERR_INVALID;
+
+	while(r->state != AIO_DONE)
+		aio_progress(1);
+
+	r->state = AIO_FREE;
+	return r->error ? r->error : (long)r->done;
+}
+
+// Called by fclose(): finish the requests reading stream, which are then
+// only waiting to be collected
+void aio_fclose(FILE *stream)
+{
+	for(int i = 0; i < AIO_MAX_REQUESTS; i++)
+	{
+		struct aio_request *r = &requests[i];
+		if((r->state == AIO_QUEUED) || (r->state == AIO_ACTIVE))
+		{
+			if(r->fp == stream)
+			{
+				while(r->state != AIO_DONE)
+					aio_progress(1);
+			}
+		}
+	}
+}
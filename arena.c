@@ -0,0 +1,118 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// All allocations are aligned to this
+#define ARENA_ALIGN		8
+
+struct arena_block
+{
+	struct arena_block *prev;
+	size_t size;
+	size_t used;
+	uint32_t pad;		// keep data 8-byte aligned
+};
+
+struct arena transient_arena = ARENA_INIT(ARENA_DEFAULT_BLOCK_SIZE);
+struct arena persistent_arena = ARENA_INIT(ARENA_DEFAULT_BLOCK_SIZE);
+
+// Start a new block, large enough for at least 'size' bytes
+static struct arena_block *arena_new_block(struct arena *a, size_t size)
+{
+	size_t block_size = a->block_size;
+	if(size > block_size)
+		block_size = size;
+
+	struct arena_block *b = (struct arena_block *)malloc(
+			sizeof(struct arena_block) + block_size);
+	if(!b)
+		return (void *)0;
+	b->prev = a->cur;
+	b->size = block_size;
+	b->used = 0;
+	a->cur = b;
+	return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	struct arena_block *b = a->cur;
+	if(!b || ((b->size - b->used) < size))
+	{
+		b = arena_new_block(a, size);
+		if(!b)
+			return (void *)0;
+	}
+
+	void *ret = (uint8_t *)b + sizeof(struct arena_block) + b->used;
+	b->used += size;
+	return ret;
+}
+
+void *arena_zalloc(struct arena *a, size_t size)
+{
+	void *ret = arena_alloc(a, size);
+	if(ret)
+		memset(ret, 0, size);
+	return ret;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	size_t len = strlen(s);
+	char *ret = (char *)arena_alloc(a, len + 1);
+	if(ret)
+	{
+		memcpy(ret, s, len);
+		ret[len] = 0;
+	}
+	return ret;
+}
+
+struct arena_mark arena_mark(struct arena *a)
+{
+	struct arena_mark m;
+	m.block = a->cur;
+	m.used = a->cur ? a->cur->used : 0;
+	return m;
+}
+
+// Free everything allocated since 'mark' was taken.  Whole blocks created
+// since then are returned to the heap, the block current at the time of
+// the mark is simply rewound.
+void arena_release(struct arena *a, struct arena_mark mark)
+{
+	while(a->cur && (a->cur != mark.block))
+	{
+		struct arena_block *prev = a->cur->prev;
+		free(a->cur);
+		a->cur = prev;
+	}
+
+	if(a->cur)
+		a->cur->used = mark.used;
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Bump-pointer arenas for boot-time allocations
+//
+// An arena hands out memory by advancing a pointer through a list of blocks
+// obtained from malloc().  A caller takes a mark before a phase of work
+// and releases back to it afterwards, freeing everything allocated in
+// between at once, without having to track (or leak) individual
+// allocations.
+//
+// transient_arena is used for scratch data which does not outlive the
+// current phase (config parsing, kernel load, module load).
+// persistent_arena is never released and is used for data which is handed
+// on to the kernel (multiboot info, module list and strings).
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct arena_block;
+
+struct arena
+{
+	struct arena_block *cur;
+	size_t block_size;
+};
+
+struct arena_mark
+{
+	struct arena_block *block;
+	size_t used;
+};
+
+#define ARENA_DEFAULT_BLOCK_SIZE	0x4000
+
+#define ARENA_INIT(bs)		{ .cur = (void *)0, .block_size = (bs) }
+
+extern struct arena transient_arena;
+extern struct arena persistent_arena;
+
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_zalloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+struct arena_mark arena_mark(struct arena *a);
+void arena_release(struct arena *a, struct arena_mark mark);
+
+#endif
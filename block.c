@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "block.h"
+#include "trace.h"
 
 int block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
 {
@@ -35,10 +36,8 @@ int block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t
 		if(to_read > dev->block_size)
 			to_read = dev->block_size;
 
-#ifdef BLOCK_DEBUG
-		printf("block_read: reading %i bytes from block %i on %s\n", to_read,
-				starting_block + block_offset, dev->device_name);
-#endif
+		TRACE_EVENT(BLOCK, TRACE_DEBUG, BLOCK_READ, starting_block + block_offset,
+				to_read);
 
 		int ret = dev->read(dev, &buf[buf_offset], to_read, starting_block + block_offset);
 		if(ret < 0)
@@ -56,3 +55,31 @@ int block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t
 	return buf_offset;
 }
 
+// Start reading whole blocks without waiting for them, if the device supports
+// it; otherwise the read is done immediately.  Returns 0 or a negative error.
+int block_read_start(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
+{
+	TRACE_EVENT(BLOCK, TRACE_DEBUG, BLOCK_READ, starting_block, buf_size);
+
+	if(dev->read_start && (buf_size <= BLOCK_ASYNC_MAX) && !((uint32_t)buf & 0x3))
+		return dev->read_start(dev, buf, buf_size, starting_block);
+
+	int ret = block_read(dev, buf, buf_size, starting_block);
+	return (ret < 0) ? ret : 0;
+}
+
+// Wait for a read begun with block_read_start()
+int block_read_wait(struct block_device *dev)
+{
+	if(dev->read_wait)
+		return dev->read_wait(dev);
+	return 0;
+}
+
+// Returns 1 if a read begun with block_read_start() is still in progress
+int block_read_busy(struct block_device *dev)
+{
+	if(dev->read_busy)
+		return dev->read_busy(dev);
+	return 0;
+}
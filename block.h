@@ -36,10 +36,23 @@ struct block_device {
 	int (*read)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_num);
 	size_t block_size;
 
+	// Optional asynchronous reads.  read_start() begins reading whole blocks
+	// (at most BLOCK_ASYNC_MAX bytes, to a word aligned buffer) and returns
+	// without waiting; read_wait() waits for it to finish.  Only one read
+	// may be outstanding on a device.
+	int (*read_start)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_num);
+	int (*read_wait)(struct block_device *dev);
+	int (*read_busy)(struct block_device *dev);
+
 	struct fs *fs;
 };
 
+#define BLOCK_ASYNC_MAX		0x20000
+
 int block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+int block_read_start(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+int block_read_wait(struct block_device *dev);
+int block_read_busy(struct block_device *dev);
 
 #endif
 
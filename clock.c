@@ -0,0 +1,177 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Clock management via the mailbox property interface
+ *
+ * The firmware starts the ARM at its default (usually lowest) frequency.  For
+ * the duration of the boot we raise it to the maximum the firmware allows,
+ * provided the SoC is not already hot or throttled, and put it back before
+ * handing over to the kernel.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "mbox.h"
+#include "clock.h"
+
+#define TAG_GET_CLOCK_RATE		0x30002
+#define TAG_SET_CLOCK_RATE		0x38002
+#define TAG_GET_MAX_CLOCK_RATE		0x30004
+#define TAG_GET_MIN_CLOCK_RATE		0x30007
+#define TAG_GET_TEMPERATURE		0x30006
+#define TAG_GET_MAX_TEMPERATURE		0x3000a
+#define TAG_GET_THROTTLED		0x30046
+
+// GET_THROTTLED bits which indicate we should not raise the clock
+#define THROTTLED_UNDER_VOLTAGE		(1 << 0)
+#define THROTTLED_FREQ_CAPPED		(1 << 1)
+#define THROTTLED_THROTTLED		(1 << 2)
+#define THROTTLED_SOFT_TEMP_LIMIT	(1 << 3)
+
+// Don't boost if we are within this many millidegrees of the maximum
+#define CLOCK_TEMP_MARGIN		10000
+
+static uint32_t arm_boot_rate = 0;
+
+static uint32_t clock_query(uint32_t tag, uint32_t clock_id)
+{
+	mbox_prop_begin();
+	int t = mbox_prop_add1(tag, 8, clock_id);
+	if(mbox_prop_send() != 0)
+		return 0;
+	return mbox_prop_get(t, 1);
+}
+
+uint32_t clock_get_rate(uint32_t clock_id)
+{
+	return clock_query(TAG_GET_CLOCK_RATE, clock_id);
+}
+
+uint32_t clock_get_min_rate(uint32_t clock_id)
+{
+	return clock_query(TAG_GET_MIN_CLOCK_RATE, clock_id);
+}
+
+uint32_t clock_get_max_rate(uint32_t clock_id)
+{
+	return clock_query(TAG_GET_MAX_CLOCK_RATE, clock_id);
+}
+
+// Returns the rate actually set
+uint32_t clock_set_rate(uint32_t clock_id, uint32_t rate)
+{
+	mbox_prop_begin();
+	int t = mbox_prop_add3(TAG_SET_CLOCK_RATE, 8, clock_id, rate, 0);
+	if(mbox_prop_send() != 0)
+		return 0;
+	return mbox_prop_get(t, 1);
+}
+
+struct clock_tags
+{
+	const char *name;
+	uint32_t clock_id;
+	int cur, min, max;
+};
+
+static struct clock_tags clocks[] =
+{
+	{ "arm", CLOCK_ARM, 0, 0, 0 },
+	{ "core", CLOCK_CORE, 0, 0, 0 },
+	{ "emmc", CLOCK_EMMC, 0, 0, 0 },
+};
+
+#define NUM_CLOCKS	(sizeof(clocks) / sizeof(clocks[0]))
+
+// Raise the ARM clock to its maximum for the rest of the boot.  Returns 0 if
+// the clock was raised.
+int clock_boost()
+{
+	// Gather the clock rates and thermal state in one round trip
+	mbox_prop_begin();
+	for(unsigned int i = 0; i < NUM_CLOCKS; i++)
+	{
+		clocks[i].cur = mbox_prop_add1(TAG_GET_CLOCK_RATE, 8, clocks[i].clock_id);
+		clocks[i].min = mbox_prop_add1(TAG_GET_MIN_CLOCK_RATE, 8, clocks[i].clock_id);
+		clocks[i].max = mbox_prop_add1(TAG_GET_MAX_CLOCK_RATE, 8, clocks[i].clock_id);
+	}
+	int temp_tag = mbox_prop_add1(TAG_GET_TEMPERATURE, 8, 0);
+	int max_temp_tag = mbox_prop_add1(TAG_GET_MAX_TEMPERATURE, 8, 0);
+	int throttled_tag = mbox_prop_add1(TAG_GET_THROTTLED, 4, 0);
+
+	if(mbox_prop_send() != 0)
+	{
+		printf("CLOCK: unable to query clocks\n");
+		return -1;
+	}
+
+	for(unsigned int i = 0; i < NUM_CLOCKS; i++)
+		printf("CLOCK: %s %u MHz (min %u, max %u)\n", clocks[i].name,
+				mbox_prop_get(clocks[i].cur, 1) / 1000000,
+				mbox_prop_get(clocks[i].min, 1) / 1000000,
+				mbox_prop_get(clocks[i].max, 1) / 1000000);
+
+	arm_boot_rate = mbox_prop_get(clocks[0].cur, 1);
+	uint32_t arm_max = mbox_prop_get(clocks[0].max, 1);
+	if(!arm_boot_rate || !arm_max)
+	{
+		printf("CLOCK: unable to query arm clock\n");
+		return -1;
+	}
+	if(arm_max <= arm_boot_rate)
+		return -1;
+
+	// Check we are not too hot
+	uint32_t temp = mbox_prop_get(temp_tag, 1);
+	uint32_t max_temp = mbox_prop_get(max_temp_tag, 1);
+	if(temp && max_temp)
+	{
+		printf("CLOCK: temperature %u.%u C (max %u C)\n", temp / 1000,
+				(temp % 1000) / 100, max_temp / 1000);
+		if((temp + CLOCK_TEMP_MARGIN) >= max_temp)
+		{
+			printf("CLOCK: too hot, not raising arm clock\n");
+			return -1;
+		}
+	}
+
+	// Check we are not being throttled (older firmware doesn't support this
+	// tag, in which case we get 0 back)
+	uint32_t throttled = mbox_prop_get(throttled_tag, 0) &
+		(THROTTLED_UNDER_VOLTAGE | THROTTLED_FREQ_CAPPED |
+		 THROTTLED_THROTTLED | THROTTLED_SOFT_TEMP_LIMIT);
+	if(throttled)
+	{
+		printf("CLOCK: throttled (%x), not raising arm clock\n", throttled);
+		return -1;
+	}
+
+	uint32_t new_rate = clock_set_rate(CLOCK_ARM, arm_max);
+	printf("CLOCK: arm clock set to %u MHz\n", new_rate / 1000000);
+	return (new_rate > arm_boot_rate) ? 0 : -1;
+}
+
+// Put the ARM clock back to the rate the firmware started us at
+void clock_restore()
+{
+	if(arm_boot_rate && (clock_get_rate(CLOCK_ARM) != arm_boot_rate))
+		clock_set_rate(CLOCK_ARM, arm_boot_rate);
+}
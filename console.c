@@ -22,9 +22,12 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "fb.h"
 #include "console.h"
 #include "util.h"
+#include "timer.h"
+#include "memlog.h"
 
 extern uint8_t vgafont8[];
 
@@ -34,24 +37,287 @@ extern uint32_t read_sctlr();
 #define CHAR_W		8
 #define CHAR_H		8
 
-#define DEF_FORE	0xffffffff
-#define DEF_BACK	0x00000000
+// Default attribute: white on black
+#define DEF_ATTR	0x0f
+
+// How often (us) buffered console output is rendered to the framebuffer
+#define CONSOLE_FLUSH_INTERVAL	50000
+
+/* Shadow text grid
+ *
+ * Output is written to a grid of character cells in normal RAM and only
+ * rendered to the framebuffer by console_flush(), which is called
+ * periodically from console_putc(), from console_poll() while the loader is
+ * busy without printing (e.g. loading a large file) and explicitly at
+ * important points (before each config line, before handing over to the
+ * kernel, on abort).  Each row of the grid records the
+ * range of columns changed since the last flush, so rendering cost depends on
+ * what actually changed on screen rather than on how much was printed.
+ *
+ * The grid is a ring of rows: scrolling advances top_row and counts a pending
+ * scroll, which is applied to the framebuffer in one step at the next flush.
+ */
+struct cell
+{
+	uint8_t ch;
+	uint8_t attr;		// foreground in low nibble, background in high
+};
+
+static struct cell *cells = (void*)0;
+static int *dirty_lo = (void*)0;
+static int *dirty_hi = (void*)0;
+static int cols = 0;
+static int rows = 0;
+static int top_row = 0;			// ring index of the top screen row
+static int pending_scroll = 0;		// rows scrolled since last flush
+static int full_redraw = 0;
+static int immediate = 0;
+static uint64_t last_flush = 0;
+
+// Start the console after this long (us) even if nothing has asked for it
+#define CONSOLE_DEFER_TIME	2000000
+
+#define CONSOLE_DEFERRED	0
+#define CONSOLE_STARTING	1
+#define CONSOLE_ACTIVE		2
+#define CONSOLE_HEADLESS	3
+
+#ifdef HEADLESS
+static int console_state = CONSOLE_HEADLESS;
+#else
+static int console_state = CONSOLE_DEFERRED;
+#endif
+static uint64_t defer_start = 0;
 
 static int cur_x = 0;
 static int cur_y = 0;
+static uint8_t cur_attr = DEF_ATTR;
 
-static uint32_t cur_fore = DEF_FORE;
-static uint32_t cur_back = DEF_BACK;
+// Standard VGA text palette, as 0xRRGGBB
+static const uint32_t vga_palette[16] =
+{
+	0x000000, 0x0000aa, 0x00aa00, 0x00aaaa, 0xaa0000, 0xaa00aa, 0xaa5500, 0xaaaaaa,
+	0x555555, 0x5555ff, 0x55ff55, 0x55ffff, 0xff5555, 0xff55ff, 0xffff55, 0xffffff
+};
 
-void clear()
+static uint32_t palette[16];
+static int palette_bpp = 0;
+
+static void build_palette(int bpp)
+{
+	for(int i = 0; i < 16; i++)
+	{
+		uint32_t rgb = vga_palette[i];
+		if(bpp == 16)
+			palette[i] = ((rgb >> 8) & 0xf800) | ((rgb >> 5) & 0x07e0) |
+				((rgb >> 3) & 0x001f);
+		else
+			palette[i] = 0xff000000 | rgb;
+	}
+	palette_bpp = bpp;
+}
+
+/* Scrolling
+ *
+ * The framebuffer is taller than the screen (see fb.c).  The console draws
+ * into a window starting scroll_y lines into it and scrolls by moving the
+ * window down and changing the display offset.  Only when the window reaches
+ * the bottom of the virtual framebuffer is the visible text copied back to
+ * the top.  If the firmware does not honour the offset we fall back to
+ * copying on every scroll.
+ */
+static int scroll_y = 0;
+static int hw_scroll = 1;
+
+// Fills and copies are done by the fb.c blitter, which may still be running
+// when these return
+static void clear_lines(int start, int end)
+{
+	if(end > start)
+		fb_fill_rect(0, start, fb_get_width(), end - start, 0);
+}
+
+// Move the visible text from the current window to dest_y, dropping the first
+// drop_lines lines
+static void move_window(int dest_y, int drop_lines)
+{
+	int text_h = (fb_get_height() / CHAR_H) * CHAR_H;
+
+	if(text_h > drop_lines)
+		fb_copy_rect(0, dest_y, 0, scroll_y + drop_lines, fb_get_width(),
+				text_h - drop_lines);
+}
+
+static void set_window(int y)
+{
+	// Don't show the new area until it has been prepared
+	fb_blit_wait();
+
+	scroll_y = y;
+	if(hw_scroll && (fb_set_virt_offset((uint32_t)y) != 0))
+		hw_scroll = 0;
+}
+
+// Scroll the framebuffer contents up by n character rows (n < rows), leaving
+// the exposed rows blank
+static void fb_scroll(int n)
 {
 	int height = fb_get_height();
-	int pitch = fb_get_pitch();
-	int line_byte_width = fb_get_width() * (fb_get_bpp() >> 3);
-	uint8_t *fb = (uint8_t *)fb_get_framebuffer();
+	int text_h = rows * CHAR_H;
+	int lines = n * CHAR_H;
+
+	if(hw_scroll && ((scroll_y + lines + height) <= fb_get_virt_height()))
+	{
+		// Clear the newly exposed area before showing it
+		int new_y = scroll_y + lines;
+		clear_lines(new_y + text_h - lines, new_y + height);
+		fb_blit_wait();
+		if(fb_set_virt_offset((uint32_t)new_y) == 0)
+		{
+			scroll_y = new_y;
+			return;
+		}
+		hw_scroll = 0;
+	}
+
+	// Out of virtual framebuffer (or no hardware scrolling): copy the
+	// remaining text to the top
+	move_window(0, lines);
+	clear_lines(text_h - lines, height);
+	set_window(0);
+}
+
+static struct cell *grid_row(int screen_row)
+{
+	return &cells[((top_row + screen_row) % rows) * cols];
+}
+
+static void mark_dirty(int ring_row, int lo, int hi)
+{
+	if(lo < dirty_lo[ring_row])
+		dirty_lo[ring_row] = lo;
+	if(hi > dirty_hi[ring_row])
+		dirty_hi[ring_row] = hi;
+}
 
-	for(int line = 0; line < height; line++)
-		memset(&fb[line * pitch], 0, line_byte_width);
+static void clear_grid_row(int ring_row)
+{
+	struct cell *r = &cells[ring_row * cols];
+	for(int x = 0; x < cols; x++)
+	{
+		r[x].ch = ' ';
+		r[x].attr = DEF_ATTR;
+	}
+	dirty_lo[ring_row] = cols;
+	dirty_hi[ring_row] = -1;
+}
+
+// Set up the grid the first time it is needed.  Returns 0 if there is no
+// framebuffer to draw on.
+static int grid_init()
+{
+	if(cells)
+		return 1;
+
+	int new_cols = fb_get_width() / CHAR_W;
+	int new_rows = fb_get_height() / CHAR_H;
+	if((new_cols <= 0) || (new_rows <= 0) || !fb_get_framebuffer())
+		return 0;
+
+	cells = (struct cell *)malloc(new_cols * new_rows * sizeof(struct cell));
+	dirty_lo = (int *)malloc(new_rows * sizeof(int));
+	dirty_hi = (int *)malloc(new_rows * sizeof(int));
+	if(!cells || !dirty_lo || !dirty_hi)
+	{
+		free(cells);
+		free(dirty_lo);
+		free(dirty_hi);
+		cells = (void*)0;
+		return 0;
+	}
+
+	cols = new_cols;
+	rows = new_rows;
+	for(int y = 0; y < rows; y++)
+		clear_grid_row(y);
+	top_row = 0;
+	pending_scroll = 0;
+	full_redraw = 1;
+	return 1;
+}
+
+// Render outstanding changes to the framebuffer
+void console_flush()
+{
+	if(!cells)
+		return;
+
+	int bpp = fb_get_bpp();
+	if(bpp != palette_bpp)
+		build_palette(bpp);
+
+	if(pending_scroll >= rows)
+		full_redraw = 1;
+	else if(pending_scroll && !full_redraw)
+		fb_scroll(pending_scroll);
+	pending_scroll = 0;
+
+	// For a full redraw, fill the window with the default background and then
+	// only draw cells which differ from it
+	int skip_blank = 0;
+	if(full_redraw)
+	{
+		fb_fill_rect(0, scroll_y, fb_get_width(), fb_get_height(),
+				palette[DEF_ATTR >> 4]);
+		for(int y = 0; y < rows; y++)
+			mark_dirty(y, 0, cols - 1);
+		full_redraw = 0;
+		skip_blank = 1;
+	}
+
+	fb_blit_wait();
+
+	for(int y = 0; y < rows; y++)
+	{
+		int ring_row = (top_row + y) % rows;
+		if(dirty_hi[ring_row] < 0)
+			continue;
+
+		struct cell *r = &cells[ring_row * cols];
+		for(int x = dirty_lo[ring_row]; x <= dirty_hi[ring_row]; x++)
+		{
+			if(skip_blank && (r[x].ch == ' ') && (r[x].attr == DEF_ATTR))
+				continue;
+			draw_char((char)r[x].ch, x, y, palette[r[x].attr & 0xf],
+					palette[r[x].attr >> 4]);
+		}
+
+		dirty_lo[ring_row] = cols;
+		dirty_hi[ring_row] = -1;
+	}
+
+	last_flush = timer_get_ticks();
+}
+
+// In immediate mode every character is rendered as it is written.  This is
+// used once the kernel has been started as it may not return to us.
+void console_set_immediate(int enable)
+{
+	immediate = enable;
+	if(enable)
+		console_flush();
+}
+
+void clear()
+{
+	if(!grid_init())
+		return;
+
+	for(int y = 0; y < rows; y++)
+		clear_grid_row(y);
+	top_row = 0;
+	pending_scroll = 0;
+	full_redraw = 1;
 
 	cur_x = 0;
 	cur_y = 0;
@@ -63,46 +329,214 @@ void newline()
 	cur_x = 0;
 
 	// Scroll up if necessary
-	if(cur_y == fb_get_height() / CHAR_H)
+	if(cur_y == rows)
 	{
-		uint8_t *fb = (uint8_t *)fb_get_framebuffer();
-		int line_byte_width = fb_get_width() * (fb_get_bpp() >> 3);
-		int pitch = fb_get_pitch();
-		int height = fb_get_height();
-
-		for(int line = 0; line < (height - CHAR_H); line++)
-			quick_memcpy(&fb[line * pitch], &fb[(line + CHAR_H) * pitch], line_byte_width);
-		for(int line = height - CHAR_H; line < height; line++)
-			memset(&fb[line * pitch], 0, line_byte_width);
+		clear_grid_row(top_row);
+		top_row = (top_row + 1) % rows;
+		pending_scroll++;
 
 		cur_y--;
 	}
 }
 
-int console_putc(int c)
+// Copy the visible text to the top of the framebuffer and reset the display
+// offset, so that the framebuffer passed to the kernel matches the screen
+void console_reset_scroll()
 {
-	int line_w = fb_get_width() / CHAR_W;
+	console_flush();
+	if(scroll_y == 0)
+		return;
+
+	move_window(0, 0);
+	clear_lines((fb_get_height() / CHAR_H) * CHAR_H, fb_get_height());
+	set_window(0);
+	fb_blit_wait();
+}
 
+static void console_put(int c)
+{
 	if(c == '\n')
 		newline();
 	else
 	{
-		draw_char((char)c, cur_x, cur_y, cur_fore, cur_back);
+		struct cell *r = grid_row(cur_y);
+		r[cur_x].ch = (uint8_t)c;
+		r[cur_x].attr = cur_attr;
+		mark_dirty((top_row + cur_y) % rows, cur_x, cur_x);
+
 		cur_x++;
-		if(cur_x == line_w)
+		if(cur_x == cols)
 			newline();
 	}
+}
+
+static void console_check_flush()
+{
+	if(immediate || ((timer_get_ticks() - last_flush) >= CONSOLE_FLUSH_INTERVAL))
+		console_flush();
+}
+
+// Start the console if it has been deferred for too long
+static void console_check_defer()
+{
+	if(console_state != CONSOLE_DEFERRED)
+		return;
+	if(!defer_start)
+		defer_start = timer_get_ticks();
+	else if((timer_get_ticks() - defer_start) >= CONSOLE_DEFER_TIME)
+		console_start();
+}
 
+// Called from loops which may run for a long time without printing anything,
+// so that what was last printed still reaches the screen
+void console_poll()
+{
+	console_check_defer();
+	if((console_state == CONSOLE_ACTIVE) && !immediate)
+		console_check_flush();
+}
+
+int console_putc(int c)
+{
+	if(!grid_init())
+		return c;
+
+	console_put(c);
+	console_check_flush();
 	return c;
 }
 
-void draw_char(char c, int x, int y, uint32_t fore, uint32_t back)
+// Bulk write, used as an output sink
+int console_write(const char *buf, size_t len)
+{
+	if(console_state != CONSOLE_ACTIVE)
+	{
+		// Start anyway if the boot is taking a long time, so that there is
+		// something to look at if it hangs
+		console_check_defer();
+		return (int)len;
+	}
+
+	if(!grid_init())
+		return (int)len;
+
+	for(size_t i = 0; i < len; i++)
+		console_put(buf[i]);
+	console_check_flush();
+	return (int)len;
+}
+
+/* Deferred start and headless mode
+ *
+ * Setting up the framebuffer takes several mailbox round trips and drawing
+ * to it is slow, so the console sink starts out deferred: output is only
+ * recorded in the boot log.  console_start() is called when the screen is
+ * actually needed (before booting a kernel, on error, or if the boot is
+ * taking a long time) and replays the end of the log.  In headless mode the
+ * console never starts and the framebuffer is only set up if a kernel asks
+ * for it.
+ */
+
+struct output_sink console_sink =
+{
+	.name = "console",
+	.write = console_write
+};
+
+void console_start()
+{
+	if(console_state != CONSOLE_DEFERRED)
+		return;
+
+	// Don't recurse while the framebuffer is being set up
+	console_state = CONSOLE_STARTING;
+	if(fb_ensure() != 0 || !grid_init())
+	{
+		console_state = CONSOLE_HEADLESS;
+		return;
+	}
+
+	// Show the last screenful of the log
+	fflush(stdout);
+	console_state = CONSOLE_ACTIVE;
+	memlog_replay((size_t)(rows * cols), console_write);
+	console_flush();
+}
+
+void console_set_headless()
+{
+	console_state = CONSOLE_HEADLESS;
+}
+
+int console_is_headless()
+{
+	return console_state == CONSOLE_HEADLESS;
+}
+
+/* Fast glyph rendering
+ *
+ * Each row of a glyph in vgafont8 is a single byte, so there are only 256
+ * possible rows.  For the current colour pair and depth we expand every
+ * possible row into the exact words that need storing to the framebuffer
+ * (4 words at 16 bpp, 8 words at 32 bpp).  Drawing a character is then 8
+ * table lookups and 32 or 64 word stores.  The table is rebuilt whenever the
+ * colour pair changes.  Other depths use the per-pixel path.
+ */
+
+#define GLYPH_ROW_MAX_WORDS	8		// 8 pixels at 32 bpp
+
+static uint32_t glyph_rows[256 * GLYPH_ROW_MAX_WORDS];
+static int glyph_row_words = 0;			// 0 = table invalid
+static int glyph_bpp;
+static uint32_t glyph_fore, glyph_back;
+
+static void build_glyph_rows(int bpp, uint32_t fore, uint32_t back)
+{
+	glyph_bpp = bpp;
+	glyph_fore = fore;
+	glyph_back = back;
+
+	if(bpp == 16)
+	{
+		fore &= 0xffff;
+		back &= 0xffff;
+		glyph_row_words = 4;
+
+		for(int row = 0; row < 256; row++)
+		{
+			uint32_t *d = &glyph_rows[row * 4];
+			for(int w = 0; w < 4; w++)
+			{
+				// Leftmost pixel is the most significant font bit and is
+				// stored in the lower half of the little-endian word
+				uint32_t lo = (row & (0x80 >> (w * 2))) ? fore : back;
+				uint32_t hi = (row & (0x40 >> (w * 2))) ? fore : back;
+				d[w] = lo | (hi << 16);
+			}
+		}
+	}
+	else if(bpp == 32)
+	{
+		glyph_row_words = 8;
+
+		for(int row = 0; row < 256; row++)
+		{
+			uint32_t *d = &glyph_rows[row * 8];
+			for(int p = 0; p < 8; p++)
+				d[p] = (row & (0x80 >> p)) ? fore : back;
+		}
+	}
+	else
+		glyph_row_words = 0;
+}
+
+static void draw_char_slow(char c, int x, int y, uint32_t fore, uint32_t back)
 {
 	volatile uint8_t *fb = (uint8_t *)fb_get_framebuffer();
 	int bpp = fb_get_bpp();
 	int bytes_per_pixel = bpp >> 3;
 
-	int d_offset = y * CHAR_H * fb_get_pitch() + x * bytes_per_pixel * CHAR_W;
+	int d_offset = (scroll_y + y * CHAR_H) * fb_get_pitch() + x * bytes_per_pixel * CHAR_W;
 	int line_d_offset = d_offset;
 	int s_offset = (int)c * CHAR_W * CHAR_H;
 
@@ -134,6 +568,98 @@ void draw_char(char c, int x, int y, uint32_t fore, uint32_t back)
 	}
 }
 
+void draw_char(char c, int x, int y, uint32_t fore, uint32_t back)
+{
+	int bpp = fb_get_bpp();
+	int pitch = fb_get_pitch();
+
+	if((glyph_row_words == 0) || (bpp != glyph_bpp) || (fore != glyph_fore) ||
+			(back != glyph_back))
+		build_glyph_rows(bpp, fore, back);
+
+	// Word stores need a word aligned framebuffer and pitch
+	uint8_t *fb = fb_get_framebuffer();
+	if((glyph_row_words == 0) || ((uint32_t)fb & 3) || (pitch & 3))
+	{
+		draw_char_slow(c, x, y, fore, back);
+		return;
+	}
+
+	int words = glyph_row_words;
+	int pitch_words = pitch >> 2;
+	uint32_t *d = (uint32_t *)&fb[(scroll_y + y * CHAR_H) * pitch + x * CHAR_W * (bpp >> 3)];
+	uint8_t *s = &vgafont8[((uint8_t)c & 0x7f) * CHAR_H];		// font has 128 glyphs
+
+	for(int c_y = 0; c_y < CHAR_H; c_y++)
+	{
+		uint32_t *row = &glyph_rows[s[c_y] * words];
+
+		d[0] = row[0];
+		d[1] = row[1];
+		d[2] = row[2];
+		d[3] = row[3];
+		if(words == 8)
+		{
+			d[4] = row[4];
+			d[5] = row[5];
+			d[6] = row[6];
+			d[7] = row[7];
+		}
+
+		d += pitch_words;
+	}
+}
+
+#ifdef BENCHMARK
+#define BENCH_CHARS	4096
+
+static uint32_t bench_rate(uint32_t us)
+{
+	return us ? (uint32_t)((uint64_t)BENCH_CHARS * 1000000 / us) : 0;
+}
+
+// Compare the per-pixel and table driven glyph renderers, and the cost of
+// buffered console output
+void console_bench()
+{
+	int line_w = fb_get_width() / CHAR_W;
+	int lines = fb_get_height() / CHAR_H;
+	if(!line_w || !lines)
+		return;
+
+	fb_blit_wait();
+	build_palette(fb_get_bpp());
+	uint32_t fore = palette[DEF_ATTR & 0xf];
+	uint32_t back = palette[DEF_ATTR >> 4];
+
+	uint64_t start = timer_get_ticks();
+	for(int i = 0; i < BENCH_CHARS; i++)
+		draw_char_slow((char)(32 + (i % 95)), i % line_w, (i / line_w) % lines,
+				fore, back);
+	uint32_t slow_us = (uint32_t)(timer_get_ticks() - start);
+
+	start = timer_get_ticks();
+	for(int i = 0; i < BENCH_CHARS; i++)
+		draw_char((char)(32 + (i % 95)), i % line_w, (i / line_w) % lines,
+				fore, back);
+	uint32_t fast_us = (uint32_t)(timer_get_ticks() - start);
+
+	// 80 column lines through the shadow grid, including scrolling
+	start = timer_get_ticks();
+	for(int i = 0; i < BENCH_CHARS; i++)
+		console_putc(((i % 80) == 79) ? '\n' : (32 + (i % 95)));
+	console_flush();
+	uint32_t grid_us = (uint32_t)(timer_get_ticks() - start);
+
+	clear();
+
+	printf("CONSOLE: benchmark %i chars at %i bpp\n", BENCH_CHARS, fb_get_bpp());
+	printf("CONSOLE:  per-pixel: %u us (%u chars/s)\n", slow_us, bench_rate(slow_us));
+	printf("CONSOLE:  table:     %u us (%u chars/s)\n", fast_us, bench_rate(fast_us));
+	printf("CONSOLE:  buffered:  %u us (%u chars/s)\n", grid_us, bench_rate(grid_us));
+}
+#endif
+
 int fb_test(uint32_t fb_addr)
 {
 	volatile uint8_t *bb = (uint8_t *)fb_addr;
@@ -22,8 +22,25 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include <stddef.h>
+
 void clear();
+int console_putc(int c);
+int console_write(const char *buf, size_t len);
+void console_start();
+void console_set_headless();
+int console_is_headless();
+
+struct output_sink;
+extern struct output_sink console_sink;
+void console_reset_scroll();
+void console_flush();
+void console_poll();
+void console_set_immediate(int enable);
 void draw_char(char c, int x, int y, uint32_t fore, uint32_t back);
+#ifdef BENCHMARK
+void console_bench();
+#endif
 
 #endif
 
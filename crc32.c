@@ -0,0 +1,54 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* CRC-32 (reflected, polynomial 0xedb88320), a table lookup per byte */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crc32.h"
+
+static uint32_t crc_table[256];
+static int crc_table_built = 0;
+
+static void build_table()
+{
+	for(uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for(int j = 0; j < 8; j++)
+			c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+		crc_table[i] = c;
+	}
+	crc_table_built = 1;
+}
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	if(!crc_table_built)
+		build_table();
+
+	crc = ~crc;
+	while(len--)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
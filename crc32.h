@@ -19,22 +19,14 @@
  * THE SOFTWARE.
  */
 
-#include <stdint.h>
-#include "mmio.h"
-
-extern void memory_barrier();
+#ifndef CRC32_H
+#define CRC32_H
 
-inline void mmio_write(uint32_t reg, uint32_t data)
-{
-	memory_barrier();
-	*(volatile uint32_t *)(reg) = data;
-	memory_barrier();
-}
+#include <stdint.h>
+#include <stddef.h>
 
-inline uint32_t mmio_read(uint32_t reg)
-{
-	memory_barrier();
-	return *(volatile uint32_t *)(reg);
-	memory_barrier();
-}
+// The CRC-32 used by gzip and zlib.  Start with crc = 0 and pass the result
+// of each call to the next.
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
 
+#endif
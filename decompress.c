@@ -0,0 +1,383 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Compressed payloads
+ *
+ * Kernels and modules may be stored gzip (deflate) or LZ4 frame compressed.
+ * The format is recognised by its magic number.  The compressed file is
+ * read into a scratch chunk at the top of memory through a load pipe and
+ * decoded as it arrives, either straight into its destination
+ * (decompress_begin()/decompress_run(), used for modules) or into a memory
+ * backed FILE (decompress_fopen(), used for kernels, so that ELF and
+ * multiboot headers are parsed from the decompressed image).
+ *
+ * The decompressed size has to be known before decoding starts.  For gzip
+ * it is the ISIZE field at the end of the file; for LZ4 it is the content
+ * size in the frame header if present (taken to cover the whole file), and
+ * otherwise the whole file is read and its frames measured first.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decompress.h"
+#include "inflate.h"
+#include "lz4.h"
+#include "loadpipe.h"
+#include "memchunk.h"
+#include "timer.h"
+#include "trace.h"
+#include "vfs.h"
+#include "fs.h"
+
+#define GZIP_FTEXT		(1 << 0)
+#define GZIP_FHCRC		(1 << 1)
+#define GZIP_FEXTRA		(1 << 2)
+#define GZIP_FNAME		(1 << 3)
+#define GZIP_FCOMMENT		(1 << 4)
+
+static const char *format_names[] = { "none", "gzip", "lz4" };
+
+const char *decompress_format_name(int format)
+{
+	if((format < DECOMP_NONE) || (format > DECOMP_LZ4))
+		return "unknown";
+	return format_names[format];
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+		((uint32_t)p[3] << 24);
+}
+
+// Find the deflate data within a gzip member.  Returns its offset, or 0 if
+// the header is invalid.
+static size_t gzip_data_offset(const uint8_t *src, size_t len)
+{
+	if((len < 18) || (src[2] != 8))
+		return 0;
+
+	uint8_t flg = src[3];
+	size_t p = 10;
+	if(flg & GZIP_FEXTRA)
+	{
+		if(p + 2 > len)
+			return 0;
+		p += 2 + (src[p] | (src[p + 1] << 8));
+	}
+	if(flg & GZIP_FNAME)
+	{
+		while((p < len) && src[p])
+			p++;
+		p++;
+	}
+	if(flg & GZIP_FCOMMENT)
+	{
+		while((p < len) && src[p])
+			p++;
+		p++;
+	}
+	if(flg & GZIP_FHCRC)
+		p += 2;
+
+	if(p + 8 > len)
+		return 0;
+	return p;
+}
+
+// Identify the format of fp from its magic number.  The file is left
+// positioned at the start.
+int decompress_format(FILE *fp)
+{
+	uint8_t magic[4];
+	fseek(fp, 0, SEEK_SET);
+	size_t n = fread(magic, 1, 4, fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if((n >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b))
+		return DECOMP_GZIP;
+	if((n == 4) && (read32(magic) == LZ4_FRAME_MAGIC))
+		return DECOMP_LZ4;
+	return DECOMP_NONE;
+}
+
+// Identify the format of fp and, if it is compressed, start reading it into
+// memory and work out its decompressed size.  Returns the format, or a
+// negative error.  If the file is not compressed it is left positioned at
+// the start.
+int decompress_begin(FILE *fp, struct decomp_stream *ds)
+{
+	memset(ds, 0, sizeof(struct decomp_stream));
+
+	ds->format = decompress_format(fp);
+	if(ds->format == DECOMP_NONE)
+		return DECOMP_NONE;
+
+	ds->src_len = (size_t)fp->len;
+	if((ds->format == DECOMP_GZIP) && (ds->src_len >= 18))
+	{
+		// ISIZE is the size modulo 2^32, which is all we can address
+		uint8_t isize[4];
+		fseek(fp, (long)ds->src_len - 4, SEEK_SET);
+		if(fread(isize, 1, 4, fp) != 4)
+			return DECOMP_ERR_READ;
+		ds->out_len = read32(isize);
+	}
+
+	ds->src_chunk = chunk_get_scratch_chunk((uint32_t)ds->src_len);
+	if(!ds->src_chunk)
+		return DECOMP_ERR_NO_MEMORY;
+	ds->src = (const uint8_t *)ds->src_chunk;
+
+	fseek(fp, 0, SEEK_SET);
+	if(loadpipe_begin(&ds->pipe, fp, (void *)ds->src, ds->src_len) != 0)
+	{
+		decompress_end(ds);
+		return DECOMP_ERR_READ;
+	}
+
+	// The headers are within the first transfer
+	size_t have = loadpipe_wait(&ds->pipe, 1);
+	if(ds->format == DECOMP_GZIP)
+	{
+		ds->data_offset = gzip_data_offset(ds->src, have);
+		if(!ds->data_offset && (have < ds->src_len))
+			ds->data_offset = gzip_data_offset(ds->src,
+					loadpipe_wait(&ds->pipe, ds->src_len));
+		if(!ds->data_offset)
+		{
+			decompress_end(ds);
+			return DECOMP_ERR_BAD_DATA;
+		}
+	}
+	else
+	{
+		// Measure the frames.  A frame's content size field only covers
+		// that frame and a file may hold several, so it is only trusted
+		// frame by frame; frames without one have their sequences parsed.
+		// Either is cheap next to decoding, but needs the whole file first.
+		if((loadpipe_wait(&ds->pipe, ds->src_len) != ds->src_len) ||
+				(lz4_frame_decode((void *)0, 0, ds->src, ds->src_len,
+					&ds->out_len) != LZ4_OK))
+		{
+			decompress_end(ds);
+			return DECOMP_ERR_BAD_DATA;
+		}
+	}
+
+	return ds->format;
+}
+
+// Called by the decoders when they run out of input
+static size_t decompress_wait(void *ctx, size_t need)
+{
+	struct decomp_stream *ds = (struct decomp_stream *)ctx;
+	size_t have = loadpipe_wait(&ds->pipe, ds->data_offset + need);
+	return (have > ds->data_offset) ? have - ds->data_offset : 0;
+}
+
+// Decode into dst, which must be at least ds->out_len bytes
+int decompress_run(struct decomp_stream *ds, void *dst)
+{
+	size_t out_len = 0;
+	int ret;
+
+	uint64_t start = timer_get_ticks();
+	if(ds->format == DECOMP_GZIP)
+	{
+		size_t p = ds->data_offset;
+		ret = inflate_stream((uint8_t *)dst, ds->out_len, &ds->src[p],
+				ds->src_len - p - 8, decompress_wait, ds, &out_len);
+		ret = (ret == INFLATE_OK) ? 0 : DECOMP_ERR_BAD_DATA;
+	}
+	else if(ds->format == DECOMP_LZ4)
+	{
+		ret = lz4_frame_decode_stream((uint8_t *)dst, ds->out_len, ds->src,
+				ds->src_len, decompress_wait, ds, &out_len);
+		if(ret == LZ4_UNSUPPORTED)
+			ret = DECOMP_ERR_UNSUPPORTED;
+		else
+			ret = (ret == LZ4_OK) ? 0 : DECOMP_ERR_BAD_DATA;
+	}
+	else
+		ret = DECOMP_ERR_UNSUPPORTED;
+	uint32_t decode_time = (uint32_t)(timer_get_ticks() - start);
+
+	if(loadpipe_end(&ds->pipe, decompress_format_name(ds->format)) != 0)
+		ret = DECOMP_ERR_READ;
+	if((ret == 0) && (out_len != ds->out_len))
+		ret = DECOMP_ERR_BAD_DATA;
+
+	TRACE(MULTIBOOT, TRACE_INFO, "DECOMP: %s %u -> %u bytes, decode %u us\n",
+			decompress_format_name(ds->format), ds->src_len, out_len,
+			decode_time);
+	return ret;
+}
+
+void decompress_end(struct decomp_stream *ds)
+{
+	loadpipe_end(&ds->pipe, decompress_format_name(ds->format));
+	if(ds->src_chunk)
+		chunk_free(ds->src_chunk);
+	ds->src_chunk = 0;
+	ds->src = (void *)0;
+}
+
+// Memory backed files, holding a decompressed image
+struct memfile
+{
+	struct fs fs;
+	uint32_t chunk;
+};
+
+static size_t memfile_fread(struct fs *fs, void *ptr, size_t size, size_t nmemb,
+		FILE *stream)
+{
+	struct memfile *mf = (struct memfile *)fs;
+	size_t len = size * nmemb;
+	memcpy(ptr, (void *)(mf->chunk + (uint32_t)stream->pos), len);
+	return len;
+}
+
+static int memfile_fclose(struct fs *fs, FILE *fp)
+{
+	struct memfile *mf = (struct memfile *)fs;
+	(void)fp;
+	chunk_free(mf->chunk);
+	free(mf);
+	return 0;
+}
+
+// If fp is compressed, decompress it and return a memory backed file with
+// the contents, closing fp.  Otherwise return fp itself.  Returns null on
+// error.
+FILE *decompress_fopen(FILE *fp)
+{
+	struct decomp_stream ds;
+	int format = decompress_begin(fp, &ds);
+	if(format == DECOMP_NONE)
+		return fp;
+	if(format < 0)
+	{
+		printf("DECOMP: unable to read compressed file (%i)\n", format);
+		fclose(fp);
+		return (void *)0;
+	}
+
+	uint32_t chunk = chunk_get_top_chunk((uint32_t)ds.out_len);
+	if(!chunk)
+	{
+		printf("DECOMP: unable to allocate %u bytes\n", ds.out_len);
+		decompress_end(&ds);
+		fclose(fp);
+		return (void *)0;
+	}
+
+	int ret = decompress_run(&ds, (void *)chunk);
+	decompress_end(&ds);
+	if(ret != 0)
+	{
+		printf("DECOMP: %s data is corrupt (%i)\n",
+				decompress_format_name(format), ret);
+		chunk_free(chunk);
+		fclose(fp);
+		return (void *)0;
+	}
+
+	struct memfile *mf = (struct memfile *)malloc(sizeof(struct memfile));
+	memset(mf, 0, sizeof(struct memfile));
+	mf->fs.parent = fp->fs->parent;
+	mf->fs.fs_name = fp->fs->fs_name;
+	mf->fs.fread = memfile_fread;
+	mf->fs.fclose = memfile_fclose;
+	mf->chunk = chunk;
+
+	struct vfs_file *ret_fp = (struct vfs_file *)malloc(sizeof(struct vfs_file));
+	memset(ret_fp, 0, sizeof(struct vfs_file));
+	ret_fp->fs = &mf->fs;
+	ret_fp->pos = 0;
+	ret_fp->len = (long)ds.out_len;
+	ret_fp->opaque = mf;
+
+	fclose(fp);
+	return ret_fp;
+}
+
+#ifdef BENCHMARK
+static uint32_t kib_per_sec(size_t bytes, uint32_t usec)
+{
+	if(!usec)
+		return 0;
+	return (uint32_t)(((uint64_t)bytes * 1000000 / usec) >> 10);
+}
+
+// Compare loading the same payload stored uncompressed and in each supported
+// format.  Looks for bench.bin, bench.gz and bench.lz4 on the default device.
+void decompress_bench()
+{
+	static const char *names[] = { "bench.bin", "bench.gz", "bench.lz4" };
+
+	for(unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		FILE *fp = fopen(names[i], "r");
+		if(!fp)
+			continue;
+
+		uint64_t start = timer_get_ticks();
+		struct decomp_stream ds;
+		int format = decompress_begin(fp, &ds);
+		if(format == DECOMP_NONE)
+		{
+			uint32_t chunk = chunk_get_top_chunk((uint32_t)fp->len);
+			if(chunk)
+			{
+				loadpipe_read(fp, (void *)chunk, (size_t)fp->len, names[i]);
+				uint32_t t = (uint32_t)(timer_get_ticks() - start);
+				printf("BENCH: %s: uncompressed %u bytes, read %u us "
+						"(%u KiB/s)\n", names[i], (uint32_t)fp->len, t,
+						kib_per_sec((size_t)fp->len, t));
+				chunk_free(chunk);
+			}
+		}
+		else if(format > 0)
+		{
+			uint32_t chunk = chunk_get_top_chunk((uint32_t)ds.out_len);
+			if(chunk)
+			{
+				int ret = decompress_run(&ds, (void *)chunk);
+				uint32_t t = (uint32_t)(timer_get_ticks() - start);
+				printf("BENCH: %s: %s %u -> %u bytes in %u us, decode "
+						"%u us, waiting for card %u us (%u KiB/s)%s\n",
+						names[i], decompress_format_name(format),
+						ds.src_len, ds.out_len, t, ds.pipe.stats.cpu_busy,
+						ds.pipe.stats.cpu_wait, kib_per_sec(ds.out_len, t),
+						(ret == 0) ? "" : " - corrupt");
+				chunk_free(chunk);
+			}
+			decompress_end(&ds);
+		}
+		fclose(fp);
+	}
+}
+#endif
@@ -0,0 +1,65 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "loadpipe.h"
+
+// Payload formats, detected by magic number
+#define DECOMP_NONE		0
+#define DECOMP_GZIP		1
+#define DECOMP_LZ4		2
+
+// Errors
+#define DECOMP_ERR_READ		-1
+#define DECOMP_ERR_NO_MEMORY	-2
+#define DECOMP_ERR_BAD_DATA	-3
+#define DECOMP_ERR_UNSUPPORTED	-4
+
+// A compressed file being read into memory through a load pipe, ready to
+// be decoded as it arrives
+struct decomp_stream
+{
+	int format;
+	const uint8_t *src;
+	size_t src_len;
+	uint32_t src_chunk;
+	size_t data_offset;	// start of the deflate data in a gzip file
+	size_t out_len;		// decompressed size
+	struct loadpipe pipe;
+};
+
+int decompress_format(FILE *fp);
+int decompress_begin(FILE *fp, struct decomp_stream *ds);
+int decompress_run(struct decomp_stream *ds, void *dst);
+void decompress_end(struct decomp_stream *ds);
+FILE *decompress_fopen(FILE *fp);
+const char *decompress_format_name(int format);
+
+#ifdef BENCHMARK
+void decompress_bench();
+#endif
+
+#endif
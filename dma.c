@@ -0,0 +1,151 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Minimal driver for the BCM2835 DMA controller
+ *
+ * Channels are handed out from those the firmware reports as free for the
+ * ARM to use.  Channels 0-6 are full channels; 7-14 are 'lite' channels
+ * which do not support 2D mode or wide bursts.  Channel 15 is not used.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "dma.h"
+#include "mbox.h"
+#include "mmio.h"
+#include "timer.h"
+#include "trace.h"
+
+#define DMA_BASE		0x20007000
+#define DMA_CHAN(n)		(DMA_BASE + ((n) * 0x100))
+#define DMA_ENABLE		(DMA_BASE + 0xff0)
+
+#define DMA_CS			0x00
+#define DMA_CONBLK_AD		0x04
+#define DMA_DBG			0x20
+
+#define DMA_CS_ACTIVE		(1 << 0)
+#define DMA_CS_END		(1 << 1)
+#define DMA_CS_INT		(1 << 2)
+#define DMA_CS_ERROR		(1 << 8)
+#define DMA_CS_PRIORITY(x)	(((x) & 0xf) << 16)
+#define DMA_CS_WAIT_WRITES	(1 << 28)
+#define DMA_CS_ABORT		(1 << 30)
+#define DMA_CS_RESET		(1 << 31)
+
+#define DMA_NUM_CHANNELS	15
+#define DMA_NUM_FULL_CHANNELS	7
+
+#define TAG_GET_DMA_CHANNELS	0x60001
+
+static int dma_inited = 0;
+static uint32_t dma_free_mask = 0;
+
+static void dma_init()
+{
+	dma_inited = 1;
+
+	mbox_prop_begin();
+	int t = mbox_prop_add0(TAG_GET_DMA_CHANNELS, 4);
+	if(mbox_prop_send() != 0)
+	{
+		printf("DMA: unable to query available channels\n");
+		return;
+	}
+	dma_free_mask = mbox_prop_get(t, 0) & ((1 << DMA_NUM_CHANNELS) - 1);
+
+	TRACE(DMA, TRACE_DEBUG, "DMA: available channels %x\n", dma_free_mask);
+}
+
+// Reserve a channel.  Returns the channel number or DMA_ERR_NO_CHANNEL.
+int dma_alloc_channel(int flags)
+{
+	if(!dma_inited)
+		dma_init();
+
+	int max_chan = (flags & DMA_CHAN_FULL) ? DMA_NUM_FULL_CHANNELS : DMA_NUM_CHANNELS;
+
+	// Prefer lite channels for jobs which don't need a full one
+	for(int i = 0; i < max_chan; i++)
+	{
+		int chan = (flags & DMA_CHAN_FULL) ? i : (DMA_NUM_CHANNELS - 1 - i);
+		if(dma_free_mask & (1 << chan))
+		{
+			dma_free_mask &= ~(1 << chan);
+
+			mmio_write(DMA_ENABLE, mmio_read(DMA_ENABLE) | (1 << chan));
+			mmio_write(DMA_CHAN(chan) + DMA_CS, DMA_CS_RESET);
+			return chan;
+		}
+	}
+	return DMA_ERR_NO_CHANNEL;
+}
+
+void dma_start(int chan, struct dma_cb *cb)
+{
+	mmio_barrier();
+	mmio_write_relaxed(DMA_CHAN(chan) + DMA_CS, DMA_CS_END | DMA_CS_INT);
+	mmio_write_relaxed(DMA_CHAN(chan) + DMA_CONBLK_AD, DMA_BUS_ADDR(cb));
+	mmio_write_relaxed(DMA_CHAN(chan) + DMA_CS, DMA_CS_ACTIVE | DMA_CS_WAIT_WRITES |
+			DMA_CS_PRIORITY(8));
+	mmio_barrier();
+}
+
+// Returns 1 if memory may be handed to the DMA engine as it is: the MMU and
+// data cache are off, so addresses are physical and nothing is cached.  Once a
+// kernel has turned either on this is no longer true and callers must use the
+// CPU instead.
+int dma_memory_direct()
+{
+	uint32_t sctlr;
+	asm volatile("mrc p15, #0, %[sctlr], c1, c0, #0" : [sctlr]"=r"(sctlr));
+	return (sctlr & ((1 << 0) | (1 << 2))) ? 0 : 1;
+}
+
+int dma_busy(int chan)
+{
+	return (mmio_read(DMA_CHAN(chan) + DMA_CS) & DMA_CS_ACTIVE) ? 1 : 0;
+}
+
+// Wait for the transfer on a channel to complete
+int dma_wait(int chan, int usec)
+{
+	uint32_t cs = 0;
+	TIMEOUT_WAIT(!((cs = mmio_read_relaxed(DMA_CHAN(chan) + DMA_CS)) & DMA_CS_ACTIVE), usec);
+	mmio_barrier();
+
+	if(cs & DMA_CS_ACTIVE)
+	{
+		printf("DMA: timeout on channel %i\n", chan);
+		mmio_write(DMA_CHAN(chan) + DMA_CS, DMA_CS_ABORT);
+		return DMA_ERR_TIMEOUT;
+	}
+	if(cs & DMA_CS_ERROR)
+	{
+		printf("DMA: error on channel %i, debug %x\n", chan,
+				mmio_read(DMA_CHAN(chan) + DMA_DBG));
+		mmio_write(DMA_CHAN(chan) + DMA_CS, DMA_CS_RESET);
+		return DMA_ERR_BUS;
+	}
+
+	mmio_write(DMA_CHAN(chan) + DMA_CS, DMA_CS_END | DMA_CS_INT);
+	return 0;
+}
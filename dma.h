@@ -0,0 +1,87 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+
+// Converts an ARM physical address to a bus address for the DMA engine
+#define DMA_BUS_ADDR(x)		((uint32_t)(x) | 0x40000000)
+
+// Converts a peripheral ARM physical address to its bus address
+#define DMA_PERIPH_BUS_ADDR(x)	(((uint32_t)(x) & 0x00ffffff) | 0x7e000000)
+
+// Peripheral DREQ numbers for DMA_TI_PERMAP
+#define DMA_DREQ_EMMC		11
+#define DMA_DREQ_UART_TX	12
+#define DMA_DREQ_UART_RX	14
+
+// Transfer information (TI) bits
+#define DMA_TI_INTEN		(1 << 0)
+#define DMA_TI_TDMODE		(1 << 1)
+#define DMA_TI_WAIT_RESP	(1 << 3)
+#define DMA_TI_DEST_INC		(1 << 4)
+#define DMA_TI_DEST_WIDTH	(1 << 5)
+#define DMA_TI_DEST_DREQ	(1 << 6)
+#define DMA_TI_DEST_IGNORE	(1 << 7)
+#define DMA_TI_SRC_INC		(1 << 8)
+#define DMA_TI_SRC_WIDTH	(1 << 9)
+#define DMA_TI_SRC_DREQ		(1 << 10)
+#define DMA_TI_SRC_IGNORE	(1 << 11)
+#define DMA_TI_BURST(x)		(((x) & 0xf) << 12)
+#define DMA_TI_PERMAP(x)	(((x) & 0x1f) << 16)
+#define DMA_TI_NO_WIDE_BURSTS	(1 << 26)
+
+// 2D mode transfer length and stride
+#define DMA_TXFR_LEN_2D(xbytes, ylines)	((((ylines) - 1) << 16) | ((xbytes) & 0xffff))
+#define DMA_STRIDE(d, s)	((((uint32_t)(d) & 0xffff) << 16) | ((uint32_t)(s) & 0xffff))
+
+// Maximum 2D transfer sizes
+#define DMA_MAX_XLENGTH		0xffff
+#define DMA_MAX_YLENGTH		0x3fff
+
+// Flags to dma_alloc_channel()
+#define DMA_CHAN_FULL		1	// need a full (not lite) channel, e.g. for 2D mode
+
+#define DMA_ERR_NO_CHANNEL	-1
+#define DMA_ERR_TIMEOUT		-2
+#define DMA_ERR_BUS		-3
+
+// A control block.  These must be 32 byte aligned.
+struct dma_cb
+{
+	uint32_t ti;
+	uint32_t source_ad;
+	uint32_t dest_ad;
+	uint32_t txfr_len;
+	uint32_t stride;
+	uint32_t nextconbk;
+	uint32_t reserved[2];
+} __attribute__((aligned(32)));
+
+int dma_alloc_channel(int flags);
+void dma_start(int chan, struct dma_cb *cb);
+int dma_busy(int chan);
+int dma_memory_direct();
+int dma_wait(int chan, int usec);
+
+#endif
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "elf.h"
+#include "loadpipe.h"
+#include "trace.h"
 
 int elf32_read_ehdr(FILE *fp, Elf32_Ehdr **ehdr)
 {
@@ -90,25 +92,6 @@ int elf32_read_shdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **shdrs)
 	return ELF_OK;
 }
 
-int elf32_load_section(FILE *fp, Elf32_Shdr *shdr)
-{
-	if(shdr->sh_type == SHT_NOBITS)
-		memset((void*)shdr->sh_addr, 0, shdr->sh_size);
-	else
-	{
-		if(!shdr->sh_offset)
-			return ELF_NO_OFFSET;
-
-		fseek(fp, (long)shdr->sh_offset, SEEK_SET);
-		size_t bytes_to_read = (size_t)shdr->sh_size;
-		size_t bytes_read = fread((void *)shdr->sh_addr,
-				1, bytes_to_read, fp);
-		if(bytes_to_read != bytes_read)
-			return ELF_FILE_LOAD_ERROR;
-	}
-	return ELF_OK;
-}
-
 int elf32_read_phdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **phdrs)
 {
 	size_t bytes_to_load = (size_t)(ehdr->e_phentsize * ehdr->e_phnum);
@@ -123,26 +106,125 @@ int elf32_read_phdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **phdrs)
 	return ELF_OK;
 }
 
-int elf32_load_segment(FILE *fp, Elf32_Phdr *phdr)
+/* Load plans
+ *
+ * Rather than seeking to and reading each section or segment in table order
+ * the regions to load are collected first.  elf32_plan_load() then sorts them
+ * by file offset and reads the file once from front to back, merging regions
+ * that are adjacent or overlapping in the file and land at the same relative
+ * place in memory into a single read through a load pipe.  Zero filled parts (.bss) are cleared
+ * in a final pass.
+ */
+
+int elf32_plan_init(struct elf32_load_plan *plan, int max_regions)
 {
-	uint32_t load_address = phdr->p_vaddr;
-	if(phdr->p_filesz)
+	plan->count = 0;
+	plan->size = max_regions;
+	plan->regions = (struct elf32_load_region *)malloc((size_t)max_regions *
+			sizeof(struct elf32_load_region));
+	if(!plan->regions)
+		return ELF_OUT_OF_MEMORY;
+	return ELF_OK;
+}
+
+void elf32_plan_free(struct elf32_load_plan *plan)
+{
+	free(plan->regions);
+	plan->regions = (void*)0;
+	plan->count = 0;
+	plan->size = 0;
+}
+
+static int elf32_plan_add(struct elf32_load_plan *plan, Elf32_Off offset,
+		Elf32_Addr addr, Elf32_Word filesz, Elf32_Word memsz)
+{
+	if(plan->count >= plan->size)
+		return ELF_OUT_OF_MEMORY;
+
+	struct elf32_load_region *r = &plan->regions[plan->count++];
+	r->offset = offset;
+	r->addr = addr;
+	r->filesz = filesz;
+	r->memsz = memsz;
+	return ELF_OK;
+}
+
+int elf32_plan_add_section(struct elf32_load_plan *plan, Elf32_Shdr *shdr)
+{
+	if(shdr->sh_type == SHT_NOBITS)
+		return elf32_plan_add(plan, 0, shdr->sh_addr, 0, shdr->sh_size);
+	if(!shdr->sh_offset)
+		return ELF_NO_OFFSET;
+	return elf32_plan_add(plan, shdr->sh_offset, shdr->sh_addr,
+			shdr->sh_size, shdr->sh_size);
+}
+
+int elf32_plan_add_segment(struct elf32_load_plan *plan, Elf32_Phdr *phdr)
+{
+	return elf32_plan_add(plan, phdr->p_offset, phdr->p_vaddr,
+			phdr->p_filesz, phdr->p_memsz);
+}
+
+int elf32_plan_load(FILE *fp, struct elf32_load_plan *plan)
+{
+	struct elf32_load_region *r = plan->regions;
+	int count = plan->count;
+
+	// Sort by file offset.  There are only ever a handful of regions.
+	for(int i = 1; i < count; i++)
 	{
-		// Load the file image
-		fseek(fp, (long)phdr->p_offset, SEEK_SET);
-		size_t bytes_to_load = (size_t)phdr->p_filesz;
-		size_t bytes_read = fread((void*)load_address, 1,
-				bytes_to_load, fp);
-		if(bytes_read != bytes_to_load)
+		struct elf32_load_region cur = r[i];
+		int j = i - 1;
+		while((j >= 0) && (r[j].offset > cur.offset))
+		{
+			r[j + 1] = r[j];
+			j--;
+		}
+		r[j + 1] = cur;
+	}
+
+	int i = 0;
+	while(i < count)
+	{
+		if(!r[i].filesz)
+		{
+			i++;
+			continue;
+		}
+
+		// Extend the read over every following region that continues it
+		// both in the file and in memory
+		uint32_t start = r[i].offset;
+		uint32_t end = start + r[i].filesz;
+		uint32_t delta = r[i].addr - start;
+		int j = i + 1;
+		while((j < count) && (r[j].offset <= end) &&
+				(r[j].addr - r[j].offset == delta))
+		{
+			if(r[j].offset + r[j].filesz > end)
+				end = r[j].offset + r[j].filesz;
+			j++;
+		}
+
+		TRACE_EVENT(MULTIBOOT, TRACE_DEBUG, ELF_READ, start, end - start);
+
+		fseek(fp, (long)start, SEEK_SET);
+		size_t bytes_to_read = (size_t)(end - start);
+		size_t bytes_read = loadpipe_read(fp, (void *)(start + delta),
+				bytes_to_read, "ELF");
+		if(bytes_read != bytes_to_read)
 			return ELF_FILE_LOAD_ERROR;
-		load_address += phdr->p_filesz;
+
+		i = j;
 	}
-	if(phdr->p_memsz - phdr->p_filesz)
+
+	// Zero out the rest of each memory image
+	for(i = 0; i < count; i++)
 	{
-		// Zero out the rest of the memory image
-		memset((void*)load_address, 0, phdr->p_memsz -
-				phdr->p_filesz);
+		if(r[i].memsz > r[i].filesz)
+			memset((void *)(r[i].addr + r[i].filesz), 0,
+					r[i].memsz - r[i].filesz);
 	}
+
 	return ELF_OK;
 }
-
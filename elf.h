@@ -233,11 +233,32 @@ typedef struct
 #define DT_STRTAB			5
 #define DT_SYMTAB			6
 
+// A region of the file to be loaded to memory, followed by memsz - filesz
+// bytes of zeros
+struct elf32_load_region
+{
+	Elf32_Off offset;
+	Elf32_Addr addr;
+	Elf32_Word filesz;
+	Elf32_Word memsz;
+};
+
+struct elf32_load_plan
+{
+	struct elf32_load_region *regions;
+	int count;
+	int size;
+};
+
 int elf32_read_ehdr(FILE *fp, Elf32_Ehdr **ehdr);
 int elf32_read_shdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **shdrs);
-int elf32_load_section(FILE *fp, Elf32_Shdr *shdr);
 int elf32_read_phdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **phdrs);
-int elf32_load_segment(FILE *fp, Elf32_Phdr *phdr);
+
+int elf32_plan_init(struct elf32_load_plan *plan, int max_regions);
+int elf32_plan_add_section(struct elf32_load_plan *plan, Elf32_Shdr *shdr);
+int elf32_plan_add_segment(struct elf32_load_plan *plan, Elf32_Phdr *phdr);
+int elf32_plan_load(FILE *fp, struct elf32_load_plan *plan);
+void elf32_plan_free(struct elf32_load_plan *plan);
 
 // Error return from the above functions
 #define ELF_OK				0
@@ -248,6 +269,7 @@ int elf32_load_segment(FILE *fp, Elf32_Phdr *phdr);
 #define ELF_NOT_ARM			-5
 #define ELF_FILE_LOAD_ERROR		-6
 #define ELF_NO_OFFSET			-7
+#define ELF_OUT_OF_MEMORY		-8
 
 
 
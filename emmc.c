@@ -37,10 +37,8 @@
 #include "mmio.h"
 #include "block.h"
 #include "timer.h"
-
-#ifdef DEBUG2
-#define EMMC_DEBUG
-#endif
+#include "trace.h"
+#include "dma.h"
 
 static char driver_name[] = "emmc";
 static char device_name[] = "emmc0";	// We use a single device name as there is only
@@ -59,6 +57,8 @@ struct emmc_block_dev
 	uint32_t card_rca;
 	uint32_t last_interrupt;
 	uint32_t last_error;
+	uint32_t async_block_no;
+	uint32_t async_blocks;
 };
 
 #define EMMC_BASE		0x20300000
@@ -112,11 +112,24 @@ struct emmc_block_dev
 #define SD_BLKCNT_EN		(1 << 1)
 
 int sd_read(struct block_device *, uint8_t *, size_t buf_size, uint32_t);
+int sd_read_start(struct block_device *, uint8_t *, size_t buf_size, uint32_t);
+int sd_read_wait(struct block_device *);
+int sd_read_busy(struct block_device *);
+
+// Multi-block reads are split into one DMA control block per 64 blocks,
+// which keeps each within the 64 KiB limit of a lite channel
+#define SD_DMA_CB_BLOCKS	64
+#define SD_DMA_CBS		(BLOCK_ASYNC_MAX / (SD_DMA_CB_BLOCKS * 512))
+
+static int sd_dma_chan = DMA_ERR_NO_CHANNEL;
+static int sd_dma_tried = 0;
+static struct dma_cb sd_dma_cbs[SD_DMA_CBS];
 
 static void sd_send_command(uint32_t command)
 {
 	// Wait for the CMD inhibit bit to clear
-	while(mmio_read(EMMC_BASE + EMMC_STATUS) & 0x1)
+	mmio_barrier();
+	while(mmio_read_relaxed(EMMC_BASE + EMMC_STATUS) & 0x1)
 		usleep(1000);
 
 	// Send the command
@@ -136,25 +149,27 @@ static int sd_wait_response(useconds_t usec, struct emmc_block_dev *dev)
 
 	if(usec == 0)
 	{
-		while((mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x1) == 0)
+		mmio_barrier();
+		uint32_t irpt;
+		while(((irpt = mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT)) & 0x1) == 0)
 		{
-			error = mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x8000;
+			error = irpt & 0x8000;
 			if(error)
 				break;
 		}
+		mmio_barrier();
 		if(!error)
 			response = 1;
 	}
 	else
 	{
-		TIMEOUT_WAIT(mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x1, usec);
+		TIMEOUT_WAIT(mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT) & 0x1, usec);
 		response = mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x1;
 		error = mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x8000;
-#ifdef EMMC_DEBUG
 		if(!response)
-			printf("SD: no command result received, interrupt: %08x\n",
+			TRACE(EMMC, TRACE_DEBUG, "SD: no command result received, "
+					"interrupt: %08x\n",
 					mmio_read(EMMC_BASE + EMMC_INTERRUPT));
-#endif
 	}
 
 	if(error)
@@ -198,74 +213,59 @@ int sd_card_init(struct block_device **dev)
 	}
 
 	// Reset the controller
-#ifdef EMMC_DEBUG
-	printf("EMMC: resetting controller\n");
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: resetting controller\n");
 	uint32_t control1 = mmio_read(EMMC_BASE + EMMC_CONTROL1);
 	control1 |= (1 << 24);
 	mmio_write(EMMC_BASE + EMMC_CONTROL1, control1);
-	TIMEOUT_WAIT((mmio_read(EMMC_BASE + EMMC_CONTROL1) & (0x7 << 24)) == 0, 1000000);
+	TIMEOUT_WAIT((mmio_read_relaxed(EMMC_BASE + EMMC_CONTROL1) & (0x7 << 24)) == 0, 1000000);
 	if((mmio_read(EMMC_BASE + EMMC_CONTROL1) & (0x7 << 24)) != 0)
 	{
 		printf("EMMC: controller did not reset properly\n");
 		return -1;
 	}
-#ifdef EMMC_DEBUG
-	printf("EMMC: control0: %08x, control1: %08x\n",
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: control0: %08x, control1: %08x\n",
 			mmio_read(EMMC_BASE + EMMC_CONTROL0),
 			mmio_read(EMMC_BASE + EMMC_CONTROL1));
-#endif
 
 	// Read the capabilities registers
 	capabilities_0 = mmio_read(EMMC_BASE + EMMC_CAPABILITIES_0);
 	capabilities_1 = mmio_read(EMMC_BASE + EMMC_CAPABILITIES_1);
-#ifdef EMMC_DEBUG
-	printf("EMMC: capabilities: %08x%08x\n", capabilities_1, capabilities_0);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: capabilities: %08x%08x\n", capabilities_1,
+			capabilities_0);
 
 	// Check for a valid card
-#ifdef EMMC_DEBUG
-	printf("EMMC: checking for an inserted card\n");
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: checking for an inserted card\n");
 	uint32_t status_reg = mmio_read(EMMC_BASE + EMMC_STATUS);
 	if((status_reg & (1 << 16)) == 0)
 	{
 		printf("EMMC: no card inserted\n");
 		return -1;
 	}
-#ifdef EMMC_DEBUG
-	printf("EMMC: status: %08x\n", status_reg);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: status: %08x\n", status_reg);
 
 	// Clear control2
 	mmio_write(EMMC_BASE + EMMC_CONTROL2, 0);
 
 	// Set clock rate to something slow
-#ifdef EMMC_DEBUG
-	printf("EMMC: setting clock rate\n");
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: setting clock rate\n");
 	control1 = mmio_read(EMMC_BASE + EMMC_CONTROL1);
 	control1 |= 1;			// enable clock
 	control1 |= 0x20;		// programmable clock mode
 	control1 |= (1 << 8);		// base clock * M/2
 	control1 |= (7 << 16);		// data timeout = TMCLK * 2^10
 	mmio_write(EMMC_BASE + EMMC_CONTROL1, control1);
-	TIMEOUT_WAIT(mmio_read(EMMC_BASE + EMMC_CONTROL1) & 0x2, 0x1000000);
+	TIMEOUT_WAIT(mmio_read_relaxed(EMMC_BASE + EMMC_CONTROL1) & 0x2, 0x1000000);
 	if((mmio_read(EMMC_BASE + EMMC_CONTROL1) & 0x2) == 0)
 	{
 		printf("EMMC: controller's clock did not stabilise within 1 second\n");
 		return -1;
 	}
-#ifdef EMMC_DEBUG
-	printf("EMMC: control0: %08x, control1: %08x\n",
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: control0: %08x, control1: %08x\n",
 			mmio_read(EMMC_BASE + EMMC_CONTROL0),
 			mmio_read(EMMC_BASE + EMMC_CONTROL1));
-#endif
 
 	// Enable the SD clock
-#ifdef EMMC_DEBUG
-	printf("EMMC: enabling SD clock\n");
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "EMMC: enabling SD clock\n");
 	usleep(2000);
 	control1 = mmio_read(EMMC_BASE + EMMC_CONTROL1);
 	control1 |= 4;
@@ -283,22 +283,14 @@ int sd_card_init(struct block_device **dev)
 
 	// Send CMD0 to the card (reset to idle state)
 	mmio_write(EMMC_BASE + EMMC_CMDTM, SD_CMD_INDEX(0));
-#ifdef EMMC_DEBUG
-	printf("SD: sent CMD0 ");
-#endif
 
 	if(!sd_wait_response(500000, (void*)0))
 	{
-#ifdef EMMC_DEBUG
-		printf("- no response\n");
-#endif
 		printf("EMMC: no SD card detected\n");
 		return -1;
 	}
 
-#ifdef EMMC_DEBUG
-	printf("done\n");
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: sent CMD0\n");
 
 	// Send CMD8 to the card
 	// Voltage supplied = 0x1 = 2.7-3.6V (standard)
@@ -307,20 +299,13 @@ int sd_card_init(struct block_device **dev)
 	mmio_write(EMMC_BASE + EMMC_ARG1, 0x000001AA);
 	mmio_write(EMMC_BASE + EMMC_CMDTM, SD_CMD_INDEX(8) | SD_CMD_CRCCHK_EN |
 			SD_CMD_RSPNS_TYPE_48);
-#ifdef EMMC_DEBUG
-	printf("SD: sent CMD8, ");
-#endif
 	// Wait for a response
 	int can_set_sdhc = sd_wait_response(500000, (void*)0);
 	uint32_t sdhc_flag = 0;
 	if(can_set_sdhc)
 	{
 		uint32_t cmd8_resp = mmio_read(EMMC_BASE + EMMC_RESP0);
-#ifdef EMMC_DEBUG
-		printf("received response: %08x\n", cmd8_resp);
-#else
-		(void)cmd8_resp;
-#endif
+		TRACE(EMMC, TRACE_DEBUG, "SD: CMD8 response: %08x\n", cmd8_resp);
 		// The CMD8 response is R7 (card interface condition) - PLSS 4.9.6
 		// Bits 0-7 should be the check pattern
 		// Bits 8-11 should be the accepted voltage (in this case 1 = 2.7-3.6V)
@@ -331,10 +316,8 @@ int sd_card_init(struct block_device **dev)
 		}
 		sdhc_flag = 0x40000000;
 	}
-#ifdef EMMC_DEBUG
 	else
-		printf("no response received\n");
-#endif
+		TRACE(EMMC, TRACE_DEBUG, "SD: no CMD8 response\n");
 
 	// Prepare the device structure
 	struct emmc_block_dev *ret;
@@ -348,21 +331,19 @@ int sd_card_init(struct block_device **dev)
 	ret->bd.device_name = device_name;
 	ret->bd.block_size = 512;
 	ret->bd.read = sd_read;
+	ret->bd.read_start = sd_read_start;
+	ret->bd.read_wait = sd_read_wait;
+	ret->bd.read_busy = sd_read_busy;
 
 	// Check ACMD41
 	while(1)
 	{
 		usleep(500000);
-#ifdef EMMC_DEBUG
-		printf("SD: sending ACMD41: CMD55: ");
-#endif
 		mmio_write(EMMC_BASE + EMMC_ARG1, 0);
 		sd_send_command(SD_CMD_INDEX(55) | SD_CMD_CRCCHK_EN | SD_CMD_RSPNS_TYPE_48);
 		if(!sd_wait_response(500000, ret))
 		{
-#ifdef EMMC_DEBUG
-			printf("SD: no CMD55 response, retrying\n");
-#endif
+			TRACE(EMMC, TRACE_DEBUG, "SD: no CMD55 response, retrying\n");
 			if(ret->last_interrupt & 0x10000)
 			{
 				// timeout occured
@@ -373,9 +354,8 @@ int sd_card_init(struct block_device **dev)
 
 			continue;
 		}
-#ifdef EMMC_DEBUG
-		printf("done, response %08x, ACMD41: ", mmio_read(EMMC_BASE + EMMC_RESP0));
-#endif
+		TRACE(EMMC, TRACE_DEBUG, "SD: CMD55 response %08x\n",
+				mmio_read(EMMC_BASE + EMMC_RESP0));
 
 		usleep(2000);
 
@@ -393,17 +373,11 @@ int sd_card_init(struct block_device **dev)
 			return -1;
 		}
 
-#ifdef EMMC_DEBUG
-		printf("done\n");
-#endif
-
 		// Read the response
 		usleep(250000);
 		uint32_t acmd41_resp = mmio_read(EMMC_BASE + EMMC_RESP0);
-#ifdef EMMC_DEBUG
-		printf("SD: ACMD41 response: %08x\n",
+		TRACE(EMMC, TRACE_DEBUG, "SD: ACMD41 response: %08x\n",
 				acmd41_resp);
-#endif
 
 		uint32_t card_ready = (acmd41_resp >> 31) & 0x1;
 		if(!card_ready)
@@ -424,27 +398,23 @@ int sd_card_init(struct block_device **dev)
 		break;
 	}
 
-#ifdef EMMC_DEBUG
-	printf("SD: card identified: OCR: %04x, 1.8v support: %i, SDHC support: %i\n",
-			ret->card_ocr, ret->card_supports_18v, ret->card_supports_sdhc);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: card identified: OCR: %04x, 1.8v support: %i, "
+			"SDHC support: %i\n", ret->card_ocr, ret->card_supports_18v, ret->card_supports_sdhc);
 
 	// Switch to 1.8V mode if possible
 	if(ret->card_supports_18v)
 	{
-#ifdef EMMC_DEBUG
-		printf("SD: switching to 1.8V mode: ");
-#endif
-
 		mmio_write(EMMC_BASE + EMMC_ARG1, 0);
 		mmio_write(EMMC_BASE + EMMC_INTERRUPT, 1);
 		mmio_write(EMMC_BASE + EMMC_CMDTM, SD_CMD_INDEX(11) | SD_CMD_CRCCHK_EN |
 				SD_CMD_RSPNS_TYPE_48);
 
 		// Wait for completion
-		while((mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x1) == 0);
+		mmio_barrier();
+		while((mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT) & 0x1) == 0);
+		mmio_barrier();
 
-		printf("done\n");
+		TRACE(EMMC, TRACE_DEBUG, "SD: switched to 1.8V mode\n");
 	}
 
 	// Send CMD2 to get the cards CID
@@ -460,9 +430,8 @@ int sd_card_init(struct block_device **dev)
 	uint32_t card_cid_2 = mmio_read(EMMC_BASE + EMMC_RESP2);
 	uint32_t card_cid_3 = mmio_read(EMMC_BASE + EMMC_RESP3);
 
-#ifdef EMMC_DEBUG
-	printf("SD: card CID: %08x%08x%08x%08x\n", card_cid_3, card_cid_2, card_cid_1, card_cid_0);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: card CID: %08x%08x%08x%08x\n", card_cid_3,
+			card_cid_2, card_cid_1, card_cid_0);
 	uint32_t *dev_id = (uint32_t *)malloc(4 * sizeof(uint32_t));
 	dev_id[0] = card_cid_0;
 	dev_id[1] = card_cid_1;
@@ -480,9 +449,7 @@ int sd_card_init(struct block_device **dev)
 		return -1;
 	}
 	uint32_t cmd3_resp = mmio_read(EMMC_BASE + EMMC_RESP0);
-#ifdef EMMC_DEBUG
-	printf("SD: CMD3 response: %08x\n", cmd3_resp);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: CMD3 response: %08x\n", cmd3_resp);
 
 	ret->card_rca = (cmd3_resp >> 16) & 0xffff;
 	uint32_t crc_error = (cmd3_resp >> 15) & 0x1;
@@ -523,9 +490,7 @@ int sd_card_init(struct block_device **dev)
 		return -1;
 	}
 
-#ifdef EMMC_DEBUG
-	printf("SD: RCA: %04x\n", ret->card_rca);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: RCA: %04x\n", ret->card_rca);
 
 	// Now select the card (toggles it to transfer state)
 	mmio_write(EMMC_BASE + EMMC_ARG1, ret->card_rca << 16);
@@ -595,9 +560,7 @@ int sd_card_init(struct block_device **dev)
 #endif
 
 	printf("SD: found a valid SD card\n");
-#ifdef EMMC_DEBUG
-	printf("SD: setup successful (status %i)\n", status);
-#endif
+	TRACE(EMMC, TRACE_DEBUG, "SD: setup successful (status %i)\n", status);
 
 	// Reset interrupt register
 	mmio_write(EMMC_BASE + EMMC_INTERRUPT, 0xffffffff);
@@ -606,10 +569,12 @@ int sd_card_init(struct block_device **dev)
 	return 0;
 }
 
-int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_no)
+// Make sure the card is selected and in the transfer state
+static int sd_ensure_transfer_state(struct emmc_block_dev *edev)
 {
+	struct block_device *dev = &edev->bd;
+
 	// Check the status of the card
-	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
 	if(edev->card_rca == 0)
 	{
 		// Try again to initialise the card
@@ -618,10 +583,6 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 			return ret;
 	}
 
-#ifdef EMMC_DEBUG
-	printf("SD: read() obtaining status register: ");
-#endif
-
 	mmio_write(EMMC_BASE + EMMC_ARG1, edev->card_rca << 16);
 	sd_send_command(SD_CMD_INDEX(13) | SD_CMD_CRCCHK_EN | SD_CMD_RSPNS_TYPE_48);
 	if(!sd_wait_response(500000, edev))
@@ -632,9 +593,6 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 	}
 	uint32_t status = mmio_read(EMMC_BASE + EMMC_RESP0);
 	uint32_t cur_state = (status >> 9) & 0xf;
-#ifdef EMMC_DEBUG
-	printf("status %i\n", cur_state);
-#endif
 	if(cur_state == 3)
 	{
 		// Currently in the stand-by state - select it
@@ -669,9 +627,6 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 	// Check again that we're now in the correct mode
 	if(cur_state != 4)
 	{
-#ifdef EMMC_DEBUG
-		printf("SD: read() rechecking status: ");
-#endif
 		mmio_write(EMMC_BASE + EMMC_ARG1, edev->card_rca << 16);
 		sd_send_command(SD_CMD_INDEX(13) | SD_CMD_CRCCHK_EN | SD_CMD_RSPNS_TYPE_48);
 		if(!sd_wait_response(500000, edev))
@@ -683,9 +638,8 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 		status = mmio_read(EMMC_BASE + EMMC_RESP0);
 		cur_state = (status >> 9) & 0xf;
 
-#ifdef EMMC_DEBUG
-		printf("%i\n", cur_state);
-#endif
+		TRACE(EMMC, TRACE_DEBUG, "SD: read() rechecked status: %i\n",
+				cur_state);
 
 		if(cur_state != 4)
 		{
@@ -696,9 +650,25 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 		}
 	}
 
-#ifdef EMMC_DEBUG
-	printf("SD: read() card ready, reading from block %u\n", block_no);
-#endif
+	return 0;
+}
+
+int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_no)
+{
+	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+
+	// Finish any outstanding multi-block read first
+	if(edev->async_blocks)
+	{
+		int ret = sd_read_wait(dev);
+		if(ret < 0)
+			return ret;
+	}
+
+	int ret = sd_ensure_transfer_state(edev);
+	if(ret != 0)
+		return ret;
+	TRACE_EVENT(EMMC, TRACE_DEBUG, EMMC_READ, block_no, 1);
 
 	// PLSS table 4.20 - SDSC cards use byte addresses rather than block addresses
 	if(!edev->card_supports_sdhc)
@@ -728,13 +698,6 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 		return -1;
 	}
 
-#ifdef EMMC_DEBUG
-	printf("SD: read command complete, waiting for data (current INTERRUPT: %08x, "
-			"STATUS: %08x)\n",
-			mmio_read(EMMC_BASE + EMMC_INTERRUPT),
-			mmio_read(EMMC_BASE + EMMC_STATUS));
-#endif
-	
 	// Read data
 	int byte_no = 0;
 	int bytes_to_read = (int)buf_size;
@@ -742,15 +705,14 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 		bytes_to_read = 512;		// read a maximum of 512 bytes
 
 	// Wait for buffer read ready interrupt
-#ifdef EMMC_DEBUG
-	printf("SD: awaiting buffer read ready interrupt ");
 	int card_interrupt_displayed = 0;
 	uint32_t old_interrupt = 0;
-#endif
-	while((mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x20) == 0)
+	struct timer_wait data_wait;
+	register_timer(&data_wait, 500000);
+	while((mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT) & 0x20) == 0)
 	{
-#ifdef EMMC_DEBUG
-		uint32_t cur_irpt = mmio_read(EMMC_BASE + EMMC_INTERRUPT);
+		uint32_t cur_irpt = TRACE_ON(EMMC, TRACE_DEBUG) ?
+			mmio_read(EMMC_BASE + EMMC_INTERRUPT) : 0;
 		if(cur_irpt != old_interrupt)
 		{
 			printf("SD: interrupt %08x\n", cur_irpt);
@@ -780,19 +742,29 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 				card_interrupt_displayed = 1;
 			}
 		}
-#endif
-		usleep(1000);
+		if(compare_timer(&data_wait))
+		{
+			printf("SD: read() timeout waiting for data\n");
+			edev->card_rca = 0;
+			return -1;
+		}
 	}
-#ifdef EMMC_DEBUG
-	printf("done\n");
-#endif
 	// Clear buffer read ready interrupt
 	mmio_write(EMMC_BASE + EMMC_INTERRUPT, 0x20);
 
-	// Get data
+	// Get data.  Nothing else touches the EMMC while the FIFO is drained
+	// so the reads need no barriers between them.
+	mmio_barrier();
+	if((bytes_to_read == 512) && !((uint32_t)buf & 0x3))
+	{
+		uint32_t *buf32 = (uint32_t *)buf;
+		for(int i = 0; i < 128; i++)
+			buf32[i] = mmio_read_relaxed(EMMC_BASE + EMMC_DATA);
+		byte_no = 512;
+	}
 	while(byte_no < 512)
 	{
-		uint32_t data = mmio_read(EMMC_BASE + EMMC_DATA);
+		uint32_t data = mmio_read_relaxed(EMMC_BASE + EMMC_DATA);
 		uint8_t d0 = (uint8_t)(data & 0xff);
 		uint8_t d1 = (uint8_t)((data >> 8) & 0xff);
 		uint8_t d2 = (uint8_t)((data >> 16) & 0xff);
@@ -817,21 +789,153 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 	}
 
 	// Wait for transfer complete interrupt
-#ifdef EMMC_DEBUG
-	printf("SD: awaiting transfer complete interrupt ");
-#endif
-	while((mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x2) == 0)
-		usleep(1000);
-#ifdef EMMC_DEBUG
-	printf("done\n");
-#endif
+	TIMEOUT_WAIT(mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT) & 0x2, 500000);
+	if((mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x2) == 0)
+	{
+		printf("SD: read() timeout waiting for transfer complete\n");
+		edev->card_rca = 0;
+		return -1;
+	}
+	TRACE_EVENT(EMMC, TRACE_DEBUG, EMMC_DONE, block_no,
+			mmio_read(EMMC_BASE + EMMC_INTERRUPT));
 	// Clear transfer complete interrupt
 	mmio_write(EMMC_BASE + EMMC_INTERRUPT, 0x2);
 
-#ifdef EMMC_DEBUG
-	printf("SD: data read successful\n");
-#endif
-
 	return byte_no;
 }
 
+// Start a multi-block read (CMD18) with the data moved by the DMA engine,
+// paced by the EMMC DREQ.  The card stops itself with an auto CMD12 once
+// the block count is reached.
+int sd_read_start(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_no)
+{
+	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+	uint32_t blocks = buf_size / 512;
+
+	if(edev->async_blocks)
+	{
+		int ret = sd_read_wait(dev);
+		if(ret < 0)
+			return ret;
+	}
+
+	if(!sd_dma_tried)
+	{
+		sd_dma_chan = dma_alloc_channel(0);
+		sd_dma_tried = 1;
+	}
+
+	// Anything we cannot hand to the DMA engine is read synchronously, as
+	// is everything once a kernel has enabled the MMU or data cache
+	if((sd_dma_chan < 0) || (buf_size % 512) || (blocks == 0) ||
+			(blocks > SD_DMA_CBS * SD_DMA_CB_BLOCKS) || ((uint32_t)buf & 0x3) ||
+			!dma_memory_direct())
+	{
+		int ret = block_read(dev, buf, buf_size, block_no);
+		return (ret < 0) ? ret : 0;
+	}
+
+	int ret = sd_ensure_transfer_state(edev);
+	if(ret != 0)
+		return ret;
+	TRACE_EVENT(EMMC, TRACE_DEBUG, EMMC_READ, block_no, blocks);
+
+	// Build the control block chain
+	uint32_t done = 0;
+	int cb = 0;
+	while(done < blocks)
+	{
+		uint32_t count = blocks - done;
+		if(count > SD_DMA_CB_BLOCKS)
+			count = SD_DMA_CB_BLOCKS;
+
+		sd_dma_cbs[cb].ti = DMA_TI_SRC_DREQ | DMA_TI_PERMAP(DMA_DREQ_EMMC) |
+			DMA_TI_DEST_INC | DMA_TI_WAIT_RESP;
+		sd_dma_cbs[cb].source_ad = DMA_PERIPH_BUS_ADDR(EMMC_BASE + EMMC_DATA);
+		sd_dma_cbs[cb].dest_ad = DMA_BUS_ADDR(buf + done * 512);
+		sd_dma_cbs[cb].txfr_len = count * 512;
+		sd_dma_cbs[cb].stride = 0;
+		sd_dma_cbs[cb].nextconbk = 0;
+		if(cb > 0)
+			sd_dma_cbs[cb - 1].nextconbk = DMA_BUS_ADDR(&sd_dma_cbs[cb]);
+
+		done += count;
+		cb++;
+	}
+
+	// PLSS table 4.20 - SDSC cards use byte addresses rather than block addresses
+	uint32_t addr = block_no;
+	if(!edev->card_supports_sdhc)
+		addr *= 512;
+
+	// Clear any stale interrupts then arm the DMA engine before the card
+	// starts sending
+	mmio_write(EMMC_BASE + EMMC_INTERRUPT, 0xffffffff);
+	dma_start(sd_dma_chan, &sd_dma_cbs[0]);
+
+	uint32_t blksizecnt = mmio_read(EMMC_BASE + EMMC_BLKSIZECNT);
+	blksizecnt &= 0xfff;
+	blksizecnt |= blocks << 16;
+	mmio_write(EMMC_BASE + EMMC_BLKSIZECNT, blksizecnt);
+
+	mmio_write(EMMC_BASE + EMMC_ARG1, addr);
+	sd_send_command(SD_CMD_INDEX(18) | SD_CMD_CRCCHK_EN | SD_CMD_RSPNS_TYPE_48 |
+			SD_CMD_DAT_DIR_CH | SD_CMD_ISDATA | SD_CMD_MULTI_BLOCK |
+			SD_BLKCNT_EN | SD_AUTO_CMD_EN_CMD12);
+
+	if(!sd_wait_response(500000, edev))
+	{
+		printf("SD: read_start() no response from CMD18\n");
+		dma_wait(sd_dma_chan, 0);
+		edev->card_rca = 0;
+		return -1;
+	}
+
+	edev->async_block_no = block_no;
+	edev->async_blocks = blocks;
+	return 0;
+}
+
+// Returns 1 while a multi-block read is still transferring
+int sd_read_busy(struct block_device *dev)
+{
+	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+	if(!edev->async_blocks)
+		return 0;
+	return (mmio_read(EMMC_BASE + EMMC_INTERRUPT) & 0x2) ? dma_busy(sd_dma_chan) : 1;
+}
+
+// Wait for the read begun by sd_read_start()
+int sd_read_wait(struct block_device *dev)
+{
+	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+	if(!edev->async_blocks)
+		return 0;
+
+	uint32_t blocks = edev->async_blocks;
+	edev->async_blocks = 0;
+
+	// Allow 1 ms per block on top of the usual command timeout
+	TIMEOUT_WAIT(mmio_read_relaxed(EMMC_BASE + EMMC_INTERRUPT) & 0x8002,
+			500000 + blocks * 1000);
+	uint32_t irpt = mmio_read(EMMC_BASE + EMMC_INTERRUPT);
+	int dma_ret = dma_wait(sd_dma_chan, 100000);
+	TRACE_EVENT(EMMC, TRACE_DEBUG, EMMC_DONE, edev->async_block_no, irpt);
+
+	// Restore the single block count used by sd_read()
+	uint32_t blksizecnt = mmio_read(EMMC_BASE + EMMC_BLKSIZECNT);
+	mmio_write(EMMC_BASE + EMMC_BLKSIZECNT, (blksizecnt & 0xfff) | (1 << 16));
+	mmio_write(EMMC_BASE + EMMC_INTERRUPT, 0xffffffff);
+
+	if(!(irpt & 0x2) || (irpt & 0x8000) || (dma_ret != 0))
+	{
+		printf("SD: read_wait() error reading %i blocks from %i "
+				"(interrupt %08x, dma %i)\n", blocks,
+				edev->async_block_no, irpt, dma_ret);
+		edev->card_rca = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
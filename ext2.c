@@ -27,10 +27,7 @@
 #include "vfs.h"
 #include "fs.h"
 #include "errno.h"
-
-#ifdef DEBUG2
-#define EXT2_DEBUG
-#endif
+#include "trace.h"
 
 struct ext2_bgd
 {
@@ -316,9 +313,8 @@ static struct ext2_inode *ext2_read_inode(struct ext2_fs *fs,
 int ext2_init(struct block_device *parent, struct fs **fs)
 {
 	// Interpret an EXT2 file system
-#ifdef EXT2_DEBUG
-	printf("EXT2: looking for a filesytem on %s\n", parent->device_name);
-#endif
+	TRACE(EXT2, TRACE_DEBUG, "EXT2: looking for a filesytem on %s\n",
+			parent->device_name);
 
 	// Read superblock
 	uint8_t *sb = (uint8_t *)malloc(1024);
@@ -439,9 +435,7 @@ struct dirent *ext2_read_directory(struct fs *fs, char **name)
 		}
 		if(!found)
 		{
-#ifdef EXT2_DEBUG
-			printf("EXT2: path part %s not found\n", *name);
-#endif
+			TRACE(EXT2, TRACE_DEBUG, "EXT2: path part %s not found\n", *name);
 			errno = ENOENT;
 			return (void*)0;
 		}
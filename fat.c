@@ -28,10 +28,7 @@
 #include "fs.h"
 #include "errno.h"
 #include "util.h"
-
-#ifdef DEBUG2
-#define FAT_DEBUG
-#endif
+#include "trace.h"
 
 struct fat_fs {
 	struct fs b;
@@ -47,6 +44,8 @@ struct fat_fs {
 	uint32_t root_dir_sectors;
 	uint32_t first_non_root_sector;
 	uint32_t root_dir_cluster;
+	uint8_t *fat_cache;		// the FAT sector read most recently
+	uint32_t fat_cache_sector;
 };
 
 // FAT32 extended fields
@@ -103,6 +102,16 @@ struct fat_BS
 	} ext;
 } __attribute__ ((packed));
 
+// Per-file state.  The cursor remembers the last cluster visited so that
+// sequential reads carry on along the chain rather than walking it again
+// from the first cluster.
+struct fat_file
+{
+	uint32_t first_cluster;
+	uint32_t cur_cluster;
+	size_t cur_offset;		// file offset of the start of cur_cluster
+};
+
 #define FAT12		0
 #define FAT16		1
 #define FAT32		2
@@ -110,8 +119,10 @@ struct fat_BS
 
 static struct dirent *fat_read_dir(struct fat_fs *fs, struct dirent *d);
 struct dirent *fat_read_directory(struct fs *fs, char **name);
-static size_t fat_read_from_file(struct fat_fs *fs, uint32_t starting_cluster, uint8_t *buf,
+static size_t fat_read_from_file(struct fat_fs *fs, struct fat_file *ff, uint8_t *buf,
 		size_t byte_count, size_t offset);
+uint32_t get_sector(struct fat_fs *fs, uint32_t rel_cluster);
+static uint32_t get_next_fat_entry(struct fat_fs *fs, uint32_t current_cluster);
 
 static const char *fat_names[] = { "FAT12", "FAT16", "FAT32", "VFAT" };
 
@@ -133,9 +144,14 @@ static FILE *fat_fopen(struct fs *fs, struct dirent *path, const char *mode)
 	memset(ret, 0, sizeof(struct vfs_file));
 	ret->fs = fs;
 	ret->pos = 0;
-	ret->opaque = path->opaque;
 	ret->len = (long)path->byte_size;
 
+	struct fat_file *ff = (struct fat_file *)malloc(sizeof(struct fat_file));
+	ff->first_cluster = (uint32_t)path->opaque;
+	ff->cur_cluster = ff->first_cluster;
+	ff->cur_offset = 0;
+	ret->opaque = ff;
+
 	(void)mode;
 	return ret;
 }
@@ -144,26 +160,80 @@ static size_t fat_fread(struct fs *fs, void *ptr, size_t size, size_t nmemb, FIL
 {
 	if(stream->fs != fs)
 		return -1;
-	if(stream->opaque == (void *)0)
+	struct fat_file *ff = (struct fat_file *)stream->opaque;
+	if((ff == (void *)0) || (ff->first_cluster == 0))
 		return -1;
 
-	return fat_read_from_file((struct fat_fs *)fs, (uint32_t)stream->opaque, (uint8_t *)ptr,
+	return fat_read_from_file((struct fat_fs *)fs, ff, (uint8_t *)ptr,
 			size * nmemb, (size_t)stream->pos);
 }
 
 static int fat_fclose(struct fs *fs, FILE *fp)
 {
 	(void)fs;
-	(void)fp;
+	free(fp->opaque);
+	fp->opaque = (void *)0;
+	return 0;
+}
+
+// Map a file offset to its sector, extending the run for as long as the
+// cluster chain is contiguous.  The cursor is left on the last cluster
+// mapped so that the next call carries on from there.
+static int fat_fmap(struct fs *fs, FILE *fp, long offset, size_t max_len,
+		uint32_t *block_no, size_t *len)
+{
+	struct fat_fs *fat = (struct fat_fs *)fs;
+	if(fp->fs != fs)
+		return -1;
+	struct fat_file *ff = (struct fat_file *)fp->opaque;
+	if((ff == (void *)0) || (ff->first_cluster == 0))
+		return -1;
+	if((fat->bytes_per_sector != fs->parent->block_size) ||
+			((size_t)offset % fat->bytes_per_sector))
+		return -1;
+
+	size_t cluster_size = fat->bytes_per_sector * fat->sectors_per_cluster;
+
+	uint32_t cur_cluster = ff->cur_cluster;
+	size_t location_in_file = ff->cur_offset;
+	if(location_in_file > (size_t)offset)
+	{
+		cur_cluster = ff->first_cluster;
+		location_in_file = 0;
+	}
+	while(location_in_file + cluster_size <= (size_t)offset)
+	{
+		cur_cluster = get_next_fat_entry(fat, cur_cluster);
+		location_in_file += cluster_size;
+		if(cur_cluster >= 0x0ffffff7)
+			return -1;
+	}
+
+	size_t c_ptr = (size_t)offset - location_in_file;
+	*block_no = get_sector(fat, cur_cluster) + c_ptr / fat->bytes_per_sector;
+	size_t run = cluster_size - c_ptr;
+
+	while(run < max_len)
+	{
+		uint32_t next_cluster = get_next_fat_entry(fat, cur_cluster);
+		if(next_cluster != cur_cluster + 1)
+			break;
+		cur_cluster = next_cluster;
+		location_in_file += cluster_size;
+		run += cluster_size;
+	}
+
+	ff->cur_cluster = cur_cluster;
+	ff->cur_offset = location_in_file;
+	*len = (run > max_len) ? max_len : run;
 	return 0;
 }
 
 int fat_init(struct block_device *parent, struct fs **fs)
 {
 	// Interpret a FAT file system
-#ifdef FAT_DEBUG
-	printf("FAT: looking for a filesytem on %s\n", parent->device_name);
-#endif
+	TRACE(FAT, TRACE_DEBUG, "FAT: looking for a filesytem on %s\n",
+			parent->device_name);
 
 	// Read block 0
 	uint8_t *block_0 = (uint8_t *)malloc(512);
@@ -180,21 +250,22 @@ int fat_init(struct block_device *parent, struct fs **fs)
 	}
 
 	// Dump the boot block
-#ifdef FAT_DEBUG
-	int j = 0;
-	for(int i = 0; i < 90; i++)
+	if(TRACE_ON(FAT, TRACE_DEBUG))
 	{
-		printf("%02x ", block_0[i]);
-		j++;
-		if(j == 8)
+		int j = 0;
+		for(int i = 0; i < 90; i++)
 		{
-			j = 0;
-			printf("\n");
+			printf("%02x ", block_0[i]);
+			j++;
+			if(j == 8)
+			{
+				j = 0;
+				printf("\n");
+			}
 		}
+		if(j != 0)
+			printf("\n");
 	}
-	if(j != 0)
-		printf("\n");
-#endif
 
 	struct fat_BS *bs = (struct fat_BS *)block_0;
 	if(bs->bootjmp[0] != 0xeb)
@@ -212,8 +283,11 @@ int fat_init(struct block_device *parent, struct fs **fs)
 	ret->b.fopen = fat_fopen;
 	ret->b.fread = fat_fread;
 	ret->b.fclose = fat_fclose;
+	ret->b.fmap = fat_fmap;
 	ret->b.read_directory = fat_read_directory;
 	ret->b.parent = parent;
+	ret->fat_cache = (void *)0;
+	ret->fat_cache_sector = 0xffffffff;
 
 	ret->total_sectors = total_sectors;
 	uint32_t total_clusters = total_sectors / bs->sectors_per_cluster;
@@ -226,13 +300,12 @@ int fat_init(struct block_device *parent, struct fs **fs)
 	ret->b.fs_name = fat_names[ret->fat_type];
 	ret->sectors_per_cluster = (uint32_t)bs->sectors_per_cluster;
 	ret->bytes_per_sector = (uint32_t)bs->bytes_per_sector;
+	ret->fat_cache = (uint8_t *)malloc(ret->bytes_per_sector);
 
-#ifdef FAT_DEBUG
-	printf("FAT: reading a %s filesystem: total_sectors %i, sectors_per_cluster %i, "
-		       "bytes_per_sector %i\n",
+	TRACE(FAT, TRACE_DEBUG, "FAT: reading a %s filesystem: total_sectors %i, "
+			"sectors_per_cluster %i, bytes_per_sector %i\n",
 	       ret->b.fs_name, ret->total_sectors, ret->sectors_per_cluster,
 		ret->bytes_per_sector);
-#endif
 
 	// Interpret the extended bpb
 	ret->vol_label = (char *)malloc(12);
@@ -249,11 +322,10 @@ int fat_init(struct block_device *parent, struct fs **fs)
 		ret->first_non_root_sector = ret->first_data_sector;
 		ret->sectors_per_fat = bs->ext.fat32.table_size_32;
 
-#ifdef FAT_DEBUG
-		printf("FAT: first_data_sector: %i, first_fat_sector: %i\n",
+		TRACE(FAT, TRACE_DEBUG, "FAT: first_data_sector: %i, "
+				"first_fat_sector: %i\n",
 				ret->first_data_sector,
 				ret->first_fat_sector);
-#endif
 
 		ret->root_dir_cluster = bs->ext.fat32.root_cluster;
 	}
@@ -263,9 +335,7 @@ int fat_init(struct block_device *parent, struct fs **fs)
 
 		strcpy(ret->vol_label, bs->ext.fat16.volume_label);
 		ret->vol_label[11] = 0;
-#ifdef FAT_DEBUG
-		printf("FAT: volume label: %s\n", ret->vol_label);
-#endif
+		TRACE(FAT, TRACE_DEBUG, "FAT: volume label: %s\n", ret->vol_label);
 
 		ret->first_data_sector = bs->reserved_sector_count + (bs->table_count *
 				bs->table_size_16);
@@ -275,15 +345,14 @@ int fat_init(struct block_device *parent, struct fs **fs)
 		ret->root_dir_sectors = (ret->root_dir_entries * 32 + ret->bytes_per_sector - 1) /
 			ret->bytes_per_sector;	// The + bytes_per_sector - 1 rounds up the sector no
 
-#ifdef FAT_DEBUG
-		printf("FAT: first_data_sector: %i, first_fat_sector: %i\n",
+		TRACE(FAT, TRACE_DEBUG, "FAT: first_data_sector: %i, "
+				"first_fat_sector: %i\n",
 				ret->first_data_sector,
 				ret->first_fat_sector);
-
-		printf("FAT: root_dir_entries: %i, root_dir_sectors: %i\n",
+		TRACE(FAT, TRACE_DEBUG, "FAT: root_dir_entries: %i, "
+				"root_dir_sectors: %i\n",
 				ret->root_dir_entries,
 				ret->root_dir_sectors);
-#endif
 
 		ret->first_non_root_sector = ret->first_data_sector + ret->root_dir_sectors;
 		ret->root_dir_cluster = 2;
@@ -299,15 +368,33 @@ int fat_init(struct block_device *parent, struct fs **fs)
 
 uint32_t get_sector(struct fat_fs *fs, uint32_t rel_cluster)
 {
-#ifdef FAT_DEBUG
-	printf("FAT: get_sector rel_cluster %i, sector %i\n",
+	TRACE(FAT, TRACE_DEBUG, "FAT: get_sector rel_cluster %i, sector %i\n",
 			rel_cluster,
 			fs->first_non_root_sector + (rel_cluster - 2) * fs->sectors_per_cluster);
-#endif
 	rel_cluster -= 2;
 	return fs->first_non_root_sector + rel_cluster * fs->sectors_per_cluster;
 }
 
+// Return a FAT sector, reading it only if it is not the one read last time.
+// Chains of files written in one go mostly run through a single sector, so
+// following them costs one read per sector rather than one per cluster.
+static uint8_t *read_fat_sector(struct fat_fs *fs, uint32_t fat_sector)
+{
+	if(fs->fat_cache_sector == fat_sector)
+		return fs->fat_cache;
+
+	int br_ret = block_read(fs->b.parent, fs->fat_cache, fs->bytes_per_sector,
+			fat_sector);
+	if(br_ret < 0)
+	{
+		printf("FAT: block_read returned %i\n", br_ret);
+		fs->fat_cache_sector = 0xffffffff;
+		return (void *)0;
+	}
+	fs->fat_cache_sector = fat_sector;
+	return fs->fat_cache;
+}
+
 static uint32_t get_next_fat_entry(struct fat_fs *fs, uint32_t current_cluster)
 {
 	switch(fs->fat_type)
@@ -315,18 +402,12 @@ static uint32_t get_next_fat_entry(struct fat_fs *fs, uint32_t current_cluster)
 		case FAT16:
 			{
 				uint32_t fat_offset = current_cluster << 1; // *2
-				uint32_t fat_sector = fs->first_fat_sector +
-					(fat_offset / fs->bytes_per_sector);
-				uint8_t *buf = (uint8_t *)malloc(512);
-				int br_ret = block_read(fs->b.parent, buf, 512, fat_sector);
-				if(br_ret < 0)
-				{
-					printf("FAT: block_read returned %i\n");
+				uint8_t *buf = read_fat_sector(fs, fs->first_fat_sector +
+					(fat_offset / fs->bytes_per_sector));
+				if(!buf)
 					return 0x0ffffff7;
-				}
 				uint32_t fat_index = fat_offset % fs->bytes_per_sector;
 				uint32_t next_cluster = (uint32_t)*(uint16_t *)&buf[fat_index];
-				free(buf);
 				if(next_cluster >= 0xfff7)
 					next_cluster |= 0x0fff0000;
 				return next_cluster;
@@ -335,18 +416,12 @@ static uint32_t get_next_fat_entry(struct fat_fs *fs, uint32_t current_cluster)
 		case FAT32:
 			{
 				uint32_t fat_offset = current_cluster << 2; // *4
-				uint32_t fat_sector = fs->first_fat_sector +
-					(fat_offset / fs->bytes_per_sector);
-				uint8_t *buf = (uint8_t *)malloc(512);
-				int br_ret = block_read(fs->b.parent, buf, 512, fat_sector);
-				if(br_ret < 0)
-				{
-					printf("FAT: block_read returned %i\n");
+				uint8_t *buf = read_fat_sector(fs, fs->first_fat_sector +
+					(fat_offset / fs->bytes_per_sector));
+				if(!buf)
 					return 0x0ffffff7;
-				}
 				uint32_t fat_index = fat_offset % fs->bytes_per_sector;
 				uint32_t next_cluster = *(uint32_t *)&buf[fat_index];
-				free(buf);
 				return next_cluster & 0x0fffffff; // FAT32 is actually FAT28
 			}
 		default:
@@ -380,9 +455,7 @@ struct dirent *fat_read_directory(struct fs *fs, char **name)
 		}
 		if(!found)
 		{
-#ifdef FAT_DEBUG
-			printf("FAT: path part %s not found\n", *name);
-#endif
+			TRACE(FAT, TRACE_DEBUG, "FAT: path part %s not found\n", *name);
 			errno = ENOENT;
 			return (void*)0;
 		}
@@ -390,74 +463,88 @@ struct dirent *fat_read_directory(struct fs *fs, char **name)
 	return cur_dir;
 }
 
-static size_t fat_read_from_file(struct fat_fs *fs, uint32_t starting_cluster, uint8_t *buf,
+static size_t fat_read_from_file(struct fat_fs *fs, struct fat_file *ff, uint8_t *buf,
 		size_t byte_count, size_t offset)
 {
-	uint32_t cur_cluster = starting_cluster;
 	size_t cluster_size = fs->bytes_per_sector * fs->sectors_per_cluster;
 
-	size_t location_in_file = 0;
-	int buf_ptr = 0;
-	while(cur_cluster < 0x0ffffff8)
+	// Start from the cursor if it is not past the requested offset
+	uint32_t cur_cluster = ff->cur_cluster;
+	size_t location_in_file = ff->cur_offset;
+	if(location_in_file > offset)
+	{
+		cur_cluster = ff->first_cluster;
+		location_in_file = 0;
+	}
+
+	size_t buf_ptr = 0;
+	uint8_t *read_buf = (void *)0;
+	while((cur_cluster < 0x0ffffff8) && (buf_ptr < byte_count))
 	{
-#ifdef FAT_DEBUG
-		printf("FAT: read_from_file: reading cluster %i, cluster_size %i\n", cur_cluster,
-				cluster_size);
-#endif
+		TRACE(FAT, TRACE_DEBUG, "FAT: read_from_file: reading cluster %i, "
+				"cluster_size %i\n", cur_cluster, cluster_size);
 		if((location_in_file + cluster_size) > offset)
 		{
-			if(location_in_file < (offset + byte_count))
+			// This cluster contains part of the requested file.  Decide how
+			// much of it we need.
+			size_t c_ptr = 0;
+			if(offset > location_in_file)
+				c_ptr = offset - location_in_file;
+			size_t len = cluster_size - c_ptr;
+			if(len > byte_count - buf_ptr)
+				len = byte_count - buf_ptr;
+
+			uint32_t sector = get_sector(fs, cur_cluster);
+			int rb_ret;
+			if(len == cluster_size)
 			{
-				// This cluster contains part of the requested file
-				// Load it
-				
-				uint32_t sector = get_sector(fs, cur_cluster);
-				uint8_t *read_buf = (uint8_t *)malloc(cluster_size);
-				int rb_ret = block_read(fs->b.parent, read_buf, cluster_size, sector);
-
-				if(rb_ret < 0)
-					return rb_ret;
-
-				// Now decide how much of this sector we need to load
-				int len;
-				int c_ptr;
-
-				if(offset >= location_in_file)
+				// Whole clusters - extend the run over those which follow on
+				// the disk and read it straight into the buffer as one
+				// multi-block transfer
+				uint32_t next_cluster = get_next_fat_entry(fs, cur_cluster);
+				while((next_cluster == cur_cluster + 1) &&
+						(len + cluster_size <= byte_count - buf_ptr) &&
+						(len + cluster_size <= BLOCK_ASYNC_MAX))
 				{
-					// This is the first cluster containing the file
-					buf_ptr = 0;
-					c_ptr = offset - location_in_file;
-					len = byte_count;
-					if(len > (int)cluster_size)
-						len = cluster_size;
-					if(len > (int)(cluster_size - c_ptr))
-						len = cluster_size - c_ptr;
-				}
-				else
-				{
-					// We are starting somewhere within the file
-					c_ptr = 0;
-					len = byte_count - buf_ptr;
-					if(len > (int)cluster_size)
-						len = cluster_size;
-					if(len > (int)(cluster_size - c_ptr))
-						len = cluster_size - c_ptr;
-					if(len > (int)(byte_count - buf_ptr))
-						len = byte_count - buf_ptr;
+					cur_cluster = next_cluster;
+					location_in_file += cluster_size;
+					len += cluster_size;
+					next_cluster = get_next_fat_entry(fs, cur_cluster);
 				}
+				rb_ret = block_read_start(fs->b.parent, &buf[buf_ptr], len,
+						sector);
+				if(rb_ret >= 0)
+					rb_ret = block_read_wait(fs->b.parent);
+			}
+			else
+			{
+				if(!read_buf)
+					read_buf = (uint8_t *)malloc(cluster_size);
+				rb_ret = block_read(fs->b.parent, read_buf, cluster_size, sector);
+				if(rb_ret >= 0)
+					memcpy(&buf[buf_ptr], &read_buf[c_ptr], len);
+			}
 
-				// Copy to the buffer
-				memcpy(&buf[buf_ptr], &read_buf[c_ptr], len);
+			if(rb_ret < 0)
+			{
 				free(read_buf);
-
-				buf_ptr += len;
+				return rb_ret;
 			}
+
+			buf_ptr += len;
+
+			// Leave the cursor on this cluster if the read stopped within it
+			if(c_ptr + len < cluster_size)
+				break;
 		}
 
 		cur_cluster = get_next_fat_entry(fs, cur_cluster);
 		location_in_file += cluster_size;
 	}
 
+	free(read_buf);
+	ff->cur_cluster = cur_cluster;
+	ff->cur_offset = location_in_file;
 	return buf_ptr;
 }
 
@@ -491,10 +578,8 @@ struct dirent *fat_read_dir(struct fat_fs *fs, struct dirent *d)
 		if(!is_root)
 			first_data_sector = fat->first_non_root_sector;
 		
-#ifdef FAT_DEBUG
-		printf("FAT: reading cluster %i (sector %i)\n", cur_cluster,
+		TRACE_EVENT(FAT, TRACE_DEBUG, FAT_CLUSTER, cur_cluster,
 				absolute_cluster * fat->sectors_per_cluster + first_data_sector);
-#endif
 		int br_ret = block_read(fat->b.parent, buf, cluster_size, 
 				absolute_cluster * fat->sectors_per_cluster + first_data_sector);
 
@@ -563,10 +648,8 @@ struct dirent *fat_read_dir(struct fat_fs *fs, struct dirent *d)
 
 			de->opaque = (void*)opaque;
 
-#ifdef FAT_DEBUG
-			printf("FAT: read dir entry: %s, size %i, cluster %i, ptr %i\n", 
-					de->name, de->byte_size, opaque, ptr);
-#endif
+			TRACE(FAT, TRACE_DEBUG, "FAT: read dir entry: %s, size %i, "
+					"cluster %i, ptr %i\n", de->name, de->byte_size, opaque, ptr);
 		}
 		free(buf);
 
@@ -24,8 +24,8 @@
 #include <string.h>
 #include "mbox.h"
 #include "fb.h"
-
-extern void memory_barrier();
+#include "dma.h"
+#include "util.h"
 
 #define WIDTH		640
 #define HEIGHT		480
@@ -62,41 +62,71 @@ extern void memory_barrier();
 #define TAG_TEST_PALETTE		0x4400b
 #define TAG_SET_PALETTE			0x4800b
 
+// The virtual framebuffer is this many screens tall so that the console can
+// scroll by moving the display offset rather than copying
+#define FB_VIRT_PAGES	4
+
 static uint32_t phys_w, phys_h, virt_w, virt_h, pitch;
 static uint32_t fb_addr, fb_size;
 
-int fb_init()
+// The framebuffer is set up on first use: 0 = not yet tried, 1 = available,
+// otherwise the error from fb_init()
+static int fb_state = 0;
+
+/* Set the physical and virtual sizes and bit depth, allocate the framebuffer
+ * and read back its pitch in a single message */
+static int fb_alloc()
 {
-	// define a mailbox buffer
-	uint32_t mb_addr = 0x40007000;		// 0x7000 in L2 cache coherent mode
-	volatile uint32_t *mailbuffer = (uint32_t *)mb_addr;
+	mbox_prop_begin();
+	mbox_prop_add2(TAG_SET_PHYS_WH, 8, phys_w, phys_h);
+	int virt_tag = mbox_prop_add2(TAG_SET_VIRT_WH, 8, virt_w, virt_h);
+	mbox_prop_add1(TAG_SET_DEPTH, 4, BPP);
+	mbox_prop_add2(TAG_SET_VIRT_OFFSET, 8, 0, 0);
+	int alloc_tag = mbox_prop_add1(TAG_ALLOCATE_BUFFER, 8, 16);	// 16 byte alignment
+	int pitch_tag = mbox_prop_add0(TAG_GET_PITCH, 4);
 
-	/* Get the display size */
-	// set up the buffer
-	mailbuffer[0] = 8 * 4;			// size of this message
-	mailbuffer[1] = 0;			// this is a request
+	/* Validate the response */
+	if(mbox_prop_send() != 0)
+		return FB_FAIL_SETUP_FB;
+
+	/* Check the allocate_buffer response */
+	if(!mbox_prop_ok(alloc_tag))
+		return FB_FAIL_INVALID_TAG_RESPONSE;
+
+	fb_addr = mbox_prop_get(alloc_tag, 0);
+	fb_size = mbox_prop_get(alloc_tag, 1);
+
+	if((fb_addr == 0) || (fb_size == 0))
+		return FB_FAIL_INVALID_TAG_DATA;
 
-	// next comes the first tag
-	mailbuffer[2] = TAG_GET_PHYS_WH;	// get physical width/height tag
-	mailbuffer[3] = 0x8;			// value buffer size
-	mailbuffer[4] = 0;			// request/response
-	mailbuffer[5] = 0;			// space to return width
-	mailbuffer[6] = 0;			// space to return height
+	/* Check the pitch of the display */
+	if(!mbox_prop_ok(pitch_tag))
+		return FB_FAIL_INVALID_PITCH_RESPONSE;
 
-	// closing tag
-	mailbuffer[7] = 0;
+	pitch = mbox_prop_get(pitch_tag, 0);
+	if(pitch == 0)
+		return FB_FAIL_INVALID_PITCH_DATA;
 
-	// send the message
-	mbox_write(MBOX_PROP, mb_addr);
+	/* The firmware may have given us a smaller virtual size than we asked for */
+	if(mbox_prop_ok(virt_tag) && (mbox_prop_get(virt_tag, 1) < virt_h))
+		virt_h = mbox_prop_get(virt_tag, 1);
+	if((fb_size / pitch) < virt_h)
+		virt_h = fb_size / pitch;
+	if(virt_h < phys_h)
+		return FB_FAIL_INVALID_TAG_DATA;
 
-	// read the response
-	mbox_read(MBOX_PROP);
+	return 0;
+}
 
-	/* Check for a valid response */
-	if(mailbuffer[1] != MBOX_SUCCESS)
+int fb_init()
+{
+	/* Get the display size */
+	mbox_prop_begin();
+	int wh_tag = mbox_prop_add0(TAG_GET_PHYS_WH, 8);
+	if(mbox_prop_send() != 0)
 		return FB_FAIL_GET_RESOLUTION;
-	phys_w = mailbuffer[5];
-	phys_h = mailbuffer[6];
+	phys_w = mbox_prop_get(wh_tag, 0);
+	phys_h = mbox_prop_get(wh_tag, 1);
 
 	/* Request 640x480 if not otherwise specified */
 	if((phys_w == 0) && (phys_h == 0))
@@ -108,87 +138,41 @@ int fb_init()
 	if((phys_w == 0) || (phys_h == 0))
 		return FB_FAIL_INVALID_RESOLUTION;
 
-	/* For now set the physical and virtual sizes to be the same */
+	/* Try for a tall virtual framebuffer, falling back to a single screen if
+	 * the firmware cannot allocate it */
 	virt_w = phys_w;
-	virt_h = phys_h;
-
-	/* Now set the physical and virtual sizes and bit depth and allocate the framebuffer */
-	mailbuffer[0] = 22 * 4;		// size of buffer
-	mailbuffer[1] = 0;		// request
-
-	mailbuffer[2] = TAG_SET_PHYS_WH;
-	mailbuffer[3] = 8;
-	mailbuffer[4] = 8;
-	mailbuffer[5] = phys_w;
-	mailbuffer[6] = phys_h;
-
-	mailbuffer[7] = TAG_SET_VIRT_WH;
-	mailbuffer[8] = 8;
-	mailbuffer[9] = 8;
-	mailbuffer[10] = virt_w;
-	mailbuffer[11] = virt_h;
-
-	mailbuffer[12] = TAG_SET_DEPTH;
-	mailbuffer[13] = 4;
-	mailbuffer[14] = 4;
-	mailbuffer[15] = BPP;
-
-	mailbuffer[16] = TAG_ALLOCATE_BUFFER;
-	mailbuffer[17] = 8;
-	mailbuffer[18] = 4;	// request size = 4, response size = 8
-	mailbuffer[19] = 16;	// requested alignment of buffer, space for returned address
-	mailbuffer[20] = 0;	// space for returned size
+	virt_h = phys_h * FB_VIRT_PAGES;
 
-	mailbuffer[21] = 0;	// terminating tag
-
-	mbox_write(MBOX_PROP, mb_addr);
-	mbox_read(MBOX_PROP);
-
-	/* Validate the response */
-	if(mailbuffer[1] != MBOX_SUCCESS)
-		return FB_FAIL_SETUP_FB;
-
-	/* Check the allocate_buffer response */
-	if(mailbuffer[18] != (MBOX_SUCCESS | 8))
-		return FB_FAIL_INVALID_TAG_RESPONSE;
-
-	fb_addr = mailbuffer[19];
-	fb_size = mailbuffer[20];
-
-	if((fb_addr == 0) || (fb_size == 0))
-		return FB_FAIL_INVALID_TAG_DATA;
+	int ret = fb_alloc();
+	if(ret != 0)
+	{
+		virt_h = phys_h;
+		ret = fb_alloc();
+	}
+	if(ret != 0)
+		return ret;
 
 	puts("fb_init, fb_addr:");
 	puthex(fb_addr);
 	puts("");
 
-	/* Get the pitch of the display */
-	mailbuffer[0] = 7 * 4;
-	mailbuffer[1] = 0;
-
-	mailbuffer[2] = TAG_GET_PITCH;
-	mailbuffer[3] = 4;
-	mailbuffer[4] = 0;
-	mailbuffer[5] = 0;
-
-	mailbuffer[6] = 0;
-
-	mbox_write(MBOX_PROP, mb_addr);
-	mbox_read(MBOX_PROP);
-
-	/* Validate the response */
-	if(mailbuffer[1] != MBOX_SUCCESS)
-		return FB_FAIL_INVALID_PITCH_RESPONSE;
-	if(mailbuffer[4] != (MBOX_SUCCESS | 4))
-		return FB_FAIL_INVALID_PITCH_RESPONSE;
-
-	pitch = mailbuffer[5];
-	if(pitch == 0)
-		return FB_FAIL_INVALID_PITCH_DATA;
-
 	return 0;
 }
 
+// Set up the framebuffer if it hasn't been already.  Returns 0 if it is
+// available.
+int fb_ensure()
+{
+	if(fb_state == 0)
+	{
+		int ret = fb_init();
+		fb_state = (ret == 0) ? 1 : ret;
+		if(ret != 0)
+			printf("FB: unable to set up framebuffer: %i\n", ret);
+	}
+	return (fb_state == 1) ? 0 : fb_state;
+}
+
 int fb_get_bpp()
 {
 	return BPP;
@@ -196,26 +180,198 @@ int fb_get_bpp()
 
 int fb_get_byte_size()
 {
+	fb_ensure();
 	return virt_w * virt_h * BYTES_PER_PIXEL;
 }
 
 int fb_get_width()
 {
+	fb_ensure();
 	return virt_w;
 }
 
+// Visible height
 int fb_get_height()
 {
+	fb_ensure();
+	return phys_h;
+}
+
+// Height of the whole virtual framebuffer
+int fb_get_virt_height()
+{
+	fb_ensure();
 	return virt_h;
 }
 
+// Set the line of the virtual framebuffer shown at the top of the screen
+int fb_set_virt_offset(uint32_t y)
+{
+	mbox_prop_begin();
+	int t = mbox_prop_add2(TAG_SET_VIRT_OFFSET, 8, 0, y);
+	if(mbox_prop_send() != 0)
+		return -1;
+	if(!mbox_prop_ok(t) || (mbox_prop_get(t, 1) != y))
+		return -1;
+	return 0;
+}
+
 int fb_get_pitch()
 {
+	fb_ensure();
 	return pitch;
 }
 
 uint8_t *fb_get_framebuffer()
 {
+	fb_ensure();
 	return (uint8_t *)fb_addr;
 }
 
+/* 2D blitter
+ *
+ * Rectangle fills and copies within the (virtual) framebuffer are done by a
+ * full DMA channel in 2D mode so the CPU can carry on while they run.  Only
+ * one operation is outstanding at a time: starting another, or calling
+ * fb_blit_wait(), waits for the previous one.  Callers must call
+ * fb_blit_wait() before touching the affected area with the CPU.  If no DMA
+ * channel is available, or the rectangle is not word aligned, the operation
+ * is done synchronously by the CPU.
+ *
+ * Coordinates are in pixels from the top of the virtual framebuffer.
+ */
+
+#define BLIT_TIMEOUT	100000
+
+static int blit_chan = -2;		// -2 = not yet allocated
+static int blit_busy = 0;
+static struct dma_cb blit_cb;
+static uint32_t fill_pattern[8] __attribute__((aligned(32)));
+
+static int blit_get_chan()
+{
+	if(blit_chan == -2)
+		blit_chan = dma_alloc_channel(DMA_CHAN_FULL);
+	return blit_chan;
+}
+
+void fb_blit_wait()
+{
+	if(!blit_busy)
+		return;
+	blit_busy = 0;
+	if(dma_wait(blit_chan, BLIT_TIMEOUT) != 0)
+	{
+		// Don't trust the DMA engine again
+		blit_chan = DMA_ERR_NO_CHANNEL;
+	}
+}
+
+static int blit_can_dma(int x, int w, int h)
+{
+	int x_bytes = x * BYTES_PER_PIXEL;
+	int w_bytes = w * BYTES_PER_PIXEL;
+
+	if((x_bytes & 3) || (w_bytes & 3) || (pitch & 3))
+		return 0;
+	if((w_bytes > DMA_MAX_XLENGTH) || (h > DMA_MAX_YLENGTH))
+		return 0;
+	if((int)pitch + w_bytes > 0x7fff)		// strides are signed 16 bit
+		return 0;
+	if(!dma_memory_direct())
+		return 0;
+	return blit_get_chan() >= 0;
+}
+
+static int blit_clip(int x, int y, int w, int h)
+{
+	if((x < 0) || (y < 0) || (w <= 0) || (h <= 0))
+		return -1;
+	if(((uint32_t)(x + w) > virt_w) || ((uint32_t)(y + h) > virt_h))
+		return -1;
+	return 0;
+}
+
+int fb_fill_rect(int x, int y, int w, int h, uint32_t colour)
+{
+	if(blit_clip(x, y, w, h) != 0)
+		return -1;
+
+	fb_blit_wait();
+
+	if(BYTES_PER_PIXEL == 2)
+		colour = (colour & 0xffff) | (colour << 16);
+	uint8_t *d = (uint8_t *)fb_addr + y * pitch + x * BYTES_PER_PIXEL;
+	int w_bytes = w * BYTES_PER_PIXEL;
+
+	if(!blit_can_dma(x, w, h))
+	{
+		for(int line = 0; line < h; line++, d += pitch)
+		{
+			if(colour == 0)
+				memset(d, 0, w_bytes);
+			else
+			{
+				for(int i = 0; i < w_bytes; i++)
+					d[i] = (uint8_t)(colour >> ((i & 3) * 8));
+			}
+		}
+		return 0;
+	}
+
+	for(int i = 0; i < 8; i++)
+		fill_pattern[i] = colour;
+
+	// Source doesn't increment, so the same word is written repeatedly
+	blit_cb.ti = DMA_TI_TDMODE | DMA_TI_DEST_INC | DMA_TI_WAIT_RESP | DMA_TI_BURST(4);
+	blit_cb.source_ad = DMA_BUS_ADDR(fill_pattern);
+	blit_cb.dest_ad = DMA_BUS_ADDR(d);
+	blit_cb.txfr_len = DMA_TXFR_LEN_2D(w_bytes, h);
+	blit_cb.stride = DMA_STRIDE(pitch - w_bytes, 0);
+	blit_cb.nextconbk = 0;
+
+	dma_start(blit_chan, &blit_cb);
+	blit_busy = 1;
+	return 0;
+}
+
+int fb_copy_rect(int dx, int dy, int sx, int sy, int w, int h)
+{
+	if((blit_clip(dx, dy, w, h) != 0) || (blit_clip(sx, sy, w, h) != 0))
+		return -1;
+
+	fb_blit_wait();
+
+	int w_bytes = w * BYTES_PER_PIXEL;
+	uint8_t *d = (uint8_t *)fb_addr + dy * pitch + dx * BYTES_PER_PIXEL;
+	uint8_t *s = (uint8_t *)fb_addr + sy * pitch + sx * BYTES_PER_PIXEL;
+
+	// When copying downwards start at the last line so that overlapping
+	// areas are handled correctly
+	int step = (int)pitch;
+	if(dy > sy)
+	{
+		d += (h - 1) * pitch;
+		s += (h - 1) * pitch;
+		step = -step;
+	}
+
+	if(!blit_can_dma(dx, w, h) || ((sx * BYTES_PER_PIXEL) & 3))
+	{
+		for(int line = 0; line < h; line++, d += step, s += step)
+			quick_memcpy(d, s, w_bytes);
+		return 0;
+	}
+
+	blit_cb.ti = DMA_TI_TDMODE | DMA_TI_SRC_INC | DMA_TI_DEST_INC | DMA_TI_WAIT_RESP |
+		DMA_TI_BURST(4);
+	blit_cb.source_ad = DMA_BUS_ADDR(s);
+	blit_cb.dest_ad = DMA_BUS_ADDR(d);
+	blit_cb.txfr_len = DMA_TXFR_LEN_2D(w_bytes, h);
+	blit_cb.stride = DMA_STRIDE(step - w_bytes, step - w_bytes);
+	blit_cb.nextconbk = 0;
+
+	dma_start(blit_chan, &blit_cb);
+	blit_busy = 1;
+	return 0;
+}
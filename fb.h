@@ -33,10 +33,17 @@
 
 uint8_t *fb_get_framebuffer();
 int fb_init();
+int fb_ensure();
 int fb_get_bpp();
 int fb_get_byte_size();
 int fb_get_width();
 int fb_get_height();
+int fb_get_virt_height();
+int fb_set_virt_offset(uint32_t y);
+
+int fb_fill_rect(int x, int y, int w, int h, uint32_t colour);
+int fb_copy_rect(int dx, int dy, int sx, int sy, int w, int h);
+void fb_blit_wait();
 int fb_get_pitch();
 
 #endif
@@ -34,6 +34,12 @@ struct fs {
 	size_t (*fread)(struct fs *, void *ptr, size_t size, size_t nmemb, FILE *stream);
 	int (*fclose)(struct fs *, FILE *fp);
 
+	// Optional: find the device block holding a block aligned file offset,
+	// and how many bytes from there (at most max_len) lie in consecutive
+	// blocks.  Returns 0, or a negative value if it cannot be mapped.
+	int (*fmap)(struct fs *, FILE *fp, long offset, size_t max_len,
+			uint32_t *block_no, size_t *len);
+
 	struct dirent *(*read_directory)(struct fs *, char **name);
 };
 
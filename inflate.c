@@ -0,0 +1,437 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Deflate decoder (RFC 1951)
+ *
+ * Huffman codes up to INFLATE_FAST_BITS long are decoded with a single table
+ * lookup; longer ones (rare in practice) fall back to walking the canonical
+ * code one bit at a time.  The whole output buffer doubles as the window.
+ *
+ * The input may still be arriving while it is decoded: inflate_stream()
+ * calls back to wait for more whenever it reaches the end of what it has
+ * been told is available.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "inflate.h"
+
+#define INFLATE_FAST_BITS	9
+#define INFLATE_MAX_BITS	15
+
+struct huffman
+{
+	uint16_t fast[1 << INFLATE_FAST_BITS];	// (length << 12) | symbol, or 0
+	uint16_t count[INFLATE_MAX_BITS + 1];	// number of codes of each length
+	uint16_t symbol[288];			// symbols in canonical order
+};
+
+struct inflate_state
+{
+	const uint8_t *src;
+	const uint8_t *src_start;
+	const uint8_t *src_avail;	// end of the input which has arrived
+	const uint8_t *src_end;
+	size_t (*wait)(void *ctx, size_t need);
+	void *ctx;
+	uint32_t bitbuf;
+	int bitcnt;
+	int overrun;		// bytes of zero padding fed past the end of src
+
+	uint8_t *dst;
+	size_t dst_len;
+	size_t out;
+};
+
+static const uint16_t len_base[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order in which code length code lengths are stored
+static const uint8_t clen_order[19] =
+{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static struct huffman fixed_lit, fixed_dist;
+static int fixed_built = 0;
+
+// Wait until n bytes at s->src have arrived.  Returns 0 if the input ends
+// before then.
+static int wait_input(struct inflate_state *s, size_t n)
+{
+	if((size_t)(s->src_avail - s->src) >= n)
+		return 1;
+	if(s->wait)
+	{
+		size_t have = s->wait(s->ctx, (size_t)(s->src - s->src_start) + n);
+		if(have > (size_t)(s->src_end - s->src_start))
+			have = (size_t)(s->src_end - s->src_start);
+		s->src_avail = s->src_start + have;
+	}
+	return (size_t)(s->src_avail - s->src) >= n;
+}
+
+// Make sure at least 'need' bits are in the bit buffer (need <= 24)
+static inline void need_bits(struct inflate_state *s, int need)
+{
+	while(s->bitcnt < need)
+	{
+		uint32_t b = 0;
+		if((s->src < s->src_avail) || wait_input(s, 1))
+			b = *s->src++;
+		else
+			s->overrun++;
+		s->bitbuf |= b << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static inline uint32_t get_bits(struct inflate_state *s, int n)
+{
+	need_bits(s, n);
+	uint32_t v = s->bitbuf & ((1U << n) - 1);
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+	return v;
+}
+
+// Build a decoding table from a list of code lengths.  Returns 0 on success
+// or -1 if the lengths do not describe a valid code.  Incomplete codes are
+// allowed since deflate uses them for single distance codes.
+static int huffman_build(struct huffman *h, const uint8_t *lengths, int n)
+{
+	uint16_t offs[INFLATE_MAX_BITS + 1];
+
+	for(int i = 0; i <= INFLATE_MAX_BITS; i++)
+		h->count[i] = 0;
+	for(int i = 0; i < n; i++)
+		h->count[lengths[i]]++;
+	h->count[0] = 0;
+
+	int left = 1;
+	for(int i = 1; i <= INFLATE_MAX_BITS; i++)
+	{
+		left <<= 1;
+		left -= h->count[i];
+		if(left < 0)
+			return -1;
+	}
+
+	offs[1] = 0;
+	for(int i = 1; i < INFLATE_MAX_BITS; i++)
+		offs[i + 1] = offs[i] + h->count[i];
+	for(int i = 0; i < n; i++)
+	{
+		if(lengths[i])
+			h->symbol[offs[lengths[i]]++] = (uint16_t)i;
+	}
+
+	// Fill the fast table.  Codes are stored most significant bit first
+	// but read least significant bit first, so index by the reversed code.
+	for(int i = 0; i < (1 << INFLATE_FAST_BITS); i++)
+		h->fast[i] = 0;
+
+	int code = 0;
+	int idx = 0;
+	for(int len = 1; len <= INFLATE_FAST_BITS; len++)
+	{
+		for(int i = 0; i < h->count[len]; i++)
+		{
+			int rev = 0;
+			for(int b = 0; b < len; b++)
+				rev |= ((code >> b) & 1) << (len - 1 - b);
+			for(int j = rev; j < (1 << INFLATE_FAST_BITS); j += 1 << len)
+				h->fast[j] = (uint16_t)((len << 12) | h->symbol[idx]);
+			code++;
+			idx++;
+		}
+		code <<= 1;
+	}
+	return 0;
+}
+
+static int huffman_decode(struct inflate_state *s, const struct huffman *h)
+{
+	need_bits(s, INFLATE_FAST_BITS);
+	uint16_t e = h->fast[s->bitbuf & ((1 << INFLATE_FAST_BITS) - 1)];
+	if(e)
+	{
+		int len = e >> 12;
+		s->bitbuf >>= len;
+		s->bitcnt -= len;
+		return e & 0xfff;
+	}
+
+	// Long code - walk the canonical code a bit at a time
+	int code = 0, first = 0, index = 0;
+	for(int len = 1; len <= INFLATE_MAX_BITS; len++)
+	{
+		code |= (int)get_bits(s, 1);
+		int count = h->count[len];
+		if(code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static void build_fixed()
+{
+	uint8_t lengths[288];
+	int i;
+	for(i = 0; i < 144; i++)
+		lengths[i] = 8;
+	for(; i < 256; i++)
+		lengths[i] = 9;
+	for(; i < 280; i++)
+		lengths[i] = 7;
+	for(; i < 288; i++)
+		lengths[i] = 8;
+	huffman_build(&fixed_lit, lengths, 288);
+
+	for(i = 0; i < 30; i++)
+		lengths[i] = 5;
+	huffman_build(&fixed_dist, lengths, 30);
+
+	fixed_built = 1;
+}
+
+static int inflate_stored(struct inflate_state *s)
+{
+	// Discard to a byte boundary then hand back any whole bytes still in
+	// the bit buffer
+	s->bitbuf >>= s->bitcnt & 7;
+	s->bitcnt &= ~7;
+	while(s->bitcnt > 0)
+	{
+		if(s->overrun)
+			s->overrun--;
+		else
+			s->src--;
+		s->bitcnt -= 8;
+	}
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+
+	if(!wait_input(s, 4))
+		return INFLATE_INPUT_END;
+	uint32_t len = s->src[0] | (s->src[1] << 8);
+	uint32_t nlen = s->src[2] | (s->src[3] << 8);
+	s->src += 4;
+	if(len != (~nlen & 0xffff))
+		return INFLATE_BAD_DATA;
+	if(!wait_input(s, len))
+		return INFLATE_INPUT_END;
+	if(s->dst_len - s->out < len)
+		return INFLATE_OUTPUT_FULL;
+
+	for(uint32_t i = 0; i < len; i++)
+		s->dst[s->out++] = *s->src++;
+	return INFLATE_OK;
+}
+
+static int inflate_codes(struct inflate_state *s, const struct huffman *lit,
+		const struct huffman *dist)
+{
+	uint8_t *dst = s->dst;
+	size_t out = s->out;
+	size_t dst_len = s->dst_len;
+
+	while(1)
+	{
+		int sym = huffman_decode(s, lit);
+		if(sym < 0)
+			return INFLATE_BAD_DATA;
+		if(s->overrun > 4)
+			return INFLATE_INPUT_END;
+		if(sym < 256)
+		{
+			if(out >= dst_len)
+				return INFLATE_OUTPUT_FULL;
+			dst[out++] = (uint8_t)sym;
+			continue;
+		}
+		if(sym == 256)
+			break;
+
+		sym -= 257;
+		if(sym >= 29)
+			return INFLATE_BAD_DATA;
+		size_t len = len_base[sym] + get_bits(s, len_extra[sym]);
+
+		int dsym = huffman_decode(s, dist);
+		if((dsym < 0) || (dsym >= 30))
+			return INFLATE_BAD_DATA;
+		size_t d = dist_base[dsym] + get_bits(s, dist_extra[dsym]);
+
+		if(d > out)
+			return INFLATE_BAD_DATA;
+		if(dst_len - out < len)
+			return INFLATE_OUTPUT_FULL;
+
+		// Byte copy so that overlapping matches repeat correctly
+		const uint8_t *from = &dst[out - d];
+		uint8_t *to = &dst[out];
+		out += len;
+		while(len--)
+			*to++ = *from++;
+	}
+
+	s->out = out;
+	return INFLATE_OK;
+}
+
+static int inflate_dynamic(struct inflate_state *s)
+{
+	static struct huffman lit, dist;
+	uint8_t lengths[288 + 32];
+
+	int nlen = (int)get_bits(s, 5) + 257;
+	int ndist = (int)get_bits(s, 5) + 1;
+	int ncode = (int)get_bits(s, 4) + 4;
+	if((nlen > 286) || (ndist > 30))
+		return INFLATE_BAD_DATA;
+
+	for(int i = 0; i < 19; i++)
+		lengths[clen_order[i]] = (i < ncode) ? (uint8_t)get_bits(s, 3) : 0;
+	if(huffman_build(&lit, lengths, 19) != 0)
+		return INFLATE_BAD_DATA;
+
+	int idx = 0;
+	while(idx < nlen + ndist)
+	{
+		int sym = huffman_decode(s, &lit);
+		if(sym < 0)
+			return INFLATE_BAD_DATA;
+		if(sym < 16)
+		{
+			lengths[idx++] = (uint8_t)sym;
+			continue;
+		}
+
+		uint8_t val = 0;
+		int rep;
+		if(sym == 16)
+		{
+			if(idx == 0)
+				return INFLATE_BAD_DATA;
+			val = lengths[idx - 1];
+			rep = 3 + (int)get_bits(s, 2);
+		}
+		else if(sym == 17)
+			rep = 3 + (int)get_bits(s, 3);
+		else
+			rep = 11 + (int)get_bits(s, 7);
+
+		if(idx + rep > nlen + ndist)
+			return INFLATE_BAD_DATA;
+		while(rep--)
+			lengths[idx++] = val;
+	}
+
+	if(lengths[256] == 0)
+		return INFLATE_BAD_DATA;
+	if(huffman_build(&lit, lengths, nlen) != 0)
+		return INFLATE_BAD_DATA;
+	if(huffman_build(&dist, &lengths[nlen], ndist) != 0)
+		return INFLATE_BAD_DATA;
+
+	return inflate_codes(s, &lit, &dist);
+}
+
+int inflate(uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len,
+		size_t *out_len)
+{
+	return inflate_stream(dst, dst_len, src, src_len, (void *)0, (void *)0,
+			out_len);
+}
+
+int inflate_stream(uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len,
+		size_t (*wait)(void *ctx, size_t need), void *ctx, size_t *out_len)
+{
+	struct inflate_state s;
+	s.src = src;
+	s.src_start = src;
+	s.src_avail = wait ? src : src + src_len;
+	s.src_end = src + src_len;
+	s.wait = wait;
+	s.ctx = ctx;
+	s.bitbuf = 0;
+	s.bitcnt = 0;
+	s.overrun = 0;
+	s.dst = dst;
+	s.dst_len = dst_len;
+	s.out = 0;
+
+	int last;
+	do
+	{
+		last = (int)get_bits(&s, 1);
+		int type = (int)get_bits(&s, 2);
+		int ret;
+
+		switch(type)
+		{
+			case 0:
+				ret = inflate_stored(&s);
+				break;
+			case 1:
+				if(!fixed_built)
+					build_fixed();
+				ret = inflate_codes(&s, &fixed_lit, &fixed_dist);
+				break;
+			case 2:
+				ret = inflate_dynamic(&s);
+				break;
+			default:
+				ret = INFLATE_BAD_DATA;
+				break;
+		}
+
+		if(ret != INFLATE_OK)
+			return ret;
+	} while(!last);
+
+	*out_len = s.out;
+	return INFLATE_OK;
+}
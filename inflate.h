@@ -0,0 +1,45 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decode a raw deflate (RFC 1951) stream from src into dst.  On success
+// returns INFLATE_OK and the number of bytes written in *out_len.
+int inflate(uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len,
+		size_t *out_len);
+
+// As inflate(), but for input which is still arriving.  wait(ctx, need) is
+// called when the decoder runs out, and returns once at least 'need' bytes
+// from the start of src are available (or the input has ended), giving the
+// number now available.
+int inflate_stream(uint8_t *dst, size_t dst_len, const uint8_t *src, size_t src_len,
+		size_t (*wait)(void *ctx, size_t need), void *ctx, size_t *out_len);
+
+#define INFLATE_OK			0
+#define INFLATE_INPUT_END		-1
+#define INFLATE_OUTPUT_FULL		-2
+#define INFLATE_BAD_DATA		-3
+
+#endif
@@ -0,0 +1,224 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Pipelined loading
+ *
+ * A load pipe reads len bytes from the current position of a file into one
+ * contiguous buffer while the caller works on the part which has already
+ * arrived.  The file is mapped to runs of device blocks with fs->fmap() and
+ * each run (up to LOADPIPE_CHUNK bytes) is read with block_read_start().  As
+ * soon as one transfer completes the next is started, so the card is busy
+ * with chunk N+1 while the caller decompresses, checks or copies chunk N.
+ * There are no interrupts, so the pipe only moves on when the caller calls
+ * loadpipe_wait().
+ *
+ * Filesystems without fmap(), and files not starting on a block boundary,
+ * are read with fread() a chunk at a time instead.
+ *
+ * Files being verified are hashed a chunk at a time once the next transfer
+ * has been started, so hashing also overlaps the card.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "loadpipe.h"
+#include "block.h"
+#include "console.h"
+#include "timer.h"
+#include "trace.h"
+#include "verify.h"
+#include "vfs.h"
+#include "fs.h"
+
+// Hash what has arrived, unless fread() has already done so
+static void loadpipe_verify(struct loadpipe *lp)
+{
+	if(lp->fp->verify && lp->async && (lp->verified < lp->ready))
+		verify_update(lp->fp, lp->base + (long)lp->verified,
+				&lp->dst[lp->verified], lp->ready - lp->verified);
+	lp->verified = lp->ready;
+}
+
+// Start the next transfer
+static void loadpipe_issue(struct loadpipe *lp)
+{
+	size_t n = lp->len - lp->issued;
+	if(n > LOADPIPE_CHUNK)
+		n = LOADPIPE_CHUNK;
+	if(n == 0)
+		return;
+
+	lp->io_start = timer_get_ticks();
+	if(lp->async)
+	{
+		uint32_t block_no;
+		size_t run;
+		if(lp->fp->fs->fmap(lp->fp->fs, lp->fp, lp->base + (long)lp->issued,
+					n, &block_no, &run) == 0)
+		{
+			run -= run % lp->dev->block_size;
+			if(run)
+			{
+				int ret = block_read_start(lp->dev, &lp->dst[lp->issued], run,
+						block_no);
+				if(ret < 0)
+				{
+					lp->error = ret;
+					return;
+				}
+				lp->issued += run;
+				lp->in_flight = 1;
+				return;
+			}
+			// Only part of a block is left; fall through to fread()
+		}
+		else
+		{
+			TRACE(BLOCK, TRACE_DEBUG, "LOAD: cannot map offset %i, "
+					"continuing with fread()\n", (int)(lp->base + (long)lp->issued));
+			loadpipe_verify(lp);
+			lp->async = 0;
+		}
+	}
+
+	// fread() hashes what it reads, so catch up first
+	loadpipe_verify(lp);
+	lp->io_start = timer_get_ticks();
+	fseek(lp->fp, lp->base + (long)lp->issued, SEEK_SET);
+	size_t bytes_read = fread(&lp->dst[lp->issued], 1, n, lp->fp);
+	uint32_t t = (uint32_t)(timer_get_ticks() - lp->io_start);
+	lp->stats.io_busy += t;
+	lp->stats.cpu_wait += t;
+	if(bytes_read != n)
+	{
+		lp->error = LOADPIPE_ERR_READ;
+		return;
+	}
+	lp->issued += n;
+	lp->ready = lp->issued;
+}
+
+// Wait for the transfer in progress.  The transfer is counted as busy until
+// it is seen to have finished, so io_busy is an upper bound.
+static void loadpipe_complete(struct loadpipe *lp)
+{
+	uint64_t now = timer_get_ticks();
+	int busy = block_read_busy(lp->dev);
+	int ret = block_read_wait(lp->dev);
+	uint64_t done = timer_get_ticks();
+
+	if(busy)
+		lp->stats.cpu_wait += (uint32_t)(done - now);
+	lp->stats.io_busy += (uint32_t)(done - lp->io_start);
+	lp->in_flight = 0;
+	if(ret < 0)
+		lp->error = ret;
+	else
+		lp->ready = lp->issued;
+}
+
+// Start loading len bytes from the current position of fp into dst.
+// Returns 0 or a negative error.
+int loadpipe_begin(struct loadpipe *lp, FILE *fp, void *dst, size_t len)
+{
+	memset(lp, 0, sizeof(struct loadpipe));
+	lp->fp = fp;
+	lp->dev = fp->fs->parent;
+	lp->dst = (uint8_t *)dst;
+	lp->base = fp->pos;
+	lp->len = len;
+	lp->stats.bytes = (uint32_t)len;
+	lp->start_time = timer_get_ticks();
+
+	if(fp->fs->fmap && lp->dev && !((size_t)lp->base % lp->dev->block_size))
+	{
+		lp->async = 1;
+		loadpipe_issue(lp);
+	}
+	return lp->error;
+}
+
+// Wait until at least the first 'need' bytes of the buffer have arrived,
+// then make sure the next transfer is under way.  Returns the number of
+// bytes which have arrived, which is less than need only on error.
+size_t loadpipe_wait(struct loadpipe *lp, size_t need)
+{
+	if(need > lp->len)
+		need = lp->len;
+
+	while((lp->ready < need) && !lp->error)
+	{
+		console_poll();
+		if(lp->in_flight)
+			loadpipe_complete(lp);
+		else
+			loadpipe_issue(lp);
+	}
+
+	// Keep the card busy while the caller works on what it has
+	if(lp->in_flight && !block_read_busy(lp->dev))
+		loadpipe_complete(lp);
+	if(lp->async && !lp->in_flight && !lp->error)
+		loadpipe_issue(lp);
+
+	loadpipe_verify(lp);
+	return lp->ready;
+}
+
+// Stop the pipe, waiting for any transfer still in progress, and report how
+// the time was spent.  The file is left positioned after the data which
+// arrived.  Returns 0 or the first error seen.
+int loadpipe_end(struct loadpipe *lp, const char *name)
+{
+	if(!lp->fp)
+		return lp->error;
+
+	if(lp->in_flight)
+		loadpipe_complete(lp);
+	loadpipe_verify(lp);
+	fseek(lp->fp, lp->base + (long)lp->ready, SEEK_SET);
+	lp->fp = (void *)0;
+
+	struct loadpipe_stats *s = &lp->stats;
+	s->elapsed = (uint32_t)(timer_get_ticks() - lp->start_time);
+	s->cpu_busy = s->elapsed - s->cpu_wait;
+	if(s->io_busy > s->elapsed)
+		s->io_busy = s->elapsed;
+
+	TRACE(MULTIBOOT, TRACE_INFO, "LOAD: %s: %u bytes in %u us, card busy %u "
+			"idle %u us, cpu busy %u waiting %u us\n", name, s->bytes,
+			s->elapsed, s->io_busy, s->elapsed - s->io_busy, s->cpu_busy,
+			s->cpu_wait);
+	return lp->error;
+}
+
+// Read len bytes from the current position of fp into dst through a pipe.
+// Returns the number of bytes read.
+size_t loadpipe_read(FILE *fp, void *dst, size_t len, const char *name)
+{
+	struct loadpipe lp;
+	loadpipe_begin(&lp, fp, dst, len);
+	size_t ret = loadpipe_wait(&lp, len);
+	loadpipe_end(&lp, name);
+	return ret;
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LOADPIPE_H
+#define LOADPIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "block.h"
+
+// Largest single transfer
+#define LOADPIPE_CHUNK		BLOCK_ASYNC_MAX
+
+#define LOADPIPE_ERR_READ	-1
+
+// Time in microseconds spent by each stage of a load
+struct loadpipe_stats
+{
+	uint32_t bytes;
+	uint32_t elapsed;	// from loadpipe_begin() to loadpipe_end()
+	uint32_t io_busy;	// a transfer was in progress
+	uint32_t cpu_busy;	// the caller was working on data which had arrived
+	uint32_t cpu_wait;	// the caller was waiting for data
+};
+
+struct loadpipe
+{
+	FILE *fp;
+	struct block_device *dev;
+	uint8_t *dst;
+	long base;		// file offset of dst[0]
+	size_t len;
+	size_t ready;		// bytes at the start of dst which have arrived
+	size_t issued;		// end of the transfer in progress
+	size_t verified;	// bytes passed to verify_update()
+	int in_flight;
+	int async;		// reading blocks directly rather than with fread()
+	int error;
+	uint64_t start_time;
+	uint64_t io_start;
+	struct loadpipe_stats stats;
+};
+
+int loadpipe_begin(struct loadpipe *lp, FILE *fp, void *dst, size_t len);
+size_t loadpipe_wait(struct loadpipe *lp, size_t need);
+int loadpipe_end(struct loadpipe *lp, const char *name);
+size_t loadpipe_read(FILE *fp, void *dst, size_t len, const char *name);
+
+#endif
@@ -0,0 +1,294 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* LZ4 frame decoder
+ *
+ * See the LZ4 frame and block format descriptions at
+ * https://github.com/lz4/lz4/tree/dev/doc
+ *
+ * Frames are decoded into one contiguous buffer, so blocks which refer back
+ * into earlier blocks (the default, 'linked' mode) need no special handling.
+ * Header and block checksums are not verified.
+ *
+ * lz4_frame_decode_stream() accepts input which is still arriving, waiting
+ * for each block to be complete before it is decoded.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lz4.h"
+
+#define LZ4_SKIPPABLE_MAGIC	0x184d2a50	// low 4 bits are user defined
+#define LZ4_MIN_MATCH		4
+
+#define FLG_VERSION(f)		(((f) >> 6) & 0x3)
+#define FLG_BLOCK_CHECKSUM	(1 << 4)
+#define FLG_CONTENT_SIZE	(1 << 3)
+#define FLG_CONTENT_CHECKSUM	(1 << 2)
+#define FLG_DICT_ID		(1 << 0)
+
+static uint32_t read32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+		((uint32_t)p[3] << 24);
+}
+
+// Input which may still be arriving
+struct lz4_input
+{
+	const uint8_t *start;
+	size_t have;		// bytes from start which have arrived
+	size_t len;
+	size_t (*wait)(void *ctx, size_t need);
+	void *ctx;
+};
+
+// Wait until n bytes at ip have arrived.  Returns 0 if the input ends first.
+static int wait_input(struct lz4_input *in, const uint8_t *ip, size_t n)
+{
+	size_t need = (size_t)(ip - in->start) + n;
+	if(need <= in->have)
+		return 1;
+	if(in->wait)
+	{
+		in->have = in->wait(in->ctx, need);
+		if(in->have > in->len)
+			in->have = in->len;
+	}
+	return need <= in->have;
+}
+
+#define WAIT_INPUT(n)	do { if(!wait_input(&in, ip, (n))) return LZ4_INPUT_END; } while(0)
+
+// Decode a single compressed block.  'out' is the current position in dst;
+// matches may reach back to the start of dst.
+static int lz4_block_decode(uint8_t *dst, size_t dst_len, size_t *out,
+		const uint8_t *src, size_t src_len)
+{
+	const uint8_t *ip = src;
+	const uint8_t *ip_end = src + src_len;
+	size_t op = *out;
+
+	while(ip < ip_end)
+	{
+		uint32_t token = *ip++;
+
+		// Literals
+		size_t lit_len = token >> 4;
+		if(lit_len == 15)
+		{
+			uint32_t b;
+			do
+			{
+				if(ip >= ip_end)
+					return LZ4_INPUT_END;
+				b = *ip++;
+				lit_len += b;
+			} while(b == 255);
+		}
+		if((size_t)(ip_end - ip) < lit_len)
+			return LZ4_INPUT_END;
+		if(dst)
+		{
+			if(dst_len - op < lit_len)
+				return LZ4_OUTPUT_FULL;
+			uint8_t *to = &dst[op];
+			for(size_t i = 0; i < lit_len; i++)
+				to[i] = ip[i];
+		}
+		ip += lit_len;
+		op += lit_len;
+
+		// The last sequence of a block has only literals
+		if(ip >= ip_end)
+			break;
+
+		// Match
+		if(ip_end - ip < 2)
+			return LZ4_INPUT_END;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if((offset == 0) || (offset > op))
+			return LZ4_BAD_DATA;
+
+		size_t match_len = token & 0xf;
+		if(match_len == 15)
+		{
+			uint32_t b;
+			do
+			{
+				if(ip >= ip_end)
+					return LZ4_INPUT_END;
+				b = *ip++;
+				match_len += b;
+			} while(b == 255);
+		}
+		match_len += LZ4_MIN_MATCH;
+
+		if(dst)
+		{
+			if(dst_len - op < match_len)
+				return LZ4_OUTPUT_FULL;
+			const uint8_t *from = &dst[op - offset];
+			uint8_t *to = &dst[op];
+			if(offset >= 4)
+			{
+				// Four bytes at a time is safe as the source stays at least
+				// one word behind the destination
+				size_t i = 0;
+				for(; i + 4 <= match_len; i += 4)
+				{
+					to[i] = from[i];
+					to[i + 1] = from[i + 1];
+					to[i + 2] = from[i + 2];
+					to[i + 3] = from[i + 3];
+				}
+				for(; i < match_len; i++)
+					to[i] = from[i];
+			}
+			else
+			{
+				for(size_t i = 0; i < match_len; i++)
+					to[i] = from[i];
+			}
+		}
+		op += match_len;
+	}
+
+	*out = op;
+	return LZ4_OK;
+}
+
+int lz4_frame_decode(uint8_t *dst, size_t dst_len, const uint8_t *src,
+		size_t src_len, size_t *out_len)
+{
+	return lz4_frame_decode_stream(dst, dst_len, src, src_len, (void *)0,
+			(void *)0, out_len);
+}
+
+int lz4_frame_decode_stream(uint8_t *dst, size_t dst_len, const uint8_t *src,
+		size_t src_len, size_t (*wait)(void *ctx, size_t need), void *ctx,
+		size_t *out_len)
+{
+	const uint8_t *ip = src;
+	const uint8_t *ip_end = src + src_len;
+	size_t op = 0;
+
+	struct lz4_input in;
+	in.start = src;
+	in.have = wait ? 0 : src_len;
+	in.len = src_len;
+	in.wait = wait;
+	in.ctx = ctx;
+
+	while(ip_end - ip >= 4)
+	{
+		WAIT_INPUT(4);
+		uint32_t magic = read32(ip);
+		ip += 4;
+
+		if((magic & 0xfffffff0) == LZ4_SKIPPABLE_MAGIC)
+		{
+			WAIT_INPUT(4);
+			uint32_t skip = read32(ip);
+			ip += 4;
+			if((uint32_t)(ip_end - ip) < skip)
+				return LZ4_INPUT_END;
+			ip += skip;
+			continue;
+		}
+		if(magic != LZ4_FRAME_MAGIC)
+			return LZ4_BAD_DATA;
+
+		// Frame descriptor
+		WAIT_INPUT(3);
+		uint8_t flg = ip[0];
+		ip += 2;		// FLG, BD
+		if(FLG_VERSION(flg) != 1)
+			return LZ4_UNSUPPORTED;
+		if(flg & FLG_DICT_ID)
+			return LZ4_UNSUPPORTED;
+		// When only measuring, a frame which gives its size need not be
+		// decoded; its blocks are just skipped
+		int skip_blocks = 0;
+		if(flg & FLG_CONTENT_SIZE)
+		{
+			WAIT_INPUT(9);
+			if(!dst)
+			{
+				// Only the low 32 bits can be addressed
+				op += read32(ip);
+				skip_blocks = 1;
+			}
+			ip += 8;
+		}
+		ip++;			// header checksum
+		if(ip > ip_end)
+			return LZ4_INPUT_END;
+
+		// Data blocks, terminated by a zero size
+		while(1)
+		{
+			WAIT_INPUT(4);
+			uint32_t bsize = read32(ip);
+			ip += 4;
+			if(bsize == 0)
+				break;
+
+			uint32_t uncompressed = bsize & 0x80000000;
+			bsize &= 0x7fffffff;
+			WAIT_INPUT(bsize);
+
+			if(!skip_blocks)
+			{
+				if(uncompressed)
+				{
+					if(dst)
+					{
+						if(dst_len - op < bsize)
+							return LZ4_OUTPUT_FULL;
+						for(uint32_t i = 0; i < bsize; i++)
+							dst[op + i] = ip[i];
+					}
+					op += bsize;
+				}
+				else
+				{
+					int ret = lz4_block_decode(dst, dst_len, &op, ip, bsize);
+					if(ret != LZ4_OK)
+						return ret;
+				}
+			}
+			ip += bsize;
+
+			if(flg & FLG_BLOCK_CHECKSUM)
+				ip += 4;
+		}
+
+		if(flg & FLG_CONTENT_CHECKSUM)
+			ip += 4;
+		if(ip > ip_end)
+			return LZ4_INPUT_END;
+	}
+
+	*out_len = op;
+	return LZ4_OK;
+}
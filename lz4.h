@@ -0,0 +1,49 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ4_FRAME_MAGIC		0x184d2204
+
+// Decode one or more concatenated LZ4 frames from src into dst.  If dst is
+// null nothing is written and *out_len receives the decompressed size; frames
+// with a content size field are then only walked, not decoded.
+int lz4_frame_decode(uint8_t *dst, size_t dst_len, const uint8_t *src,
+		size_t src_len, size_t *out_len);
+
+// As lz4_frame_decode(), but for input which is still arriving.  wait(ctx,
+// need) returns once at least 'need' bytes from the start of src are
+// available (or the input has ended), giving the number now available.
+int lz4_frame_decode_stream(uint8_t *dst, size_t dst_len, const uint8_t *src,
+		size_t src_len, size_t (*wait)(void *ctx, size_t need), void *ctx,
+		size_t *out_len);
+
+#define LZ4_OK				0
+#define LZ4_INPUT_END			-1
+#define LZ4_OUTPUT_FULL			-2
+#define LZ4_BAD_DATA			-3
+#define LZ4_UNSUPPORTED			-4
+
+#endif
@@ -30,12 +30,21 @@
 #include "block.h"
 #include "vfs.h"
 #include "memchunk.h"
+#include "arena.h"
+#include "timer.h"
+#include "clock.h"
+#include "mbox.h"
+#include "memlog.h"
+#include "decompress.h"
+#include "manifest.h"
 
 #define UNUSED(x) (void)(x)
 
 uint32_t _atags;
 uint32_t _arm_m_type;
 
+static int atag_mem_found = 0;
+
 char rpi_boot_name[] = "rpi_boot";
 
 static char *boot_cfg_names[] =
@@ -70,6 +79,7 @@ void atag_cb(struct atag *tag)
 
 		case ATAG_MEM:
 			puts("ATAG_MEM");
+			atag_mem_found = 1;
 			
 			puts("start");
 			puthex(tag->u.mem.start);
@@ -103,24 +113,63 @@ void atag_cb(struct atag *tag)
 	puts("");
 }
 
+// Query the board revision and the ARM/VideoCore memory split in a single
+// mailbox round trip.  If the firmware did not pass an ATAG_MEM (e.g. it was
+// configured to pass a device tree instead) use the ARM memory range reported
+// here to set up the chunk allocator.
+static void board_query()
+{
+	mbox_prop_begin();
+	int rev_tag = mbox_prop_add0(MBOX_TAG_GET_BOARD_REV, 4);
+	int arm_mem_tag = mbox_prop_add0(MBOX_TAG_GET_ARM_MEMORY, 8);
+	int vc_mem_tag = mbox_prop_add0(MBOX_TAG_GET_VC_MEMORY, 8);
+
+	if(mbox_prop_send() != 0)
+	{
+		puts("Unable to query board information");
+		return;
+	}
+
+	uint32_t arm_start = mbox_prop_get(arm_mem_tag, 0);
+	uint32_t arm_size = mbox_prop_get(arm_mem_tag, 1);
+
+	printf("Board revision %x, ARM memory %x (%x bytes), VC memory %x (%x bytes)\n",
+			mbox_prop_get(rev_tag, 0), arm_start, arm_size,
+			mbox_prop_get(vc_mem_tag, 0), mbox_prop_get(vc_mem_tag, 1));
+
+	if(!atag_mem_found && arm_size)
+	{
+		uint32_t start = arm_start;
+		uint32_t size = arm_size;
+
+		if(start < 0x100000)
+			start = 0x100000;
+		size -= 0x100000;
+		chunk_register_free(start, size);
+	}
+}
+
 void console_test();
 int sd_card_init(struct block_device **dev);
 int read_mbr(struct block_device *, struct block_device ***, int *);
 int usb_init();
 
-extern int (*stdout_putc)(int);
-extern int (*stderr_putc)(int);
 extern int (*stream_putc)(int, FILE*);
-extern int console_putc(int);
 extern int def_stream_putc(int, FILE*);
 
 int cfg_parse(char *buf);
 
-int split_putc(int c)
+static struct output_sink uart_sink =
 {
-	uart_putc(c);
-	return console_putc(c);
-}
+	.name = "uart",
+	.write = uart_write
+};
+
+static struct output_sink memlog_sink =
+{
+	.name = "memlog",
+	.write = memlog_write
+};
 
 void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 {
@@ -128,11 +177,18 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 	_arm_m_type = arm_m_type;
 	UNUSED(boot_dev);
 
-	// First use the serial console
-	stdout_putc = uart_putc;
-	stderr_putc = uart_putc;
+	// First use the serial console, and keep a copy of everything in memory.
+	// The screen is set up when it is first needed (see console.c).
+	stdio_add_sink(&uart_sink);
+	stdio_add_sink(&memlog_sink);
+#ifndef HEADLESS
+	stdio_add_sink(&console_sink);
+#endif
 	stream_putc = def_stream_putc;	
 
+	timer_init();
+	uart_init();
+
 	/* puts("Hello World!");
 	puthex(0xdeadbeef);
 	puts("");
@@ -153,23 +209,24 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 
 	// Dump ATAGS
 	parse_atags(atags, atag_cb);
+	board_query();
 
-	int result = fb_init();
-	if(result == 0)
-		puts("Successfully set up frame buffer");
-	else
-	{
-		puts("Error setting up framebuffer:");
-		puthex(result);
-	}
-
-	// Switch to the framebuffer for output
-	//stdout_putc = console_putc;
-	stdout_putc = split_putc;
+	// Now we know the memory map, give the boot log a permanent home
+	memlog_init();
 
 	printf("Welcome to Rpi bootloader\n");
 	printf("ARM system type is %x\n", arm_m_type);
 
+#ifdef BENCHMARK
+	console_start();
+	if(!console_is_headless())
+		console_bench();
+	printf_bench();
+#endif
+
+	// Run the rest of the boot at full speed
+	clock_boost();
+
 	usb_init();
 	
 	struct block_device *sd_dev;
@@ -184,24 +241,36 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 		printf("%s ", *devs++);
 	printf("\n");
 
+#ifdef BENCHMARK
+	decompress_bench();
+#endif
+
+	// Use the boot manifest, if there is one, to find files without
+	// walking the filesystem
+	manifest_init();
+
 	// Look for a boot configuration file, starting with the default device,
 	// then iterating through all devices
 	
 	FILE *f = (void*)0;
 	
-	// Default device
+	// Default device.  A name listed in the manifest is tried first so the
+	// other names need not be probed.
 	char **fname = boot_cfg_names;
-	while(*fname)
-	{
-		f = fopen(*fname, "r");
-		if(f)
-			break;
+	while(*fname && !manifest_contains(*fname))
 		fname++;
-	}
+	if(*fname)
+		f = fopen(*fname, "r");
+
+	fname = boot_cfg_names;
+	while(*fname && !f)
+		f = fopen(*fname++, "r");
 
 	if(!f)
 	{
-		// Try other devices
+		// Try other devices.  The candidate path names only live
+		// for the duration of the search.
+		struct arena_mark mark = arena_mark(&transient_arena);
 		char **dev = vfs_get_device_list();
 		while(*dev)
 		{
@@ -211,7 +280,8 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 			while(*fname)
 			{
 				int fname_len = strlen(*fname);
-				char *new_str = (char *)malloc(dev_len + fname_len + 3);
+				char *new_str = (char *)arena_alloc(&transient_arena,
+						dev_len + fname_len + 3);
 				new_str[0] = 0;
 				strcat(new_str, "(");
 				strcat(new_str, *dev);
@@ -219,7 +289,6 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 				strcat(new_str, *fname);
 
 				f = fopen(new_str, "r");
-				free(new_str);
 
 				if(f)
 					break;
@@ -232,6 +301,8 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 
 			dev++;
 		}
+
+		arena_release(&transient_arena, mark);
 	}
 
 	if(!f)
@@ -247,5 +318,9 @@ void kernel_main(uint32_t boot_dev, uint32_t arm_m_type, uint32_t atags)
 		fclose(f);
 		cfg_parse(buf);
 	}
+
+	// If we get here nothing was booted: make sure the messages are visible
+	console_start();
+	console_flush();
 }
 
@@ -0,0 +1,444 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Boot manifest
+ *
+ * mkmanifest records, for each boot file, the runs of sectors holding it
+ * along with a copy of its directory entry.  If /boot/manifest.bin exists
+ * on the default device, files it lists are opened without walking any
+ * directories or cluster chains: fopen() checks that the directory entry
+ * on the card still matches the copy (same name, size, first cluster and
+ * modification time) and that the file's cluster chain still covers the
+ * recorded sectors, and then reads straight from them, a whole run at a
+ * time.  A file whose entry or chain has changed is stale and is opened
+ * through its filesystem as usual.  The FAT is cached, so following the
+ * chain costs far less than walking the directories.
+ *
+ * A file which passes these checks reads exactly as it would through its
+ * filesystem, so a file rewritten in place (e.g. 'cp -p' over the old one)
+ * is still loaded correctly.  Each file's CRC32 is handed to verify.c only
+ * to report that the manifest is out of date; it never stops the boot.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "manifest.h"
+#include "block.h"
+#include "crc32.h"
+#include "dirent.h"
+#include "trace.h"
+#include "util.h"
+#include "verify.h"
+#include "vfs.h"
+#include "fs.h"
+
+static size_t manifest_fread(struct fs *fs, void *ptr, size_t size, size_t nmemb, FILE *stream);
+static int manifest_fclose(struct fs *fs, FILE *fp);
+static int manifest_fmap(struct fs *fs, FILE *fp, long offset, size_t max_len,
+		uint32_t *block_no, size_t *len);
+
+static struct fs manifest_fs =
+{
+	.parent = (void *)0,
+	.fs_name = "manifest",
+	.fopen = (void *)0,
+	.fread = manifest_fread,
+	.fclose = manifest_fclose,
+	.fmap = manifest_fmap,
+	.read_directory = (void *)0
+};
+
+static struct manifest_entry *entries = (void *)0;
+static uint32_t entry_count = 0;
+static struct fs *file_fs = (void *)0;		// the filesystem holding the files
+
+// Read and check the manifest on the default device
+int manifest_init()
+{
+	FILE *fp = fopen(MANIFEST_NAME, "r");
+	if(!fp)
+		return -1;
+
+	struct block_device *dev = fp->fs->parent;
+	struct fs *fp_fs = fp->fs;
+	long len = fp->len;
+	if((len < MANIFEST_HEADER_SIZE) || (len > MANIFEST_MAX_SIZE))
+	{
+		printf("MANIFEST: %s has an invalid size (%i)\n", MANIFEST_NAME, (int)len);
+		fclose(fp);
+		return -1;
+	}
+
+	uint8_t *buf = (uint8_t *)malloc((size_t)len);
+	size_t bytes_read = fread(buf, 1, (size_t)len, fp);
+	fclose(fp);
+
+	int ret = -1;
+	uint32_t count = read_word(buf, 4 * 2);
+	uint32_t extent_count = read_word(buf, 4 * 3);
+	uint32_t part_start = read_word(buf, 4 * 4);
+	if(bytes_read != (size_t)len)
+		printf("MANIFEST: error reading %s\n", MANIFEST_NAME);
+	else if((read_word(buf, 0) != MANIFEST_MAGIC) ||
+			(read_word(buf, 4) != MANIFEST_VERSION))
+		printf("MANIFEST: %s is not a version %i manifest\n", MANIFEST_NAME,
+				MANIFEST_VERSION);
+	else if(read_word(buf, 4 * 5) != dev->block_size)
+		printf("MANIFEST: sector size %i does not match %s\n",
+				read_word(buf, 4 * 5), dev->device_name);
+	else if((count > (MANIFEST_MAX_SIZE / MANIFEST_ENTRY_SIZE)) ||
+			(extent_count > (MANIFEST_MAX_SIZE / MANIFEST_EXTENT_SIZE)) ||
+			((uint32_t)len != MANIFEST_HEADER_SIZE +
+			count * MANIFEST_ENTRY_SIZE + extent_count * MANIFEST_EXTENT_SIZE))
+		printf("MANIFEST: %s is truncated\n", MANIFEST_NAME);
+	else if(crc32(0, &buf[MANIFEST_HEADER_SIZE], (size_t)len - MANIFEST_HEADER_SIZE) !=
+			read_word(buf, 4 * 6))
+		printf("MANIFEST: %s is corrupt (checksum mismatch)\n", MANIFEST_NAME);
+	else
+		ret = 0;
+
+	if(ret != 0)
+	{
+		free(buf);
+		return ret;
+	}
+
+	// Convert the extents to blocks within the partition
+	int e_base = MANIFEST_HEADER_SIZE + (int)count * MANIFEST_ENTRY_SIZE;
+	struct manifest_extent *extents = (struct manifest_extent *)malloc(
+			(extent_count ? extent_count : 1) * sizeof(struct manifest_extent));
+	for(uint32_t i = 0; i < extent_count; i++)
+	{
+		uint32_t sector = read_word(buf, e_base + (int)i * MANIFEST_EXTENT_SIZE);
+		if(sector < part_start)
+			ret = -1;
+		extents[i].block = sector - part_start;
+		extents[i].count = read_word(buf, e_base + (int)i * MANIFEST_EXTENT_SIZE + 4);
+	}
+
+	struct manifest_entry *new_entries = (struct manifest_entry *)malloc(
+			(count ? count : 1) * sizeof(struct manifest_entry));
+	for(uint32_t i = 0; i < count; i++)
+	{
+		int p = MANIFEST_HEADER_SIZE + (int)i * MANIFEST_ENTRY_SIZE;
+		struct manifest_entry *e = &new_entries[i];
+		memcpy(e->path, &buf[p], MANIFEST_PATH_LEN);
+		e->path[MANIFEST_PATH_LEN - 1] = 0;
+		e->size = read_word(buf, p + 64);
+		e->crc = read_word(buf, p + 68);
+		e->stamp_block = read_word(buf, p + 72) - part_start;
+		e->stamp_offset = read_word(buf, p + 76);
+		memcpy(e->stamp, &buf[p + 80], MANIFEST_STAMP_LEN);
+		uint32_t first = read_word(buf, p + 112);
+		e->extent_count = read_word(buf, p + 116);
+		e->extents = &extents[first];
+		e->state = MANIFEST_UNCHECKED;
+
+		if((read_word(buf, p + 72) < part_start) ||
+				(e->stamp_offset + MANIFEST_STAMP_LEN > dev->block_size) ||
+				(first > extent_count) || (e->extent_count > extent_count - first))
+			ret = -1;
+	}
+	free(buf);
+
+	if(ret != 0)
+	{
+		printf("MANIFEST: %s has out of range entries\n", MANIFEST_NAME);
+		free(extents);
+		free(new_entries);
+		return ret;
+	}
+
+	manifest_fs.parent = dev;
+	file_fs = fp_fs;
+	entries = new_entries;
+	entry_count = count;
+	printf("MANIFEST: %i file(s) listed on %s\n", count, dev->device_name);
+	return 0;
+}
+
+// Find the entry for a path on the manifest's device, either "(dev)/path"
+// or "/path" on the default device
+static struct manifest_entry *find_entry(const char *path)
+{
+	if(!entries)
+		return (void *)0;
+
+	const char *dev_name = manifest_fs.parent->device_name;
+	if(path[0] == '(')
+	{
+		size_t i = 0;
+		while(dev_name[i] && (path[i + 1] == dev_name[i]))
+			i++;
+		if(dev_name[i] || (path[i + 1] != ')'))
+			return (void *)0;
+		path = &path[i + 2];
+	}
+	else
+	{
+		char *def = vfs_get_default();
+		if(!def || strcmp(def, dev_name))
+			return (void *)0;
+	}
+
+	for(uint32_t i = 0; i < entry_count; i++)
+	{
+		if(!strcmp(entries[i].path, path))
+			return &entries[i];
+	}
+	return (void *)0;
+}
+
+// Returns 1 if path is listed in the manifest
+int manifest_contains(const char *path)
+{
+	return find_entry(path) ? 1 : 0;
+}
+
+// Whether byte i of a FAT directory entry is compared by check_stamp(): the
+// name and attributes (0-11), the high cluster word (20-21), the write time
+// and date (22-25), the low cluster word (26-27) and the size (28-31).  The
+// creation time and last access date (13-19) change when a host merely
+// reads the card.
+static int stamp_byte_checked(size_t i)
+{
+	return (i < 12) || (i >= 20);
+}
+
+// Find the block holding a file offset, and the number of bytes from the
+// start of that block to the end of its extent
+static int map_offset(struct manifest_entry *e, size_t block_size, size_t offset,
+		uint32_t *block_no, size_t *run)
+{
+	size_t ext_start = 0;
+	for(uint32_t i = 0; i < e->extent_count; i++)
+	{
+		size_t ext_len = (size_t)e->extents[i].count * block_size;
+		if(offset < ext_start + ext_len)
+		{
+			size_t in_ext = offset - ext_start;
+			in_ext -= in_ext % block_size;
+			*block_no = e->extents[i].block + (uint32_t)(in_ext / block_size);
+			*run = ext_len - in_ext;
+			return 0;
+		}
+		ext_start += ext_len;
+	}
+	return -1;
+}
+
+// Check that the cluster chain starting at the first cluster in the directory
+// entry still maps the file to the recorded extents.  Returns 0 if it does.
+static int check_extents(struct manifest_entry *e)
+{
+	if(!e->size)
+		return 0;
+	if(!file_fs || !file_fs->fopen || !file_fs->fmap)
+		return -1;
+
+	// Open the file by its first cluster, with no directory walk
+	struct dirent d;
+	memset(&d, 0, sizeof(struct dirent));
+	d.name = e->path;
+	d.byte_size = e->size;
+	d.opaque = (void *)(read_halfword(e->stamp, 26) |
+			((uint32_t)read_halfword(e->stamp, 20) << 16));
+	d.fs = file_fs;
+	FILE *fp = file_fs->fopen(file_fs, &d, "r");
+	if(!fp)
+		return -1;
+
+	size_t block_size = manifest_fs.parent->block_size;
+	size_t mapped_len = e->size + (block_size - 1);
+	mapped_len -= mapped_len % block_size;
+	size_t offset = 0;
+	int ret = 0;
+	while((offset < mapped_len) && (ret == 0))
+	{
+		uint32_t block_no;
+		size_t len;
+		if(file_fs->fmap(file_fs, fp, (long)offset, mapped_len - offset,
+					&block_no, &len) != 0)
+		{
+			ret = -1;
+			break;
+		}
+		len -= len % block_size;
+		if(!len)
+			ret = -1;
+
+		// The chain's runs need not split where the manifest's extents do
+		while(len && (ret == 0))
+		{
+			uint32_t e_block;
+			size_t run;
+			if((map_offset(e, block_size, offset, &e_block, &run) != 0) ||
+					(e_block != block_no))
+			{
+				ret = -1;
+				break;
+			}
+			if(run > len)
+				run = len;
+			offset += run;
+			len -= run;
+			block_no += (uint32_t)(run / block_size);
+		}
+	}
+	fclose(fp);
+	return ret;
+}
+
+// Check the file's directory entry and cluster chain are as they were when
+// the manifest was made
+static int check_stamp(struct manifest_entry *e)
+{
+	if(e->state != MANIFEST_UNCHECKED)
+		return (e->state == MANIFEST_CURRENT) ? 0 : -1;
+
+	struct block_device *dev = manifest_fs.parent;
+	uint8_t *buf = (uint8_t *)malloc(dev->block_size);
+	int ret = block_read(dev, buf, dev->block_size, e->stamp_block);
+	e->state = MANIFEST_CURRENT;
+	for(size_t i = 0; i < MANIFEST_STAMP_LEN; i++)
+	{
+		if(!stamp_byte_checked(i))
+			continue;
+		if((ret < 0) || (buf[e->stamp_offset + i] != e->stamp[i]))
+		{
+			e->state = MANIFEST_STALE;
+			break;
+		}
+	}
+	free(buf);
+
+	if((e->state == MANIFEST_CURRENT) && (check_extents(e) != 0))
+		e->state = MANIFEST_STALE;
+
+	if(e->state == MANIFEST_STALE)
+	{
+		printf("MANIFEST: %s has changed since the manifest was made, "
+				"reading it from the filesystem\n", e->path);
+		return -1;
+	}
+	return 0;
+}
+
+// Open a file listed in the manifest.  Returns NULL if it is not listed or
+// is stale, in which case the caller should use the filesystem.
+FILE *manifest_fopen(const char *path, const char *mode)
+{
+	if(strcmp(mode, "r") && strcmp(mode, "rb"))
+		return (FILE *)0;
+	struct manifest_entry *e = find_entry(path);
+	if(!e || (check_stamp(e) != 0))
+		return (FILE *)0;
+
+	struct vfs_file *ret = (struct vfs_file *)malloc(sizeof(struct vfs_file));
+	memset(ret, 0, sizeof(struct vfs_file));
+	ret->fs = &manifest_fs;
+	ret->pos = 0;
+	ret->len = (long)e->size;
+	ret->opaque = e;
+
+	verify_add_crc32(path, e->crc);
+	TRACE(BLOCK, TRACE_DEBUG, "MANIFEST: %s: %i bytes in %i extent(s)\n",
+			path, e->size, e->extent_count);
+	return ret;
+}
+
+static size_t manifest_fread(struct fs *fs, void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+	struct manifest_entry *e = (struct manifest_entry *)stream->opaque;
+	struct block_device *dev = fs->parent;
+	size_t block_size = dev->block_size;
+	size_t len = size * nmemb;
+	uint8_t *dst = (uint8_t *)ptr;
+	uint8_t *bounce = (void *)0;
+	size_t done = 0;
+
+	while(done < len)
+	{
+		size_t offset = (size_t)stream->pos + done;
+		uint32_t block_no;
+		size_t run;
+		if(map_offset(e, block_size, offset, &block_no, &run) != 0)
+			break;
+
+		size_t in_block = offset % block_size;
+		size_t whole = (len - done) - (len - done) % block_size;
+		if(!in_block && whole)
+		{
+			// Read whole blocks straight into the destination, as one
+			// multi-block transfer where the device allows it
+			size_t n = (run < whole) ? run : whole;
+			if(n > BLOCK_ASYNC_MAX)
+				n = BLOCK_ASYNC_MAX;
+			int ret = block_read_start(dev, &dst[done], n, block_no);
+			if(ret >= 0)
+				ret = block_read_wait(dev);
+			if(ret < 0)
+				break;
+			done += n;
+		}
+		else
+		{
+			if(!bounce)
+				bounce = (uint8_t *)malloc(block_size);
+			if(block_read(dev, bounce, block_size, block_no) < 0)
+				break;
+			size_t n = block_size - in_block;
+			if(n > len - done)
+				n = len - done;
+			memcpy(&dst[done], &bounce[in_block], n);
+			done += n;
+		}
+	}
+
+	if(bounce)
+		free(bounce);
+	return done;
+}
+
+static int manifest_fclose(struct fs *fs, FILE *fp)
+{
+	(void)fs;
+	fp->opaque = (void *)0;
+	return 0;
+}
+
+static int manifest_fmap(struct fs *fs, FILE *fp, long offset, size_t max_len,
+		uint32_t *block_no, size_t *len)
+{
+	if(fp->fs != fs)
+		return -1;
+	struct manifest_entry *e = (struct manifest_entry *)fp->opaque;
+	size_t run;
+	if((size_t)offset % fs->parent->block_size)
+		return -1;
+	if(map_offset(e, fs->parent->block_size, (size_t)offset, block_no, &run) != 0)
+		return -1;
+	*len = (run > max_len) ? max_len : run;
+	return 0;
+}
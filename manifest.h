@@ -0,0 +1,82 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Boot manifest file format, as written by mkmanifest.  All fields are
+ * little endian 32-bit words; sectors are absolute (from the start of the
+ * card, not the partition).
+ *
+ * header:	magic, version, entry count, extent count, partition start
+ *		sector, sector size, crc32 of everything after the header,
+ *		reserved
+ * entry:	path (64 bytes, nul terminated), size, crc32 of the contents,
+ *		sector and byte offset of the file's directory entry, a copy of
+ *		the directory entry (32 bytes), first extent, extent count,
+ *		reserved (8 bytes)
+ * extent:	first sector, sector count
+ */
+
+#define MANIFEST_NAME		"/boot/manifest.bin"
+#define MANIFEST_MAGIC		0x464d4252	// "RBMF"
+#define MANIFEST_VERSION	1
+#define MANIFEST_MAX_SIZE	0x10000
+
+#define MANIFEST_HEADER_SIZE	32
+#define MANIFEST_ENTRY_SIZE	128
+#define MANIFEST_EXTENT_SIZE	8
+#define MANIFEST_PATH_LEN	64
+#define MANIFEST_STAMP_LEN	32
+
+#define MANIFEST_UNCHECKED	0
+#define MANIFEST_CURRENT	1
+#define MANIFEST_STALE		2
+
+// A run of consecutive blocks, numbered from the start of the partition
+struct manifest_extent
+{
+	uint32_t block;
+	uint32_t count;
+};
+
+struct manifest_entry
+{
+	char path[MANIFEST_PATH_LEN];
+	uint32_t size;
+	uint32_t crc;
+	uint32_t stamp_block;
+	uint32_t stamp_offset;
+	uint8_t stamp[MANIFEST_STAMP_LEN];
+	struct manifest_extent *extents;
+	uint32_t extent_count;
+	int state;
+};
+
+int manifest_init();
+int manifest_contains(const char *path);
+FILE *manifest_fopen(const char *path, const char *mode);
+
+#endif
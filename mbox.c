@@ -22,26 +22,197 @@
 #include <stdint.h>
 #include "mbox.h"
 #include "mmio.h"
+#include "timer.h"
 
 #define MBOX_FULL		0x80000000
 #define	MBOX_EMPTY		0x40000000
 
+// The message buffer is aligned to, and a multiple of, the ARM1176 cache line
+// size so that cache maintenance on it cannot affect neighbouring data
+#define CACHE_LINE_SIZE		32
+#define MBOX_BUF_WORDS		256
+
+static volatile uint32_t mbox_buf[MBOX_BUF_WORDS] __attribute__((aligned(CACHE_LINE_SIZE)));
+static int mbox_buf_idx;
+static int mbox_buf_overflow;
+
 uint32_t mbox_read(uint8_t channel)
 {
+	mmio_barrier();
 	while(1)
 	{
-		while(mmio_read(MBOX_BASE + MBOX_STATUS) & MBOX_EMPTY);
+		while(mmio_read_relaxed(MBOX_BASE + MBOX_STATUS) & MBOX_EMPTY);
 
-		uint32_t data = mmio_read(MBOX_BASE + MBOX_READ);
+		uint32_t data = mmio_read_relaxed(MBOX_BASE + MBOX_READ);
 		uint8_t read_channel = (uint8_t)(data & 0xf);
 		if(read_channel == channel)
+		{
+			mmio_barrier();
 			return (data & 0xfffffff0);
+		}
 	}
 }
 
 void mbox_write(uint8_t channel, uint32_t data)
 {
-	while(mmio_read(MBOX_BASE + MBOX_STATUS) & MBOX_FULL);
-	mmio_write(MBOX_BASE + MBOX_WRITE, (data & 0xfffffff0) | (uint32_t)(channel & 0xf));
+	mmio_barrier();
+	while(mmio_read_relaxed(MBOX_BASE + MBOX_STATUS) & MBOX_FULL);
+	mmio_write_relaxed(MBOX_BASE + MBOX_WRITE, (data & 0xfffffff0) | (uint32_t)(channel & 0xf));
+	mmio_barrier();
+}
+
+int mbox_read_timeout(uint8_t channel, uint32_t *data, int usec)
+{
+	struct timer_wait tw;
+	register_timer(&tw, usec);
+
+	mmio_barrier();
+	while(1)
+	{
+		while(mmio_read_relaxed(MBOX_BASE + MBOX_STATUS) & MBOX_EMPTY)
+		{
+			if(compare_timer(&tw))
+			{
+				mmio_barrier();
+				return MBOX_ERR_TIMEOUT;
+			}
+		}
+
+		uint32_t val = mmio_read_relaxed(MBOX_BASE + MBOX_READ);
+		uint8_t read_channel = (uint8_t)(val & 0xf);
+		if(read_channel == channel)
+		{
+			mmio_barrier();
+			*data = val & 0xfffffff0;
+			return 0;
+		}
+	}
+}
+
+int mbox_write_timeout(uint8_t channel, uint32_t data, int usec)
+{
+	struct timer_wait tw;
+	register_timer(&tw, usec);
+
+	mmio_barrier();
+	while(mmio_read_relaxed(MBOX_BASE + MBOX_STATUS) & MBOX_FULL)
+	{
+		if(compare_timer(&tw))
+		{
+			mmio_barrier();
+			return MBOX_ERR_TIMEOUT;
+		}
+	}
+	mmio_write_relaxed(MBOX_BASE + MBOX_WRITE, (data & 0xfffffff0) | (uint32_t)(channel & 0xf));
+	mmio_barrier();
+	return 0;
+}
+
+// Clean and invalidate the data cache lines covering the message buffer so
+// that the VideoCore sees our request and we see its response
+static void mbox_buf_flush()
+{
+	uint32_t addr = (uint32_t)mbox_buf;
+	uint32_t end = addr + sizeof(mbox_buf);
+	for(; addr < end; addr += CACHE_LINE_SIZE)
+		asm volatile("mcr p15, #0, %[addr], c7, c14, #1" : : [addr]"r"(addr) : "memory");
+
+	// Drain the write buffer
+	asm volatile("mcr p15, #0, %[zero], c7, c10, #4" : : [zero]"r"(0) : "memory");
+}
+
+void mbox_prop_begin()
+{
+	mbox_buf_idx = 2;
+	mbox_buf_overflow = 0;
+}
+
+int mbox_prop_add(uint32_t tag, uint32_t resp_size, int req_words, const uint32_t *req)
+{
+	uint32_t req_size = (uint32_t)req_words * 4;
+	uint32_t val_size = (resp_size > req_size) ? resp_size : req_size;
+	val_size = (val_size + 3) & ~3;
+
+	// Leave space for the tag header and the end tag
+	if((mbox_buf_idx + 3 + (int)(val_size / 4) + 1) > MBOX_BUF_WORDS)
+	{
+		mbox_buf_overflow = 1;
+		return MBOX_ERR_FULL;
+	}
+
+	int handle = mbox_buf_idx;
+	mbox_buf[handle] = tag;
+	mbox_buf[handle + 1] = val_size;
+	mbox_buf[handle + 2] = req_size;
+
+	for(int i = 0; i < (int)(val_size / 4); i++)
+		mbox_buf[handle + 3 + i] = (i < req_words) ? req[i] : 0;
+
+	mbox_buf_idx += 3 + (int)(val_size / 4);
+	return handle;
+}
+
+int mbox_prop_add0(uint32_t tag, uint32_t resp_size)
+{
+	return mbox_prop_add(tag, resp_size, 0, (void*)0);
+}
+
+int mbox_prop_add1(uint32_t tag, uint32_t resp_size, uint32_t v0)
+{
+	return mbox_prop_add(tag, resp_size, 1, &v0);
+}
+
+int mbox_prop_add2(uint32_t tag, uint32_t resp_size, uint32_t v0, uint32_t v1)
+{
+	uint32_t req[2] = { v0, v1 };
+	return mbox_prop_add(tag, resp_size, 2, req);
+}
+
+int mbox_prop_add3(uint32_t tag, uint32_t resp_size, uint32_t v0, uint32_t v1,
+		uint32_t v2)
+{
+	uint32_t req[3] = { v0, v1, v2 };
+	return mbox_prop_add(tag, resp_size, 3, req);
+}
+
+// Send the message built since mbox_prop_begin() and wait for the response
+int mbox_prop_send()
+{
+	if(mbox_buf_overflow)
+		return MBOX_ERR_FULL;
+
+	mbox_buf[mbox_buf_idx] = 0;		// end tag
+	mbox_buf[0] = (uint32_t)(mbox_buf_idx + 1) * 4;
+	mbox_buf[1] = 0;			// this is a request
+
+	mbox_buf_flush();
+
+	if(mbox_write_timeout(MBOX_PROP, MBOX_BUS_ADDR(mbox_buf), MBOX_TIMEOUT) != 0)
+		return MBOX_ERR_TIMEOUT;
+
+	uint32_t resp;
+	if(mbox_read_timeout(MBOX_PROP, &resp, MBOX_TIMEOUT) != 0)
+		return MBOX_ERR_TIMEOUT;
+
+	mbox_buf_flush();
+
+	if(mbox_buf[1] != MBOX_SUCCESS)
+		return MBOX_ERR_RESPONSE;
+	return 0;
+}
+
+// Returns non-zero if the firmware filled in a response for this tag
+int mbox_prop_ok(int handle)
+{
+	if(handle < 0)
+		return 0;
+	return (mbox_buf[handle + 2] & MBOX_SUCCESS) ? 1 : 0;
+}
+
+uint32_t mbox_prop_get(int handle, int word)
+{
+	if(!mbox_prop_ok(handle))
+		return 0;
+	return mbox_buf[handle + 3 + word];
 }
 
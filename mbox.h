@@ -38,8 +38,50 @@
 
 #define MBOX_SUCCESS	0x80000000
 
+// Converts an ARM physical address to a VideoCore bus address in the L2
+// cache coherent alias
+#define MBOX_BUS_ADDR(x)	((uint32_t)(x) | 0x40000000)
+
+// Property tags not owned by a particular driver
+#define MBOX_TAG_GET_FIRMWARE_REV	0x1
+#define MBOX_TAG_GET_BOARD_MODEL	0x10001
+#define MBOX_TAG_GET_BOARD_REV		0x10002
+#define MBOX_TAG_GET_ARM_MEMORY		0x10005
+#define MBOX_TAG_GET_VC_MEMORY		0x10006
+
+#define MBOX_ERR_TIMEOUT		-1
+#define MBOX_ERR_RESPONSE		-2
+#define MBOX_ERR_FULL			-3
+
+// Maximum time to wait for the VideoCore to respond to a message (us)
+#define MBOX_TIMEOUT			500000
+
 uint32_t mbox_read(uint8_t channel);
 void mbox_write(uint8_t channel, uint32_t data);
+int mbox_read_timeout(uint8_t channel, uint32_t *data, int usec);
+int mbox_write_timeout(uint8_t channel, uint32_t data, int usec);
+
+/* Property channel message builder
+ *
+ * Tags are appended to a single shared message buffer between
+ * mbox_prop_begin() and mbox_prop_send(), so several requests can be batched
+ * into one round trip.  The firmware processes the tags in order.  Each
+ * mbox_prop_add*() call returns a handle which is used to fetch that tag's
+ * response once the message has been sent.
+ *
+ * resp_size is the size in bytes of the expected response; the value buffer
+ * is made large enough for both the request and the response.
+ */
+void mbox_prop_begin();
+int mbox_prop_add(uint32_t tag, uint32_t resp_size, int req_words, const uint32_t *req);
+int mbox_prop_add0(uint32_t tag, uint32_t resp_size);
+int mbox_prop_add1(uint32_t tag, uint32_t resp_size, uint32_t v0);
+int mbox_prop_add2(uint32_t tag, uint32_t resp_size, uint32_t v0, uint32_t v1);
+int mbox_prop_add3(uint32_t tag, uint32_t resp_size, uint32_t v0, uint32_t v1,
+		uint32_t v2);
+int mbox_prop_send();
+int mbox_prop_ok(int handle);
+uint32_t mbox_prop_get(int handle, int word);
 
 #endif
 
@@ -26,10 +26,7 @@
 #include "block.h"
 #include "vfs.h"
 #include "util.h"
-
-#ifdef DEBUG2
-#define MBR_DEBUG
-#endif
+#include "trace.h"
 
 int fat_init(struct block_device *, struct fs **);
 int ext2_init(struct block_device *, struct fs **);
@@ -48,6 +45,9 @@ struct mbr_block_dev {
 static char driver_name[] = "mbr";
 
 static int mbr_read(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+static int mbr_read_start(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+static int mbr_read_wait(struct block_device *);
+static int mbr_read_busy(struct block_device *);
 
 int read_mbr(struct block_device *parent, struct block_device ***partitions, int *part_count)
 {
@@ -63,9 +63,8 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 
 	/* Read the first 512 bytes */
 	uint8_t *block_0 = (uint8_t *)malloc(512);
-#ifdef MBR_DEBUG
-	printf("MBR: reading block 0 from device %s\n", parent->device_name);
-#endif
+	TRACE(MBR, TRACE_DEBUG, "MBR: reading block 0 from device %s\n",
+			parent->device_name);
 	
 	int ret = block_read(parent, block_0, 512, 0);
 	if(ret < 0)
@@ -89,17 +88,18 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 	}
 	printf("MBR: found valid MBR on device %s\n", parent->device_name);
 
-#ifdef MBR_DEBUG
 	/* Dump the first sector */
-	printf("MBR: first sector:");
-	for(int dump_idx = 0; dump_idx < 512; dump_idx++)
+	if(TRACE_ON(MBR, TRACE_DEBUG))
 	{
-		if((dump_idx & 0xf) == 0)
-			printf("\n%03x: ", dump_idx);
-		printf("%02x ", block_0[dump_idx]);
+		printf("MBR: first sector:");
+		for(int dump_idx = 0; dump_idx < 512; dump_idx++)
+		{
+			if((dump_idx & 0xf) == 0)
+				printf("\n%03x: ", dump_idx);
+			printf("%02x ", block_0[dump_idx]);
+		}
+		printf("\n");
 	}
-	printf("\n");
-#endif
 
 	/* Load the partitions */
 	struct block_device **parts =
@@ -125,6 +125,9 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 			d->bd.device_id[0] = i;
 			d->bd.dev_id_len = 1;
 			d->bd.read = mbr_read;
+			d->bd.read_start = mbr_read_start;
+			d->bd.read_wait = mbr_read_wait;
+			d->bd.read_busy = mbr_read_busy;
 			d->bd.block_size = 512;
 			d->part_no = i;
 			d->part_id = block_0[p_offset + 4];
@@ -133,12 +136,10 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 			d->parent = parent;
 			
 			parts[cur_p++] = (struct block_device *)d;
-#ifdef MBR_DEBUG
-			printf("MBR: partition number %i (%s) of type %x, start sector %u, "
-					"sector count %u, p_offset %03x\n", 
+			TRACE(MBR, TRACE_DEBUG, "MBR: partition number %i (%s) of type %x, "
+					"start sector %u, sector count %u, p_offset %03x\n",
 					d->part_no, d->bd.device_name, d->part_id,
 					d->start_block, d->blocks, p_offset);
-#endif
 
 			switch(d->part_id)
 			{
@@ -189,3 +190,26 @@ int mbr_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t s
 			starting_block + ((struct mbr_block_dev *)dev)->start_block);
 }
 
+int mbr_read_start(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
+{
+	struct block_device *parent = ((struct mbr_block_dev *)dev)->parent;
+	if(dev->block_size != parent->block_size)
+	{
+		int ret = mbr_read(dev, buf, buf_size, starting_block);
+		return (ret < 0) ? ret : 0;
+	}
+
+	return block_read_start(parent, buf, buf_size,
+			starting_block + ((struct mbr_block_dev *)dev)->start_block);
+}
+
+int mbr_read_wait(struct block_device *dev)
+{
+	return block_read_wait(((struct mbr_block_dev *)dev)->parent);
+}
+
+int mbr_read_busy(struct block_device *dev)
+{
+	return block_read_busy(((struct mbr_block_dev *)dev)->parent);
+}
+
@@ -34,6 +34,10 @@ struct chunk *used = (void *)0;
 
 uint32_t max_free = 0;
 
+// Short lived buffers come from the opposite end of memory to the modules,
+// which by default are placed at the top
+static int scratch_top = 0;
+
 // Add a chunk to a list
 static void chunk_add(uint32_t start, uint32_t length, struct chunk **list)
 {
@@ -114,6 +118,92 @@ uint32_t chunk_get_any_chunk(uint32_t length)
 	return 0;
 }
 
+// As chunk_get_any_chunk() but searching down from the top of memory, for
+// allocations which should stay out of the way of kernels and modules
+uint32_t chunk_get_top_chunk(uint32_t length)
+{
+	if(length > max_free)
+		return 0;
+
+	uint32_t test_address = (max_free - length) & ~0xfff;
+	while(1)
+	{
+		if(chunk_can_allocate(test_address, length))
+		{
+			chunk_add(test_address, length, &used);
+			return test_address;
+		}
+		if(test_address == 0)
+			break;
+		test_address -= 0x1000;
+	}
+
+	return 0;
+}
+
+// Find the highest chunk aligned to align (a power of two) which ends at or
+// below end.  The first place tried is directly below end, so a run of
+// allocations each ending where the last one started is packed together.
+uint32_t chunk_get_chunk_below(uint32_t end, uint32_t length, uint32_t align)
+{
+	if(end > max_free)
+		end = max_free;
+	if(length > end)
+		return 0;
+
+	uint32_t step = (align > 0x1000) ? align : 0x1000;
+	uint32_t test_address = (end - length) & ~(align - 1);
+	while(1)
+	{
+		if(chunk_can_allocate(test_address, length))
+		{
+			chunk_add(test_address, length, &used);
+			return test_address;
+		}
+		if(test_address < step)
+			break;
+		test_address = (test_address - step) & ~(step - 1);
+	}
+
+	return 0;
+}
+
+// As chunk_get_chunk_below() but finding the lowest chunk starting at or
+// above start
+uint32_t chunk_get_chunk_above(uint32_t start, uint32_t length, uint32_t align)
+{
+	uint32_t step = (align > 0x1000) ? align : 0x1000;
+	uint32_t test_address = (start + align - 1) & ~(align - 1);
+	while((test_address >= start) && (test_address < max_free) &&
+			(length <= max_free - test_address))
+	{
+		if(chunk_can_allocate(test_address, length))
+		{
+			chunk_add(test_address, length, &used);
+			return test_address;
+		}
+		test_address = (test_address + step) & ~(step - 1);
+	}
+
+	return 0;
+}
+
+// Choose which end of memory chunk_get_scratch_chunk() uses
+void chunk_set_scratch_top(int top)
+{
+	scratch_top = top;
+}
+
+// A buffer which is freed before the caller returns, taken from the end of
+// memory away from where the modules are being packed so that it never
+// occupies the place the next one will go
+uint32_t chunk_get_scratch_chunk(uint32_t length)
+{
+	if(scratch_top)
+		return chunk_get_top_chunk(length);
+	return chunk_get_any_chunk(length);
+}
+
 uint32_t chunk_get_chunk(uint32_t start, uint32_t length)
 {
 	if(chunk_can_allocate(start, length))
@@ -124,4 +214,22 @@ uint32_t chunk_get_chunk(uint32_t start, uint32_t length)
 	return 0;
 }
 
+// Return a chunk obtained from one of the above.  Returns 0 on success, -1 if
+// no chunk starts at that address.
+int chunk_free(uint32_t start)
+{
+	struct chunk **prev = &used;
+	while(*prev)
+	{
+		struct chunk *c = *prev;
+		if(c->start == start)
+		{
+			*prev = c->next;
+			free(c);
+			return 0;
+		}
+		prev = &c->next;
+	}
+	return -1;
+}
 
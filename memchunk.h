@@ -28,7 +28,13 @@
 
 void chunk_register_free(uint32_t start, uint32_t length);
 uint32_t chunk_get_any_chunk(uint32_t length);
+uint32_t chunk_get_top_chunk(uint32_t length);
 uint32_t chunk_get_chunk(uint32_t start, uint32_t length);
+uint32_t chunk_get_chunk_below(uint32_t end, uint32_t length, uint32_t align);
+uint32_t chunk_get_chunk_above(uint32_t start, uint32_t length, uint32_t align);
+void chunk_set_scratch_top(int top);
+uint32_t chunk_get_scratch_chunk(uint32_t length);
+int chunk_free(uint32_t start);
 
 #endif
 
@@ -0,0 +1,158 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* In-memory copy of everything written to stdout/stderr during the boot.
+ *
+ * Output is kept in a ring buffer, so the most recent MEMLOG_SIZE bytes are
+ * always available.  Until memlog_init() is called (once the memory map is
+ * known) a small static buffer is used; after that the log lives in a chunk
+ * at the top of memory so that it survives handing over to the kernel.
+ *
+ * memlog_finish() rotates the ring so the log starts at the beginning of the
+ * buffer and returns it.  It is passed to multiboot kernels as a module and
+ * is available to all kernels through multiboot_arm_functions.  After that
+ * further output is appended until the buffer is full but never overwrites
+ * the start of the log.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "memlog.h"
+#include "memchunk.h"
+
+#define MEMLOG_EARLY_SIZE	0x1000
+#define MEMLOG_SIZE		0x10000
+
+static char memlog_early[MEMLOG_EARLY_SIZE];
+static char *log_buf = memlog_early;
+static size_t log_size = MEMLOG_EARLY_SIZE;
+static size_t log_head = 0;		// next byte to write
+static size_t log_len = 0;		// bytes of valid data
+static int log_linear = 0;
+
+static void reverse(char *buf, size_t len)
+{
+	if(len < 2)
+		return;
+	for(size_t i = 0, j = len - 1; i < j; i++, j--)
+	{
+		char tmp = buf[i];
+		buf[i] = buf[j];
+		buf[j] = tmp;
+	}
+}
+
+// Rotate the ring in place so that the oldest byte is first
+static void memlog_linearise()
+{
+	if(log_len == log_size)
+	{
+		reverse(log_buf, log_head);
+		reverse(&log_buf[log_head], log_size - log_head);
+		reverse(log_buf, log_size);
+	}
+	log_head = log_len;
+}
+
+int memlog_write(const char *buf, size_t len)
+{
+	size_t ret = len;
+
+	if(log_linear)
+	{
+		size_t space = log_size - log_len;
+		if(len > space)
+			len = space;
+		memcpy(&log_buf[log_head], buf, len);
+		log_head += len;
+		log_len += len;
+		return (int)len;
+	}
+
+	// Only the last log_size bytes can be kept
+	if(len > log_size)
+	{
+		buf += len - log_size;
+		len = log_size;
+	}
+
+	size_t first = log_size - log_head;
+	if(first > len)
+		first = len;
+	memcpy(&log_buf[log_head], buf, first);
+	memcpy(log_buf, &buf[first], len - first);
+
+	log_head = (log_head + len) % log_size;
+	log_len += len;
+	if(log_len > log_size)
+		log_len = log_size;
+
+	return (int)ret;
+}
+
+// Move the log to its permanent home.  Returns 0 on success.
+int memlog_init()
+{
+	if(log_buf != memlog_early)
+		return 0;
+
+	char *new_buf = (char *)chunk_get_top_chunk(MEMLOG_SIZE);
+	if(!new_buf)
+		return -1;
+
+	memlog_linearise();
+	memcpy(new_buf, memlog_early, log_len);
+
+	log_buf = new_buf;
+	log_size = MEMLOG_SIZE;
+	log_head = log_len;
+	return 0;
+}
+
+// Pass (up to) the last max_len bytes of the log to a sink
+void memlog_replay(size_t max_len, int (*write)(const char *buf, size_t len))
+{
+	size_t len = (log_len < max_len) ? log_len : max_len;
+	size_t start = (log_head + log_size - len) % log_size;
+
+	if(log_linear || (start + len <= log_size))
+		write(&log_buf[log_linear ? (log_len - len) : start], len);
+	else
+	{
+		write(&log_buf[start], log_size - start);
+		write(log_buf, len - (log_size - start));
+	}
+}
+
+// Stop the log wrapping and return it
+const char *memlog_finish(size_t *len)
+{
+	if(!log_linear)
+	{
+		memlog_linearise();
+		log_linear = 1;
+	}
+
+	if(len)
+		*len = log_len;
+	return log_buf;
+}
@@ -0,0 +1,671 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* mkbootimg - build an SD card image with the boot files laid out for speed
+ *
+ * Built and run on the host, not the Pi:
+ *
+ *	mkbootimg [-s size_mib] [-c cluster_kib] [-e erase_kib] [-m] image list
+ *
+ * 'list' names the files to put on the card, one per line in the order they
+ * are loaded at boot:
+ *
+ *	<file on the host> <path on the card>
+ *
+ * Blank lines and lines starting with '#' are ignored.  Card paths must be
+ * absolute 8.3 names; directories are created as needed.
+ *
+ * The image has one FAT16 or FAT32 partition.  The partition and the start
+ * of its data area are aligned to the erase block size (default 4 MiB), and
+ * the files are written back to back in list order, each in one run of
+ * clusters, starting on an erase block boundary after the directories.
+ * Unless -c is given the largest cluster size up to 32 KiB that gives a
+ * valid FAT16 or FAT32 volume is used, so the loader has as few FAT entries
+ * as possible to follow.
+ *
+ * With -m a boot manifest (see manifest.h) listing every file is written to
+ * /boot/manifest.bin, so the loader need not look at the filesystem at all.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "crc32.h"
+
+// These must match manifest.h
+#define MANIFEST_NAME		"/boot/manifest.bin"
+#define MANIFEST_MAGIC		0x464d4252
+#define MANIFEST_VERSION	1
+#define MANIFEST_HEADER_SIZE	32
+#define MANIFEST_ENTRY_SIZE	128
+#define MANIFEST_EXTENT_SIZE	8
+#define MANIFEST_PATH_LEN	64
+#define MANIFEST_MAX_SIZE	0x10000
+
+#define SECTOR_SIZE		512
+#define MAX_CLUSTER_SIZE	0x8000
+#define FAT16_MIN_CLUSTERS	4085
+#define FAT32_MIN_CLUSTERS	65525
+#define FAT16_ROOT_ENTRIES	512
+
+struct node
+{
+	uint8_t name[11];		// padded 8.3 name
+	int is_dir;
+	struct node *parent;
+	struct node *child;
+	struct node *next;
+	int entries;			// directories: entries used, including . and ..
+
+	const char *host;		// files: where the data comes from
+	char *path;
+	uint32_t size;
+	uint32_t crc;
+	uint16_t time, date;
+
+	uint32_t cluster;		// first cluster (0 for an empty file)
+	uint32_t clusters;
+	uint32_t dirent_sector;		// absolute sector of the directory entry
+	uint32_t dirent_offset;
+	uint8_t dirent[32];
+};
+
+struct layout
+{
+	int fat_type;			// 16 or 32
+	uint32_t part_start;		// absolute sector
+	uint32_t part_sectors;
+	uint32_t spc;			// sectors per cluster
+	uint32_t reserved;
+	uint32_t fat_size;		// sectors per FAT
+	uint32_t root_sectors;		// FAT16 fixed root directory
+	uint32_t data_start;		// partition relative
+	uint32_t clusters;
+};
+
+static struct node root;
+static struct node **files = NULL;
+static int file_count = 0;
+static uint32_t *fat = NULL;
+
+static void die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkbootimg: ");
+	fprintf(stderr, msg, arg);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void wr16(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+	wr16(p, v);
+	wr16(&p[2], v >> 16);
+}
+
+// Convert one path component to a padded, upper case 8.3 name
+static int make_83(const char *comp, size_t len, uint8_t *name)
+{
+	memset(name, ' ', 11);
+	size_t n = 0, limit = 8;
+	int in_ext = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		char c = comp[i];
+		if((c == '.') && !in_ext && (i > 0))
+		{
+			in_ext = 1;
+			n = 8;
+			limit = 11;
+			continue;
+		}
+		if(!isalnum((unsigned char)c) && !strchr("-_~!#$%&'(){}^@`", c))
+			return -1;
+		if(n >= limit)
+			return -1;
+		name[n++] = (uint8_t)toupper((unsigned char)c);
+	}
+	return (len == 0) ? -1 : 0;
+}
+
+static struct node *add_node(struct node *dir, const uint8_t *name, int is_dir)
+{
+	for(struct node *n = dir->child; n; n = n->next)
+	{
+		if(!memcmp(n->name, name, 11))
+			return (n->is_dir == is_dir) ? n : NULL;
+	}
+
+	struct node *n = calloc(1, sizeof(struct node));
+	memcpy(n->name, name, 11);
+	n->is_dir = is_dir;
+	n->parent = dir;
+	n->entries = 2;
+
+	// Keep the list in creation order
+	struct node **p = &dir->child;
+	while(*p)
+		p = &(*p)->next;
+	*p = n;
+	dir->entries++;
+	return n;
+}
+
+static void add_file(const char *host, const char *path)
+{
+	if((path[0] != '/') || (strlen(path) >= MANIFEST_PATH_LEN))
+		die("%s: card paths must be absolute and under 64 characters", path);
+
+	struct node *dir = &root;
+	const char *p = path;
+	while(*p)
+	{
+		while(*p == '/')
+			p++;
+		const char *end = p;
+		while(*end && (*end != '/'))
+			end++;
+		uint8_t name[11];
+		if(make_83(p, (size_t)(end - p), name) != 0)
+			die("%s: not a valid 8.3 path", path);
+		dir = add_node(dir, name, *end == '/');
+		if(!dir)
+			die("%s: file and directory names clash", path);
+		p = end;
+	}
+	if(dir->path)
+		die("%s: listed twice", path);
+
+	struct stat st;
+	if(host && (stat(host, &st) != 0))
+		die("%s: cannot stat", host);
+	time_t mtime = host ? st.st_mtime : time(NULL);
+	struct tm *tm = localtime(&mtime);
+	int year = tm->tm_year + 1900;
+	if(year < 1980)
+		year = 1980;
+	dir->time = (uint16_t)((tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2));
+	dir->date = (uint16_t)(((year - 1980) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday);
+	for(struct node *d = dir->parent; d && (d != &root) && !d->date; d = d->parent)
+	{
+		d->time = dir->time;
+		d->date = dir->date;
+	}
+	dir->host = host;
+	dir->path = strdup(path);
+	dir->size = host ? (uint32_t)st.st_size : 0;
+
+	files = realloc(files, (size_t)(file_count + 1) * sizeof(struct node *));
+	files[file_count++] = dir;
+}
+
+// Work out the FAT geometry for a cluster size, with the data area aligned
+// to the erase block.  Returns 0 if it makes a valid volume.
+static int try_layout(struct layout *l, uint32_t spc, uint32_t erase_sectors)
+{
+	l->spc = spc;
+	uint32_t est = l->part_sectors / spc;
+	if(est >= FAT32_MIN_CLUSTERS)
+	{
+		l->fat_type = 32;
+		l->reserved = 32;
+		l->root_sectors = 0;
+		l->fat_size = ((est + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	}
+	else
+	{
+		l->fat_type = 16;
+		l->reserved = 1;
+		l->root_sectors = FAT16_ROOT_ENTRIES * 32 / SECTOR_SIZE;
+		l->fat_size = ((est + 2) * 2 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	}
+
+	uint32_t meta = l->reserved + 2 * l->fat_size + l->root_sectors;
+	l->reserved += (erase_sectors - meta % erase_sectors) % erase_sectors;
+	l->data_start = l->reserved + 2 * l->fat_size + l->root_sectors;
+	if(l->data_start >= l->part_sectors)
+		return -1;
+	l->clusters = (l->part_sectors - l->data_start) / spc;
+
+	// The loader picks the FAT type from total sectors / cluster size, so
+	// both counts must fall on the same side of the limits
+	if(l->fat_type == 32)
+		return (l->clusters >= FAT32_MIN_CLUSTERS) ? 0 : -1;
+	return ((l->clusters >= FAT16_MIN_CLUSTERS) &&
+			(l->clusters < FAT32_MIN_CLUSTERS)) ? 0 : -1;
+}
+
+static uint32_t alloc_clusters(struct layout *l, uint32_t *next, uint32_t bytes)
+{
+	uint32_t cluster_size = l->spc * SECTOR_SIZE;
+	uint32_t count = (bytes + cluster_size - 1) / cluster_size;
+	if(!count)
+		return 0;
+	if(*next - 2 + count > l->clusters)
+		die("%s", "the files do not fit in the image; use a larger -s");
+
+	uint32_t first = *next;
+	for(uint32_t i = 0; i < count; i++)
+		fat[first + i] = (i == count - 1) ? 0x0fffffff : first + i + 1;
+	*next += count;
+	return first;
+}
+
+static uint32_t cluster_sector(struct layout *l, uint32_t cluster)
+{
+	return l->part_start + l->data_start + (cluster - 2) * l->spc;
+}
+
+static void alloc_dirs(struct layout *l, struct node *dir, uint32_t *next)
+{
+	uint32_t cluster_size = l->spc * SECTOR_SIZE;
+	for(struct node *n = dir->child; n; n = n->next)
+	{
+		if(!n->is_dir)
+			continue;
+		if((uint32_t)n->entries * 32 > cluster_size)
+			die("%s: too many entries for one directory cluster", "directory");
+		n->cluster = alloc_clusters(l, next, cluster_size);
+		n->clusters = 1;
+		alloc_dirs(l, n, next);
+	}
+}
+
+static void make_dirent(uint8_t *de, const struct node *n)
+{
+	memset(de, 0, 32);
+	memcpy(de, n->name, 11);
+	de[11] = n->is_dir ? 0x10 : 0x20;
+	wr16(&de[14], n->time);
+	wr16(&de[16], n->date);
+	wr16(&de[18], n->date);
+	wr16(&de[20], n->cluster >> 16);
+	wr16(&de[22], n->time);
+	wr16(&de[24], n->date);
+	wr16(&de[26], n->cluster & 0xffff);
+	wr32(&de[28], n->is_dir ? 0 : n->size);
+}
+
+static void write_at(FILE *img, uint32_t sector, const void *data, size_t len)
+{
+	if((fseeko(img, (off_t)sector * SECTOR_SIZE, SEEK_SET) != 0) ||
+			(fwrite(data, 1, len, img) != len))
+		die("%s", "error writing the image");
+}
+
+// Write a directory's entries, recording where each one went
+static void write_dir(FILE *img, struct layout *l, struct node *dir)
+{
+	int is_root = (dir == &root);
+	uint32_t sector = (is_root && (l->fat_type == 16)) ?
+		l->part_start + l->reserved + 2 * l->fat_size :
+		cluster_sector(l, dir->cluster);
+	size_t len = (is_root && (l->fat_type == 16)) ?
+		l->root_sectors * SECTOR_SIZE : l->spc * SECTOR_SIZE;
+	uint8_t *buf = calloc(1, len);
+
+	int slot = 0;
+	if(!is_root)
+	{
+		struct node dot = *dir, dotdot = *dir->parent;
+		memcpy(dot.name, ".          ", 11);
+		memcpy(dotdot.name, "..         ", 11);
+		if(dir->parent == &root)
+			dotdot.cluster = 0;
+		dotdot.is_dir = 1;
+		make_dirent(&buf[0], &dot);
+		make_dirent(&buf[32], &dotdot);
+		slot = 2;
+	}
+
+	for(struct node *n = dir->child; n; n = n->next, slot++)
+	{
+		if((size_t)(slot + 1) * 32 > len)
+			die("%s", "too many entries in the root directory");
+		make_dirent(&buf[slot * 32], n);
+		memcpy(n->dirent, &buf[slot * 32], 32);
+		n->dirent_sector = sector + (uint32_t)(slot * 32) / SECTOR_SIZE;
+		n->dirent_offset = (uint32_t)(slot * 32) % SECTOR_SIZE;
+		if(n->is_dir)
+			write_dir(img, l, n);
+	}
+	write_at(img, sector, buf, len);
+	free(buf);
+}
+
+static void write_file(FILE *img, struct layout *l, struct node *n)
+{
+	FILE *in = fopen(n->host, "rb");
+	if(!in)
+		die("%s: cannot open", n->host);
+	uint8_t *buf = malloc(0x10000);
+	uint32_t done = 0;
+	n->crc = 0;
+	while(done < n->size)
+	{
+		size_t len = fread(buf, 1, 0x10000, in);
+		if(len == 0)
+			die("%s: changed while being copied", n->host);
+		if(len > n->size - done)
+			len = n->size - done;
+		n->crc = crc32(n->crc, buf, len);
+		fseeko(img, (off_t)cluster_sector(l, n->cluster) * SECTOR_SIZE + done, SEEK_SET);
+		if(fwrite(buf, 1, len, img) != len)
+			die("%s", "error writing the image");
+		done += (uint32_t)len;
+	}
+	free(buf);
+	fclose(in);
+}
+
+static void write_manifest(FILE *img, struct layout *l, struct node *m)
+{
+	uint8_t *out = calloc(1, m->size);
+	int count = file_count - 1;
+	uint8_t *ext = &out[MANIFEST_HEADER_SIZE + count * MANIFEST_ENTRY_SIZE];
+	uint32_t extents = 0;
+	for(int i = 0; i < count; i++)
+	{
+		struct node *n = files[i];
+		uint8_t *e = &out[MANIFEST_HEADER_SIZE + i * MANIFEST_ENTRY_SIZE];
+		strcpy((char *)e, n->path);
+		wr32(&e[64], n->size);
+		wr32(&e[68], n->crc);
+		wr32(&e[72], n->dirent_sector);
+		wr32(&e[76], n->dirent_offset);
+		memcpy(&e[80], n->dirent, 32);
+		wr32(&e[112], extents);
+		wr32(&e[116], n->size ? 1 : 0);
+		if(n->size)
+		{
+			wr32(&ext[extents * MANIFEST_EXTENT_SIZE], cluster_sector(l, n->cluster));
+			wr32(&ext[extents * MANIFEST_EXTENT_SIZE + 4],
+					(n->size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+			extents++;
+		}
+	}
+	wr32(&out[0], MANIFEST_MAGIC);
+	wr32(&out[4], MANIFEST_VERSION);
+	wr32(&out[8], (uint32_t)count);
+	wr32(&out[12], extents);
+	wr32(&out[16], l->part_start);
+	wr32(&out[20], SECTOR_SIZE);
+	wr32(&out[24], crc32(0, &out[MANIFEST_HEADER_SIZE], m->size - MANIFEST_HEADER_SIZE));
+	write_at(img, cluster_sector(l, m->cluster), out, m->size);
+	m->crc = crc32(0, out, m->size);
+	free(out);
+}
+
+static void write_boot_sector(FILE *img, struct layout *l, uint32_t free_clusters,
+		uint32_t next_free)
+{
+	uint8_t bs[SECTOR_SIZE];
+	memset(bs, 0, sizeof(bs));
+	memcpy(bs, "\xeb\x58\x90RPI-BOOT", 11);
+	wr16(&bs[11], SECTOR_SIZE);
+	bs[13] = (uint8_t)l->spc;
+	wr16(&bs[14], l->reserved);
+	bs[16] = 2;
+	wr16(&bs[17], (l->fat_type == 16) ? FAT16_ROOT_ENTRIES : 0);
+	if((l->fat_type == 16) && (l->part_sectors < 0x10000))
+		wr16(&bs[19], l->part_sectors);
+	else
+		wr32(&bs[32], l->part_sectors);
+	bs[21] = 0xf8;
+	wr16(&bs[24], 63);
+	wr16(&bs[26], 255);
+	wr32(&bs[28], l->part_start);
+
+	uint8_t *ext = &bs[36];
+	if(l->fat_type == 32)
+	{
+		wr32(&bs[36], l->fat_size);
+		wr32(&bs[44], 2);	// root cluster
+		wr16(&bs[48], 1);	// FSInfo sector
+		wr16(&bs[50], 6);	// backup boot sector
+		ext = &bs[64];
+	}
+	else
+		wr16(&bs[22], l->fat_size);
+	ext[0] = 0x80;
+	ext[2] = 0x29;
+	wr32(&ext[3], (uint32_t)time(NULL));
+	memcpy(&ext[7], "RPI-BOOT   ", 11);
+	memcpy(&ext[18], (l->fat_type == 32) ? "FAT32   " : "FAT16   ", 8);
+	bs[510] = 0x55;
+	bs[511] = 0xaa;
+	write_at(img, l->part_start, bs, SECTOR_SIZE);
+
+	if(l->fat_type == 32)
+	{
+		uint8_t fsinfo[SECTOR_SIZE];
+		memset(fsinfo, 0, sizeof(fsinfo));
+		wr32(&fsinfo[0], 0x41615252);
+		wr32(&fsinfo[484], 0x61417272);
+		wr32(&fsinfo[488], free_clusters);
+		wr32(&fsinfo[492], next_free);
+		wr32(&fsinfo[508], 0xaa550000);
+		write_at(img, l->part_start + 1, fsinfo, SECTOR_SIZE);
+		write_at(img, l->part_start + 6, bs, SECTOR_SIZE);
+		write_at(img, l->part_start + 7, fsinfo, SECTOR_SIZE);
+	}
+}
+
+static void write_fats(FILE *img, struct layout *l)
+{
+	size_t len = (size_t)l->fat_size * SECTOR_SIZE;
+	uint8_t *buf = calloc(1, len);
+	for(uint32_t c = 0; c < l->clusters + 2; c++)
+	{
+		if(l->fat_type == 32)
+			wr32(&buf[c * 4], fat[c]);
+		else if(c == 0)
+			wr16(&buf[0], 0xfff8);
+		else
+			wr16(&buf[c * 2], (fat[c] >= 0x0ffffff8) ? 0xffff : fat[c]);
+	}
+	for(uint32_t i = 0; i < 2; i++)
+		write_at(img, l->part_start + l->reserved + i * l->fat_size, buf, len);
+	free(buf);
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: mkbootimg [-s size_mib] [-c cluster_kib] [-e erase_kib] "
+			"[-m] image list\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t size_mib = 0, cluster_kib = 0, erase_kib = 4096;
+	int want_manifest = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "s:c:e:m")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				size_mib = (uint32_t)atoi(optarg);
+				break;
+			case 'c':
+				cluster_kib = (uint32_t)atoi(optarg);
+				break;
+			case 'e':
+				erase_kib = (uint32_t)atoi(optarg);
+				break;
+			case 'm':
+				want_manifest = 1;
+				break;
+			default:
+				usage();
+		}
+	}
+	if(argc - optind != 2)
+		usage();
+	if(!erase_kib || (erase_kib & (erase_kib - 1)))
+		die("%s", "the erase block size must be a power of two");
+	if(cluster_kib && ((cluster_kib & (cluster_kib - 1)) ||
+				(cluster_kib * 1024 > MAX_CLUSTER_SIZE) || (cluster_kib > erase_kib)))
+		die("%s", "the cluster size must be a power of two, at most 32 KiB and "
+				"no larger than an erase block");
+
+	// Read the list
+	FILE *list = fopen(argv[optind + 1], "r");
+	if(!list)
+		die("%s: cannot open", argv[optind + 1]);
+	char line[1024];
+	uint64_t total = 0;
+	while(fgets(line, sizeof(line), list))
+	{
+		char host[512], path[512];
+		char *p = line;
+		while(isspace((unsigned char)*p))
+			p++;
+		if((*p == 0) || (*p == '#'))
+			continue;
+		if(sscanf(p, "%511s %511s", host, path) != 2)
+			die("%s: expected '<host file> <card path>'", p);
+		add_file(strdup(host), path);
+		total += files[file_count - 1]->size;
+	}
+	fclose(list);
+
+	struct node *manifest = NULL;
+	if(want_manifest)
+	{
+		add_file(NULL, MANIFEST_NAME);
+		manifest = files[file_count - 1];
+		manifest->size = MANIFEST_HEADER_SIZE +
+			(uint32_t)(file_count - 1) * MANIFEST_ENTRY_SIZE;
+		for(int i = 0; i < file_count - 1; i++)
+		{
+			if(files[i]->size)
+				manifest->size += MANIFEST_EXTENT_SIZE;
+		}
+		if(manifest->size > MANIFEST_MAX_SIZE)
+			die("%s", "too many files for a manifest");
+	}
+
+	// Default to twice the size of the files, and at least 64 MiB
+	uint32_t erase_sectors = erase_kib * 1024 / SECTOR_SIZE;
+	if(!size_mib)
+	{
+		size_mib = (uint32_t)((total * 2) >> 20) + 2 * (erase_kib / 1024) + 8;
+		if(size_mib < 64)
+			size_mib = 64;
+	}
+
+	struct layout l;
+	memset(&l, 0, sizeof(l));
+	l.part_start = erase_sectors;
+	uint64_t img_sectors = (uint64_t)size_mib * 2048;
+	if(img_sectors <= l.part_start)
+		die("%s", "the image is too small");
+	l.part_sectors = (uint32_t)(img_sectors - l.part_start);
+
+	int ok = -1;
+	for(uint32_t kib = cluster_kib ? cluster_kib : MAX_CLUSTER_SIZE / 1024; kib >= 1; kib /= 2)
+	{
+		if(kib > erase_kib)
+			continue;
+		ok = try_layout(&l, kib * 2, erase_sectors);
+		if((ok == 0) || cluster_kib)
+			break;
+	}
+	if(ok != 0)
+		die("%s", "no valid FAT16/FAT32 layout for this size; try another -s or -c");
+
+	// Directories first, then the files from the next erase block in order
+	fat = calloc(l.clusters + 2, sizeof(uint32_t));
+	fat[0] = 0x0ffffff8;
+	fat[1] = 0x0fffffff;
+	uint32_t next = 2;
+	if(l.fat_type == 32)
+	{
+		root.cluster = alloc_clusters(&l, &next, l.spc * SECTOR_SIZE);
+		if((uint32_t)root.entries * 32 > l.spc * SECTOR_SIZE)
+			die("%s", "too many entries in the root directory");
+	}
+	alloc_dirs(&l, &root, &next);
+	uint32_t per_erase = erase_sectors / l.spc;
+	next = 2 + (next - 2 + per_erase - 1) / per_erase * per_erase;
+	if(manifest)
+		manifest->cluster = alloc_clusters(&l, &next, manifest->size);
+	for(int i = 0; i < file_count; i++)
+	{
+		if(files[i] != manifest)
+			files[i]->cluster = alloc_clusters(&l, &next, files[i]->size);
+	}
+
+	FILE *img = fopen(argv[optind], "wb+");
+	if(!img)
+		die("%s: cannot create", argv[optind]);
+	if(ftruncate(fileno(img), (off_t)(img_sectors * SECTOR_SIZE)) != 0)
+		die("%s: cannot set the size", argv[optind]);
+
+	// MBR with one LBA FAT partition
+	uint8_t mbr[SECTOR_SIZE];
+	memset(mbr, 0, sizeof(mbr));
+	uint8_t *pe = &mbr[0x1be];
+	memcpy(pe, "\x80\xfe\xff\xff", 4);
+	pe[4] = (l.fat_type == 32) ? 0x0c : 0x0e;
+	memcpy(&pe[5], "\xfe\xff\xff", 3);
+	wr32(&pe[8], l.part_start);
+	wr32(&pe[12], l.part_sectors);
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+	write_at(img, 0, mbr, SECTOR_SIZE);
+
+	write_boot_sector(img, &l, l.clusters - (next - 2), next);
+	write_fats(img, &l);
+	write_dir(img, &l, &root);
+	for(int i = 0; i < file_count; i++)
+	{
+		if((files[i] != manifest) && files[i]->size)
+			write_file(img, &l, files[i]);
+	}
+	if(manifest)
+		write_manifest(img, &l, manifest);
+	if(fclose(img) != 0)
+		die("%s: error writing", argv[optind]);
+
+	printf("%s: %u MiB, FAT%i, %u KiB clusters, data area at sector %u\n",
+			argv[optind], size_mib, l.fat_type, l.spc / 2,
+			l.part_start + l.data_start);
+	for(int i = 0; i < file_count; i++)
+	{
+		struct node *n = files[i];
+		printf("  %-24s %9u bytes at sector %u\n", n->path, n->size,
+				n->size ? cluster_sector(&l, n->cluster) : 0);
+	}
+	return 0;
+}
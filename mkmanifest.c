@@ -0,0 +1,440 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* mkmanifest - write a boot manifest for rpi-boot
+ *
+ * Built and run on the host, not the Pi:
+ *
+ *	mkmanifest [-p partition] image manifest.bin path...
+ *
+ * Finds each path (e.g. /boot/kernel.img) on the FAT partition of an SD
+ * card image or device and writes the sectors holding it, its size, its
+ * CRC32 and a copy of its directory entry to manifest.bin, which should
+ * then be copied to /boot/manifest.bin on the same partition.  The format
+ * is described in manifest.h.  Re-run it whenever the boot files change;
+ * files changed since are noticed by the loader and read normally.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "crc32.h"
+
+// These must match manifest.h
+#define MANIFEST_MAGIC		0x464d4252
+#define MANIFEST_VERSION	1
+#define MANIFEST_HEADER_SIZE	32
+#define MANIFEST_ENTRY_SIZE	128
+#define MANIFEST_EXTENT_SIZE	8
+#define MANIFEST_PATH_LEN	64
+#define MANIFEST_MAX_SIZE	0x10000
+
+#define SECTOR_SIZE		512
+
+struct extent
+{
+	uint32_t sector;
+	uint32_t count;
+};
+
+struct volume
+{
+	FILE *img;
+	uint32_t part_start;
+	int fat_type;		// 12, 16 or 32
+	uint32_t spc;		// sectors per cluster
+	uint32_t fat_start;
+	uint32_t root_start;	// FAT12/16 fixed root directory
+	uint32_t root_sectors;
+	uint32_t root_cluster;	// FAT32
+	uint32_t data_start;
+	uint32_t clusters;
+};
+
+static uint32_t rd16(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+	return rd16(p) | (rd16(&p[2]) << 16);
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static int read_sectors(struct volume *v, uint8_t *buf, uint32_t sector, uint32_t count)
+{
+	if(fseek(v->img, (long)sector * SECTOR_SIZE, SEEK_SET) != 0)
+		return -1;
+	if(fread(buf, SECTOR_SIZE, count, v->img) != count)
+		return -1;
+	return 0;
+}
+
+static uint32_t cluster_sector(struct volume *v, uint32_t cluster)
+{
+	return v->data_start + (cluster - 2) * v->spc;
+}
+
+static uint32_t next_cluster(struct volume *v, uint32_t cluster)
+{
+	uint8_t buf[2 * SECTOR_SIZE];
+	uint32_t offset;
+	if(v->fat_type == 12)
+		offset = cluster + cluster / 2;
+	else if(v->fat_type == 16)
+		offset = cluster * 2;
+	else
+		offset = cluster * 4;
+
+	if(read_sectors(v, buf, v->fat_start + offset / SECTOR_SIZE, 2) != 0)
+		return 0x0fffffff;
+	const uint8_t *p = &buf[offset % SECTOR_SIZE];
+
+	uint32_t next;
+	if(v->fat_type == 12)
+	{
+		next = rd16(p);
+		next = (cluster & 1) ? (next >> 4) : (next & 0xfff);
+		if(next >= 0xff7)
+			next = 0x0fffffff;
+	}
+	else if(v->fat_type == 16)
+	{
+		next = rd16(p);
+		if(next >= 0xfff7)
+			next = 0x0fffffff;
+	}
+	else
+		next = rd32(p) & 0x0fffffff;
+	if((next < 2) || (next >= v->clusters + 2))
+		next = 0x0fffffff;
+	return next;
+}
+
+static int open_volume(struct volume *v, int part_no)
+{
+	uint8_t mbr[SECTOR_SIZE], bs[SECTOR_SIZE];
+	if(read_sectors(v, mbr, 0, 1) != 0)
+		return -1;
+	if((mbr[0x1fe] != 0x55) || (mbr[0x1ff] != 0xaa))
+	{
+		fprintf(stderr, "mkmanifest: no MBR found\n");
+		return -1;
+	}
+
+	// Use the requested partition, or the first FAT one
+	v->part_start = 0;
+	for(int i = 0; i < 4; i++)
+	{
+		const uint8_t *pe = &mbr[0x1be + i * 16];
+		int is_fat = (pe[4] == 0x01) || (pe[4] == 0x04) || (pe[4] == 0x06) ||
+			(pe[4] == 0x0b) || (pe[4] == 0x0c) || (pe[4] == 0x0e);
+		if((part_no == i) || ((part_no < 0) && is_fat))
+		{
+			v->part_start = rd32(&pe[8]);
+			break;
+		}
+	}
+	if(v->part_start == 0)
+	{
+		fprintf(stderr, "mkmanifest: no FAT partition found\n");
+		return -1;
+	}
+
+	if(read_sectors(v, bs, v->part_start, 1) != 0)
+		return -1;
+	if(rd16(&bs[11]) != SECTOR_SIZE)
+	{
+		fprintf(stderr, "mkmanifest: only %i byte sectors are supported\n",
+				SECTOR_SIZE);
+		return -1;
+	}
+	v->spc = bs[13];
+	uint32_t reserved = rd16(&bs[14]);
+	uint32_t fats = bs[16];
+	uint32_t root_entries = rd16(&bs[17]);
+	uint32_t total = rd16(&bs[19]) ? rd16(&bs[19]) : rd32(&bs[32]);
+	uint32_t fat_size = rd16(&bs[22]) ? rd16(&bs[22]) : rd32(&bs[36]);
+	if(!v->spc || !fats || !fat_size)
+	{
+		fprintf(stderr, "mkmanifest: partition is not FAT\n");
+		return -1;
+	}
+
+	v->fat_start = v->part_start + reserved;
+	v->root_start = v->fat_start + fats * fat_size;
+	v->root_sectors = (root_entries * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	v->data_start = v->root_start + v->root_sectors;
+	v->clusters = (total - (v->data_start - v->part_start)) / v->spc;
+	if(v->clusters < 4085)
+		v->fat_type = 12;
+	else if(v->clusters < 65525)
+		v->fat_type = 16;
+	else
+	{
+		v->fat_type = 32;
+		v->root_cluster = rd32(&bs[44]);
+	}
+	return 0;
+}
+
+// Convert a raw 8.3 name the way the loader does: lower case, no padding
+static void short_name(const uint8_t *raw, char *name)
+{
+	int n = 0;
+	for(int i = 0; i < 8 && raw[i] != ' '; i++)
+		name[n++] = (char)tolower(raw[i]);
+	if(raw[8] != ' ')
+	{
+		name[n++] = '.';
+		for(int i = 8; i < 11 && raw[i] != ' '; i++)
+			name[n++] = (char)tolower(raw[i]);
+	}
+	name[n] = 0;
+}
+
+// Look for name in a directory (cluster 0 is the FAT12/16 root).  On
+// success the directory entry and its location are returned.
+static int find_in_dir(struct volume *v, uint32_t cluster, const char *name,
+		uint8_t *dirent, uint32_t *sector, uint32_t *offset)
+{
+	int fixed_root = (cluster == 0);
+	uint32_t sec = fixed_root ? v->root_start : cluster_sector(v, cluster);
+	uint32_t left = fixed_root ? v->root_sectors : v->spc;
+
+	while(1)
+	{
+		uint8_t buf[SECTOR_SIZE];
+		if(read_sectors(v, buf, sec, 1) != 0)
+			return -1;
+		for(uint32_t off = 0; off < SECTOR_SIZE; off += 32)
+		{
+			uint8_t *de = &buf[off];
+			if(de[0] == 0)
+				return -1;
+			if((de[0] == 0xe5) || (de[0] == '.') || (de[11] == 0x0f) ||
+					(de[11] & 0x08))
+				continue;
+			char this_name[13];
+			short_name(de, this_name);
+			if(!strcmp(this_name, name))
+			{
+				memcpy(dirent, de, 32);
+				*sector = sec;
+				*offset = off;
+				return 0;
+			}
+		}
+
+		sec++;
+		if(--left == 0)
+		{
+			if(fixed_root)
+				return -1;
+			cluster = next_cluster(v, cluster);
+			if(cluster == 0x0fffffff)
+				return -1;
+			sec = cluster_sector(v, cluster);
+			left = v->spc;
+		}
+	}
+}
+
+// Append the extents of a file, returning the number added
+static int file_extents(struct volume *v, uint32_t cluster, uint32_t size,
+		struct extent **extents, uint32_t *extent_count)
+{
+	uint32_t sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	int added = 0;
+	while(sectors)
+	{
+		if((cluster < 2) || (cluster == 0x0fffffff))
+			return -1;
+		uint32_t sec = cluster_sector(v, cluster);
+		uint32_t n = (sectors < v->spc) ? sectors : v->spc;
+		struct extent *last = added ? &(*extents)[*extent_count - 1] : NULL;
+		if(last && (last->sector + last->count == sec))
+			last->count += n;
+		else
+		{
+			*extents = realloc(*extents, (*extent_count + 1) * sizeof(struct extent));
+			(*extents)[*extent_count].sector = sec;
+			(*extents)[*extent_count].count = n;
+			(*extent_count)++;
+			added++;
+		}
+		sectors -= n;
+		if(sectors)
+			cluster = next_cluster(v, cluster);
+	}
+	return added;
+}
+
+static int file_crc(struct volume *v, struct extent *extents, uint32_t count,
+		uint32_t size, uint32_t *crc)
+{
+	uint8_t buf[SECTOR_SIZE];
+	*crc = 0;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		for(uint32_t s = 0; s < extents[i].count; s++)
+		{
+			if(read_sectors(v, buf, extents[i].sector + s, 1) != 0)
+				return -1;
+			uint32_t n = (size < SECTOR_SIZE) ? size : SECTOR_SIZE;
+			*crc = crc32(*crc, buf, n);
+			size -= n;
+		}
+	}
+	return 0;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: mkmanifest [-p partition] image manifest.bin path...\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int part_no = -1;
+	int argi = 1;
+	if((argc > 2) && !strcmp(argv[1], "-p"))
+	{
+		part_no = atoi(argv[2]);
+		argi = 3;
+	}
+	if(argc - argi < 3)
+		usage();
+
+	struct volume v;
+	memset(&v, 0, sizeof(v));
+	v.img = fopen(argv[argi], "rb");
+	if(!v.img)
+	{
+		perror(argv[argi]);
+		return 1;
+	}
+	if(open_volume(&v, part_no) != 0)
+		return 1;
+
+	int count = argc - argi - 2;
+	uint8_t *entries = calloc((size_t)count, MANIFEST_ENTRY_SIZE);
+	struct extent *extents = NULL;
+	uint32_t extent_count = 0;
+
+	for(int i = 0; i < count; i++)
+	{
+		const char *path = argv[argi + 2 + i];
+		uint8_t *e = &entries[i * MANIFEST_ENTRY_SIZE];
+		if((path[0] != '/') || (strlen(path) >= MANIFEST_PATH_LEN))
+		{
+			fprintf(stderr, "mkmanifest: %s: paths must be absolute and "
+					"shorter than %i characters\n", path, MANIFEST_PATH_LEN);
+			return 1;
+		}
+
+		// Walk the directories
+		char *copy = strdup(path);
+		uint32_t cluster = v.root_cluster;
+		uint8_t dirent[32];
+		uint32_t de_sector = 0, de_offset = 0;
+		int found = 0;
+		for(char *part = strtok(copy, "/"); part; part = strtok(NULL, "/"))
+		{
+			if(find_in_dir(&v, cluster, part, dirent, &de_sector, &de_offset) != 0)
+			{
+				found = 0;
+				break;
+			}
+			found = 1;
+			cluster = rd16(&dirent[26]) | (rd16(&dirent[20]) << 16);
+		}
+		free(copy);
+		if(!found || (dirent[11] & 0x10))
+		{
+			fprintf(stderr, "mkmanifest: %s: file not found\n", path);
+			return 1;
+		}
+
+		uint32_t size = rd32(&dirent[28]);
+		uint32_t first = extent_count;
+		int added = file_extents(&v, cluster, size, &extents, &extent_count);
+		uint32_t crc;
+		if((added < 0) || (file_crc(&v, &extents[first], (uint32_t)added,
+						size, &crc) != 0))
+		{
+			fprintf(stderr, "mkmanifest: %s: bad cluster chain\n", path);
+			return 1;
+		}
+
+		strcpy((char *)e, path);
+		wr32(&e[64], size);
+		wr32(&e[68], crc);
+		wr32(&e[72], de_sector);
+		wr32(&e[76], de_offset);
+		memcpy(&e[80], dirent, 32);
+		wr32(&e[112], first);
+		wr32(&e[116], (uint32_t)added);
+		printf("%s: %u bytes, %i extent(s), crc32 %08x\n", path, size, added, crc);
+	}
+
+	size_t len = MANIFEST_HEADER_SIZE + (size_t)count * MANIFEST_ENTRY_SIZE +
+		extent_count * MANIFEST_EXTENT_SIZE;
+	if(len > MANIFEST_MAX_SIZE)
+	{
+		fprintf(stderr, "mkmanifest: too many files or extents\n");
+		return 1;
+	}
+	uint8_t *out = calloc(1, len);
+	memcpy(&out[MANIFEST_HEADER_SIZE], entries, (size_t)count * MANIFEST_ENTRY_SIZE);
+	uint8_t *ext_out = &out[MANIFEST_HEADER_SIZE + count * MANIFEST_ENTRY_SIZE];
+	for(uint32_t i = 0; i < extent_count; i++)
+	{
+		wr32(&ext_out[i * MANIFEST_EXTENT_SIZE], extents[i].sector);
+		wr32(&ext_out[i * MANIFEST_EXTENT_SIZE + 4], extents[i].count);
+	}
+	wr32(&out[0], MANIFEST_MAGIC);
+	wr32(&out[4], MANIFEST_VERSION);
+	wr32(&out[8], (uint32_t)count);
+	wr32(&out[12], extent_count);
+	wr32(&out[16], v.part_start);
+	wr32(&out[20], SECTOR_SIZE);
+	wr32(&out[24], crc32(0, &out[MANIFEST_HEADER_SIZE], len - MANIFEST_HEADER_SIZE));
+
+	FILE *f = fopen(argv[argi + 1], "wb");
+	if(!f || (fwrite(out, 1, len, f) != len) || fclose(f))
+	{
+		perror(argv[argi + 1]);
+		return 1;
+	}
+	return 0;
+}
@@ -1,5 +1,18 @@
+# Given a list of boot files (see README), build the image with them laid out
+# contiguously in boot order instead of an empty filesystem
+if [ -n "$1" ]; then
+	make mkbootimg && ./mkbootimg -m sd.img "$1"
+	exit $?
+fi
+
 dd if=/dev/zero bs=1k count=65536 of=sd.img
 echo ';;b;;' | sfdisk sd.img
 sudo losetup -o512 /dev/loop0 sd.img
 sudo mkfs.vfat /dev/loop0 64259
 
+
+# Once the boot files have been copied in, a manifest of where they are can
+# be added (see README):
+#   make mkmanifest
+#   ./mkmanifest sd.img rpi-boot.mft /boot/rpi-boot.cfg /boot/kernel.img
+# then copy rpi-boot.mft to /boot/manifest.bin in the image.
@@ -24,8 +24,50 @@
 
 #include <stdint.h>
 
-void mmio_write(uint32_t reg, uint32_t data);
-uint32_t mmio_read(uint32_t reg);
+/* The BCM2835 does not guarantee that accesses to different peripherals
+ * complete in order.  A barrier is required before the first write to a
+ * peripheral and after the last read from one (BCM2835 Peripherals Guide
+ * section 1.3).
+ *
+ * mmio_read() and mmio_write() are fenced on both sides and are safe to use
+ * anywhere.  The _relaxed variants have no barriers and are intended for runs
+ * of accesses to a single peripheral (FIFO drains, status polling), with the
+ * run bracketed by mmio_barrier().
+ *
+ * These are always inlined as the loader is built at -O0.
+ */
 
-#endif // !MMIO_H
+#define MMIO_INLINE	static inline __attribute__((always_inline))
+
+MMIO_INLINE void mmio_barrier()
+{
+	// Data memory barrier (ARMv6 CP15 form)
+	asm volatile("mcr p15, #0, %[zero], c7, c10, #5" : : [zero]"r"(0) : "memory");
+}
 
+MMIO_INLINE uint32_t mmio_read_relaxed(uint32_t reg)
+{
+	return *(volatile uint32_t *)(reg);
+}
+
+MMIO_INLINE void mmio_write_relaxed(uint32_t reg, uint32_t data)
+{
+	*(volatile uint32_t *)(reg) = data;
+}
+
+MMIO_INLINE uint32_t mmio_read(uint32_t reg)
+{
+	mmio_barrier();
+	uint32_t data = mmio_read_relaxed(reg);
+	mmio_barrier();
+	return data;
+}
+
+MMIO_INLINE void mmio_write(uint32_t reg, uint32_t data)
+{
+	mmio_barrier();
+	mmio_write_relaxed(reg, data);
+	mmio_barrier();
+}
+
+#endif // !MMIO_H
@@ -32,6 +32,16 @@
 #include "console.h"
 #include "fb.h"
 #include "timer.h"
+#include "arena.h"
+#include "clock.h"
+#include "uart.h"
+#include "memlog.h"
+#include "trace.h"
+#include "decompress.h"
+#include "loadpipe.h"
+#include "verify.h"
+#include "prefetch.h"
+#include "aio.h"
 
 static int method_multiboot(char *args);
 static int method_boot(char *args);
@@ -39,6 +49,13 @@ static int method_module(char *args);
 static int method_kernel(char *args);
 static int method_entry_addr(char *args);
 static int method_binary_load_addr(char *args);
+static int method_baud(char *args);
+static int method_quiet(char *args);
+static int method_headless(char *args);
+static int method_trace(char *args);
+static int method_verify(char *args);
+static int method_prefetch(char *args);
+static int method_modplace(char *args);
 
 static void atag_cb(struct atag *);
 static void atag_cb2(struct atag *);
@@ -52,6 +69,17 @@ struct multiboot_info *mbinfo = (void *)0;
 uint32_t entry_addr = 0;
 uint32_t binary_load_addr = 0;
 
+// Modules are packed one after another into a single region, growing down
+// from the top of memory or up from the bottom
+#define MODULE_PLACE_TOP	0
+#define MODULE_PLACE_BOTTOM	1
+
+static int module_place = MODULE_PLACE_TOP;
+static uint32_t module_align = 0x1000;
+static int module_page_align = 0;
+static uint32_t mod_region_start = 0;
+static uint32_t mod_region_end = 0;
+
 struct multiboot_method
 {
 	char *name;
@@ -83,6 +111,34 @@ static struct multiboot_method methods[] =
 	{
 		.name = "binary_load_addr",
 		.method = method_binary_load_addr
+	},
+	{
+		.name = "baud",
+		.method = method_baud
+	},
+	{
+		.name = "quiet",
+		.method = method_quiet
+	},
+	{
+		.name = "headless",
+		.method = method_headless
+	},
+	{
+		.name = "trace",
+		.method = method_trace
+	},
+	{
+		.name = "verify",
+		.method = method_verify
+	},
+	{
+		.name = "prefetch",
+		.method = method_prefetch
+	},
+	{
+		.name = "modplace",
+		.method = method_modplace
 	}
 };
 
@@ -97,7 +153,18 @@ struct multiboot_arm_functions funcs =
 	.opendir = opendir,
 	.readdir = readdir,
 	.closedir = closedir,
-	.usleep = usleep
+	.usleep = usleep,
+	.timer_get_ticks = timer_get_ticks,
+	.timer_get_cycles = timer_get_cycles,
+	.delay_cycles = delay_cycles,
+	.get_boot_log = memlog_finish,
+	.snprintf = snprintf,
+	.vfs_load_file = vfs_load_file,
+	.aio_submit = aio_submit,
+	.aio_poll = aio_poll,
+	.aio_wait = aio_wait,
+	.register_timer = register_timer,
+	.compare_timer = compare_timer
 };
 
 static char *read_line(char **buf)
@@ -128,6 +195,9 @@ static char *read_line(char **buf)
 
 char empty_string[] = "";
 
+// The lines after the one being run
+static char *cfg_rest = (void *)0;
+
 static void split_string(char *str, char **method, char **args)
 {
 	int state = 0;
@@ -173,43 +243,51 @@ int cfg_parse(char *buf)
 	char *b = buf;
 	while((line = read_line(&b)))
 	{
-#ifdef DEBUG
-		printf("read_line: %s\n", line);
-#endif
+		TRACE(CFG, TRACE_DEBUG, "read_line: %s\n", line);
 		char *method, *args;
 		split_string(line, &method, &args);
-#ifdef DEBUG
-		printf("method: %s, args: %s\n", method, args);
-#endif
+		TRACE(CFG, TRACE_DEBUG, "method: %s, args: %s\n", method, args);
 
 		if(!strcmp(method, empty_string))
 			continue;
 
+		// Each line is its own phase - anything the method allocates
+		// from the transient arena is dropped once it returns.  Show what
+		// the last one printed before this one starts, as it may take a
+		// while.
+		console_flush();
+		struct arena_mark mark = arena_mark(&transient_arena);
+
+		char *lwr = arena_strdup(&transient_arena, method);
+		for(char *l = lwr; *l; l++)
+			*l = (char)tolower(*l);
+
 		// Find and run the method
+		cfg_rest = b;
 		int method_count = sizeof(methods) / sizeof(struct multiboot_method);
 		int found = 0;
+		int retno = 0;
 		for(int i = 0; i < method_count; i++)
 		{
-			char *lwr = strlwr(method);
 			if(!strcmp(lwr, methods[i].name))
 			{
 				found = 1;
-				int retno = methods[i].method(args);
-				if(retno != 0)
-				{
-					printf("cfg_parse: %s failed with "
-							"%i\n", line,
-							retno);
-					return retno;
-				}
-				free(lwr);
+				retno = methods[i].method(args);
 				break;
 			}
-			free(lwr);
 		}
 
+		arena_release(&transient_arena, mark);
+
 		if(!found)
 			printf("cfg_parse: unknown method %s\n", method);	
+		else if(retno != 0)
+		{
+			printf("cfg_parse: %s failed with "
+					"%i\n", line,
+					retno);
+			return retno;
+		}
 	}
 
 	return 0;
@@ -217,9 +295,7 @@ int cfg_parse(char *buf)
 
 int method_multiboot(char *args)
 {
-#ifdef DEBUG
-	printf("Interpreting multiboot command\n");
-#endif
+	TRACE(MULTIBOOT, TRACE_INFO, "Interpreting multiboot command\n");
 	char *file, *cmd_line;
 	split_string(args, &file, &cmd_line);
 
@@ -230,15 +306,21 @@ int method_multiboot(char *args)
 		printf("MULTIBOOT: cannot load %s\n", file);
 		return -1;
 	}
-#ifdef DEBUG
-	printf("MULTIBOOT: loading first 8kiB of %s\n", file);
-#endif
-	uint32_t *first_8k = (uint32_t *)malloc(8192);
+
+	// Compressed kernels are unpacked in memory and parsed from there
+	fp = decompress_fopen(fp);
+	if(!fp)
+	{
+		printf("MULTIBOOT: cannot decompress %s\n", file);
+		return -1;
+	}
+	TRACE(MULTIBOOT, TRACE_INFO, "MULTIBOOT: loading first 8kiB of %s\n",
+			file);
+	uint32_t *first_8k = (uint32_t *)arena_alloc(&transient_arena, 8192);
 	int buf_size = fread(first_8k, 1, 8192, fp);
 
-#ifdef DEBUG
-	printf("MULTIBOOT: loaded first %i bytes\n", buf_size);
-#endif
+	TRACE(MULTIBOOT, TRACE_INFO, "MULTIBOOT: loaded first %i bytes\n",
+			buf_size);
 
 	struct multiboot_header *mboot = (void*)0;
 	uint32_t header_offset;
@@ -252,31 +334,27 @@ int method_multiboot(char *args)
 			struct multiboot_header *mb = (struct multiboot_header *)&first_8k[i];
 			if((mb->magic + mb->flags + mb->checksum) == 0)
 			{
-				// Its valid, save it somewhere
-				mboot = (struct multiboot_header *)
-					malloc(sizeof(struct multiboot_header));
-				memcpy(mboot, mb, sizeof(struct multiboot_header));
+				// Its valid, use it in place (first_8k lives until
+				// the end of this phase)
+				mboot = mb;
 				header_offset = i * 4;
 				break;
 			}
 		}
 	}
 
-	free(first_8k);
-
 	if(!mboot)
 	{
 		printf("MULTIBOOT: no valid multiboot header found in %s\n", file);
 		return -1;
 	}
 
-#ifdef DEBUG
-	printf("MULTIBOOT: valid multiboot header, flags: %08x\n", mboot->flags);
-#endif
+	TRACE(MULTIBOOT, TRACE_INFO, "MULTIBOOT: valid multiboot header, "
+			"flags: %08x\n", mboot->flags);
 
-	// Create a multiboot info header
-	mbinfo = (struct multiboot_info *)malloc(sizeof(struct multiboot_info));
-	memset(mbinfo, 0, sizeof(struct multiboot_info));
+	// Create a multiboot info header - this is passed to the kernel
+	mbinfo = (struct multiboot_info *)arena_zalloc(&persistent_arena,
+			sizeof(struct multiboot_info));
 
 	// Setup the fields
 	if(mboot->flags & (1 << 1))
@@ -287,7 +365,8 @@ int method_multiboot(char *args)
 		parse_atags(_atags, atag_cb);
 
 		// Allocate the mmap buffer
-		mbinfo->mmap_addr = (uint32_t)malloc(mbinfo->mmap_length);
+		mbinfo->mmap_addr = (uint32_t)arena_alloc(&persistent_arena,
+				mbinfo->mmap_length);
 		mmap_ptr = (uint32_t *)mbinfo->mmap_addr;
 
 		// Skip the pointer to the first item (4 bytes in - structure
@@ -301,6 +380,10 @@ int method_multiboot(char *args)
 		mbinfo->flags |= (1 << 0);
 		mbinfo->flags |= (1 << 6);
 	}
+
+	// The kernel requires page aligned modules
+	if(mboot->flags & (1 << 0))
+		module_page_align = 1;
 	
 
 	// Load the file
@@ -339,7 +422,8 @@ int method_multiboot(char *args)
 
 		// Load the file
 		fseek(fp, (long)file_offset, SEEK_SET);
-		size_t b_read = fread((void *)mboot->load_addr, 1, (size_t)len, fp);
+		size_t b_read = loadpipe_read(fp, (void *)mboot->load_addr,
+				(size_t)len, file);
 		if(b_read != (size_t)len)
 		{
 			printf("MULTIBOOT: a.out load error - tried to load %i bytes "
@@ -381,12 +465,22 @@ int method_multiboot(char *args)
 			return retno;
 		}
 
-		// Now interpret and load them
+		// Now interpret them and plan the load
 		//
-		// We do two passes - first loading the sections marked ALLOC to their
-		// appropriate addresses, then loading the others (Multiboot requires
-		// we load all sections).  This ensures we don't load the sections not
-		// marked ALLOC to an address that a later section requires.
+		// We do two passes - first reserving the sections marked ALLOC at their
+		// appropriate addresses, then finding space for the others (Multiboot
+		// requires we load all sections).  This ensures we don't place the
+		// sections not marked ALLOC at an address that a later section
+		// requires.  The file is then read once, in file order.
+
+		struct elf32_load_plan plan;
+		retno = elf32_plan_init(&plan, ehdr->e_shnum);
+		if(retno != ELF_OK)
+		{
+			free(ehdr);
+			free(sh_buf);
+			return retno;
+		}
 
 		for(unsigned int i = 0; i < ehdr->e_shnum; i++)
 		{
@@ -394,15 +488,15 @@ int method_multiboot(char *args)
 
 			if(shdr->sh_flags & SHF_ALLOC)
 			{
-#ifdef DEBUG
-				printf("MULTIBOOT: section %i is loadable\n", i);
-#endif
+				TRACE(MULTIBOOT, TRACE_DEBUG, "MULTIBOOT: section %i is "
+						"loadable\n", i);
 
 				// Try and allocate space for it
 				if(!shdr->sh_addr)
 				{
 					printf("MULTIBOOT: section %i has no defined "
 							"load address\n", i);
+					elf32_plan_free(&plan);
 					free(ehdr);
 					free(sh_buf);
 					return -1;
@@ -411,6 +505,7 @@ int method_multiboot(char *args)
 				{
 					printf("MULTIBOOT: section %i has no defined "
 							"size\n", i);
+					elf32_plan_free(&plan);
 					free(ehdr);
 					free(sh_buf);
 					return -1;
@@ -422,15 +517,16 @@ int method_multiboot(char *args)
 						"between 0x%08x and 0x%08x for section %i\n",
 						shdr->sh_addr, shdr->sh_addr + shdr->sh_size,
 						i);
+					elf32_plan_free(&plan);
 					free(ehdr);
 					free(sh_buf);
 					return -1;
 				}
 
-				// Now load or zero it
-				retno = elf32_load_section(fp, shdr);
+				retno = elf32_plan_add_section(&plan, shdr);
 				if(retno != ELF_OK)
 				{
+					elf32_plan_free(&plan);
 					free(ehdr);
 					free(sh_buf);
 					return retno;
@@ -444,9 +540,8 @@ int method_multiboot(char *args)
 
 			if(!(shdr->sh_flags & SHF_ALLOC))
 			{
-#ifdef DEBUG
-				printf("MULTIBOOT: section %i is not loadable\n", i);
-#endif
+				TRACE(MULTIBOOT, TRACE_DEBUG, "MULTIBOOT: section %i is not "
+						"loadable\n", i);
 
 				if(shdr->sh_size)
 				{
@@ -457,13 +552,17 @@ int method_multiboot(char *args)
 						printf("MULTIBOOT: unable to allocate chunk of "
 								"size %i for section %i\n",
 								shdr->sh_size, i);
+						elf32_plan_free(&plan);
+						free(ehdr);
+						free(sh_buf);
 						return -1;
 					}
 
 					shdr->sh_addr = load_addr;
-					retno = elf32_load_section(fp, shdr);
+					retno = elf32_plan_add_section(&plan, shdr);
 					if(retno != ELF_OK)
 					{
+						elf32_plan_free(&plan);
 						free(ehdr);
 						free(sh_buf);
 						return retno;
@@ -472,6 +571,16 @@ int method_multiboot(char *args)
 			}
 		}
 
+		// Now load or zero them
+		retno = elf32_plan_load(fp, &plan);
+		elf32_plan_free(&plan);
+		if(retno != ELF_OK)
+		{
+			free(ehdr);
+			free(sh_buf);
+			return retno;
+		}
+
 		// Set the ELF flags
 		mbinfo->u.elf_sec.num = ehdr->e_shnum;
 		mbinfo->u.elf_sec.size = ehdr->e_shentsize;
@@ -485,7 +594,7 @@ int method_multiboot(char *args)
 	}
 
 	// Set the cmd line
-	mbinfo->cmdline = args;
+	mbinfo->cmdline = arena_strdup(&persistent_arena, args);
 	mbinfo->flags |= (1 << 2);
 
 	// Set the boot device
@@ -496,12 +605,16 @@ int method_multiboot(char *args)
 	mbinfo->boot_loader_name = rpi_boot_name;
 	mbinfo->flags |= (1 << 9);
 
-	// Set the fb info
-	mbinfo->fb_addr = (uint32_t)fb_get_framebuffer();
-	mbinfo->fb_size = (fb_get_width() << 16) | (fb_get_height() & 0xffff);
-	mbinfo->fb_pitch = fb_get_pitch();
-	mbinfo->fb_depth = (fb_get_bpp() << 16) | (0x1);	// TODO: check pixel_order
-	mbinfo->flags |= (1 << 11);
+	// Set the fb info.  The framebuffer is only set up for this if the kernel
+	// asks for video information or we are going to use the screen anyway.
+	if(((mboot->flags & (1 << 2)) || !console_is_headless()) && (fb_ensure() == 0))
+	{
+		mbinfo->fb_addr = (uint32_t)fb_get_framebuffer();
+		mbinfo->fb_size = (fb_get_width() << 16) | (fb_get_height() & 0xffff);
+		mbinfo->fb_pitch = fb_get_pitch();
+		mbinfo->fb_depth = (fb_get_bpp() << 16) | (0x1);	// TODO: check pixel_order
+		mbinfo->flags |= (1 << 11);
+	}
 
 	// Set the device containing the kernel to be the default
 	vfs_set_default(fp->fs->parent->device_name);
@@ -523,12 +636,82 @@ struct _module {
 struct _module *first_mod = (void*)0;
 int mod_count = 0;
 
+// Allocate the space for the next module next to the previous ones
+static uint32_t module_alloc(uint32_t length)
+{
+	uint32_t align = module_align;
+	if(module_page_align && (align < 0x1000))
+		align = 0x1000;
+
+	int first = (mod_region_end == 0);
+	uint32_t address;
+	if(module_place == MODULE_PLACE_TOP)
+		address = chunk_get_chunk_below(first ? 0xffffffff :
+				mod_region_start, length, align);
+	else
+		address = chunk_get_chunk_above(first ? 0 : mod_region_end,
+				length, align);
+	if(!address)
+		return 0;
+
+	if(first)
+	{
+		mod_region_start = address;
+		mod_region_end = address + length;
+		return address;
+	}
+
+	if((address + length + align <= mod_region_start) ||
+			(address >= mod_region_end + align))
+		printf("MODULE: memory is in use next to the other modules, the "
+				"modules region will not be contiguous\n");
+	if(address < mod_region_start)
+		mod_region_start = address;
+	if(address + length > mod_region_end)
+		mod_region_end = address + length;
+	return address;
+}
+
+// Print where the modules ended up
+static void module_report()
+{
+	if(mod_region_end == 0)
+		return;
+
+	printf("MODULES: 0x%08x-0x%08x (%u bytes)\n", mod_region_start,
+			mod_region_end, mod_region_end - mod_region_start);
+	printf("  start      end        size       name\n");
+	for(struct _module *m = first_mod; m; m = m->next)
+	{
+		if((m->start < mod_region_start) || (m->end > mod_region_end))
+			continue;
+		printf("  0x%08x 0x%08x %10u %s\n", m->start, m->end,
+				m->end - m->start, m->name);
+	}
+}
+
+// Shrink the modules region to the modules actually loaded, after places
+// reserved for prefetched modules which never were have been freed
+static void module_region_trim()
+{
+	mod_region_start = 0;
+	mod_region_end = 0;
+	for(struct _module *m = first_mod; m; m = m->next)
+	{
+		if(!mod_region_end || (m->start < mod_region_start))
+			mod_region_start = m->start;
+		if(m->end > mod_region_end)
+			mod_region_end = m->end;
+	}
+}
+
 static void module_add(uint32_t start, uint32_t end, char *name)
 {
-	struct _module *m = (struct _module *)malloc(sizeof(struct module));
+	struct _module *m = (struct _module *)arena_alloc(&persistent_arena,
+			sizeof(struct _module));
 	m->start = start;
 	m->end = end;
-	m->name = name;
+	m->name = arena_strdup(&persistent_arena, name);
 	m->next = first_mod;
 	first_mod = m;
 	mod_count++;
@@ -538,7 +721,8 @@ static void add_multiboot_modules()
 {
 	mbinfo->mods_count = mod_count;
 
-	mbinfo->mods_addr = (uint32_t)malloc(16 * mod_count);
+	mbinfo->mods_addr = (uint32_t)arena_alloc(&persistent_arena,
+			16 * mod_count);
 	struct _module *cur_mod = first_mod;
 	for(int i = 0; i < mod_count; i++)
 	{
@@ -568,18 +752,54 @@ int method_module(char *args)
 		return -1;
 	}
 
-	// Allocate a chunk for it
-	uint32_t address = chunk_get_any_chunk((uint32_t)fp->len);
+	// A prefetched module may already be in its place
+	uint32_t address = (uint32_t)prefetch_in_place(fp);
+	if(address)
+	{
+		size_t len = (size_t)fp->len;
+		fclose(fp);
+		module_add(address, address + (uint32_t)len, name);
+		printf("MODULE: %s loaded\n", name);
+		return 0;
+	}
+
+	// Compressed modules are decoded straight into their chunk
+	struct decomp_stream ds;
+	int format = decompress_begin(fp, &ds);
+	if(format < 0)
+	{
+		printf("MODULE: unable to read compressed file %s (%i)\n", name,
+				format);
+		fclose(fp);
+		return -1;
+	}
+	size_t bytes_to_read = (format == DECOMP_NONE) ? (size_t)fp->len :
+		ds.out_len;
+
+	// Allocate a chunk for it in the modules region
+	address = module_alloc((uint32_t)bytes_to_read);
 	if(!address)
 	{
 		printf("MODULE: unable to allocate a chunk of size %i for %s\n",
-				fp->len, name);
+				bytes_to_read, name);
+		decompress_end(&ds);
+		fclose(fp);
 		return -1;
 	}
 
 	// Load it
-	size_t bytes_to_read = (size_t)fp->len;
-	size_t bytes_read = fread((void*)address, 1, bytes_to_read, fp);
+	size_t bytes_read;
+	if(format == DECOMP_NONE)
+	{
+		long ret = vfs_fload(fp, (void*)address, bytes_to_read, name);
+		bytes_read = (ret < 0) ? 0 : (size_t)ret;
+	}
+	else
+	{
+		bytes_read = (decompress_run(&ds, (void *)address) == 0) ?
+			bytes_to_read : 0;
+		decompress_end(&ds);
+	}
 	fclose(fp);
 
 	if(bytes_to_read != bytes_read)
@@ -597,9 +817,7 @@ int method_module(char *args)
 
 int method_boot(char *args)
 {
-#ifdef DEBUG
-	printf("Interpreting boot command\n");
-#endif
+	TRACE(MULTIBOOT, TRACE_INFO, "Interpreting boot command\n");
 	(void)args;
 
 	if(entry_addr == 0)
@@ -608,8 +826,38 @@ int method_boot(char *args)
 		return -1;
 	}
 
+	if(verify_report() != 0)
+	{
+		printf("BOOT: refusing to boot - image verification failed\n");
+		return -1;
+	}
+
+	// Anything prefetched but never loaded is of no use to the kernel
+	prefetch_release();
+	module_region_trim();
+
+	// Return the ARM to the clock rate the firmware gave us
+	clock_restore();
+
+	// Bring up the screen if it is still deferred, render any buffered output,
+	// and from now on draw it as it is written since the kernel may never
+	// return control to us.  The kernel expects the
+	// screen to start at the framebuffer address.
+	console_start();
+	console_set_immediate(1);
+	console_reset_scroll();
+
+	// Send everything buffered for the UART, and leave it idle for the kernel
+	uart_sync_mode();
+
 	if(mbinfo)
 	{
+		// Pass the boot log as a module
+		size_t log_len;
+		const char *log = memlog_finish(&log_len);
+		module_report();
+		module_add((uint32_t)log, (uint32_t)log + log_len, MEMLOG_MODULE_NAME);
+
 		add_multiboot_modules();
 
 		// Do a multiboot load
@@ -644,13 +892,20 @@ int method_kernel(char *args)
 		return -1;
 	}
 
+	// Compressed kernels are unpacked in memory and parsed from there
+	fp = decompress_fopen(fp);
+	if(!fp)
+	{
+		printf("KERNEL: unable to decompress %s\n", file);
+		return -1;
+	}
+
 	// Load up the first 0x30 bytes to determine the kernel type
-	uint8_t *first_bytes = (uint8_t *)malloc(0x30);
+	uint8_t *first_bytes = (uint8_t *)arena_alloc(&transient_arena, 0x30);
 	size_t bytes_to_read = 0x30;
 	size_t bytes_read = fread(first_bytes, 1, bytes_to_read, fp);
 	if(bytes_read <= 0)
 	{
-		free(first_bytes);
 		printf("KERNEL: error reading from %s\n", file);
 		return -1;
 	}
@@ -666,8 +921,6 @@ int method_kernel(char *args)
 			(*(uint32_t *)&first_bytes[0x24] == 0x016F2818))
 		kernel_type = 2;
 
-	free(first_bytes);
-
 	// Now load up the appropriate kernel type
 	if(kernel_type == 0)
 	{
@@ -698,9 +951,9 @@ int method_kernel(char *args)
 
 		// Load it
 		fseek(fp, 0, SEEK_SET);
-		bytes_read = fread((void *)binary_load_addr, 1,
-				(size_t)length, fp);
-		if(bytes_read != (size_t)length)
+		long ret = vfs_fload(fp, (void *)binary_load_addr, (size_t)length,
+				file);
+		if(ret != (long)length)
 		{
 			printf("KERNEL: unable to load kernel %s - only %i "
 					"bytes loaded\n", file, length);
@@ -729,6 +982,17 @@ int method_kernel(char *args)
 			return retno;
 		}
 
+		// Reserve each segment's memory, then read them all in file order
+		struct elf32_load_plan plan;
+		retno = elf32_plan_init(&plan, ehdr->e_phnum);
+		if(retno != ELF_OK)
+		{
+			free(ehdr);
+			free(ph_buf);
+			fclose(fp);
+			return retno;
+		}
+
 		for(int i = 0; i < ehdr->e_phnum; i++)
 		{
 			Elf32_Phdr *phdr =
@@ -743,16 +1007,20 @@ int method_kernel(char *args)
 			// Check we can load to this address
 			if(!chunk_get_chunk(start, length))
 			{
+				printf("KERNEL: unable to allocate a chunk between "
+						"0x%08x and 0x%08x for segment %i\n",
+						start, start + length, i);
+				elf32_plan_free(&plan);
 				free(ehdr);
 				free(ph_buf);
 				fclose(fp);
-				return retno;
+				return -1;
 			}
 
-			// Load the segment
-			retno = elf32_load_segment(fp, phdr);
+			retno = elf32_plan_add_segment(&plan, phdr);
 			if(retno != ELF_OK)
 			{
+				elf32_plan_free(&plan);
 				free(ehdr);
 				free(ph_buf);
 				fclose(fp);
@@ -760,7 +1028,19 @@ int method_kernel(char *args)
 			}
 		}
 
+		retno = elf32_plan_load(fp, &plan);
+		elf32_plan_free(&plan);
+		free(ph_buf);
+		if(retno != ELF_OK)
+		{
+			free(ehdr);
+			fclose(fp);
+			return retno;
+		}
+
 		entry_addr = ehdr->e_entry;
+		free(ehdr);
+		fclose(fp);
 	}
 	else if (kernel_type == 2)
 	{
@@ -785,6 +1065,102 @@ int method_binary_load_addr(char *args)
 	return -1;
 }
 
+int method_baud(char *args)
+{
+	char *end;
+	uint32_t baud = (uint32_t)strtoul(args, &end, 10);
+	if((end == args) || (uart_set_baud(baud) != 0))
+	{
+		printf("BAUD: invalid baud rate '%s'\n", args);
+		return -1;
+	}
+	return 0;
+}
+
+// Stop writing to the UART and screen; the boot log is still kept in memory
+int method_quiet(char *args)
+{
+	(void)args;
+	fflush(stdout);
+	stdio_set_sink_enabled("uart", 0);
+	stdio_set_sink_enabled("console", 0);
+	console_set_headless();
+	return 0;
+}
+
+// Never use the screen for output
+int method_headless(char *args)
+{
+	(void)args;
+	fflush(stdout);
+	stdio_set_sink_enabled("console", 0);
+	console_set_headless();
+	return 0;
+}
+
+static int parse_trace_level(const char *s)
+{
+	static const char *level_names[] = { "none", "error", "info", "debug" };
+
+	for(int i = TRACE_NONE; i <= TRACE_DEBUG; i++)
+	{
+		if(!strcmp(s, level_names[i]))
+			return i;
+	}
+
+	char *end;
+	int level = (int)strtoul(s, &end, 10);
+	if((end == s) || *end)
+		return -1;
+	return level;
+}
+
+// Adjust tracing: a list of <subsystem>=<level> (subsystem may be 'all'),
+// 'binary' to record events in the trace ring, 'text' to print them as they
+// happen and 'dump' to print the ring
+int method_trace(char *args)
+{
+	char *p = args;
+	while(*p)
+	{
+		while(*p == ' ')
+			p++;
+		if(!*p)
+			break;
+
+		char *word = p;
+		while(*p && (*p != ' '))
+			p++;
+		if(*p)
+			*p++ = 0;
+
+		if(!strcmp(word, "binary"))
+			trace_binary = 1;
+		else if(!strcmp(word, "text"))
+			trace_binary = 0;
+		else if(!strcmp(word, "dump"))
+			trace_dump();
+		else
+		{
+			char *level = word;
+			while(*level && (*level != '='))
+				level++;
+			int lvl = -1;
+			if(*level)
+			{
+				*level++ = 0;
+				lvl = parse_trace_level(level);
+			}
+			if((lvl < 0) || (trace_set_level(word, lvl) != 0))
+			{
+				printf("TRACE: invalid setting '%s'\n", word);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
 void atag_cb(struct atag *tag)
 {
 	if(tag->hdr.tag == ATAG_MEM)
@@ -819,3 +1195,113 @@ void atag_cb2(struct atag *tag)
 	}
 }
 
+// Check a file against a SHA-256 (64 hex digits) or CRC32 (8 hex digits)
+// hash as it is loaded.  Must come before the line which loads the file.
+int method_verify(char *args)
+{
+	char *file, *hash;
+	split_string(args, &file, &hash);
+
+	if(verify_add(file, hash) != 0)
+	{
+		printf("VERIFY: invalid hash '%s' for %s\n", hash, file);
+		return -1;
+	}
+	return 0;
+}
+
+// Choose where modules are placed: 'top' (the default) packs them down from
+// the end of memory, 'bottom' up from the lowest free address.  An optional
+// alignment in bytes (a power of two, default 4096) may follow.
+int method_modplace(char *args)
+{
+	char *place, *align_str;
+	split_string(args, &place, &align_str);
+
+	if(!strcmp(place, "top"))
+		module_place = MODULE_PLACE_TOP;
+	else if(!strcmp(place, "bottom"))
+		module_place = MODULE_PLACE_BOTTOM;
+	else
+	{
+		printf("MODPLACE: invalid placement '%s'\n", place);
+		return -1;
+	}
+
+	if(strcmp(align_str, empty_string))
+	{
+		char *end;
+		uint32_t align = (uint32_t)strtoul(align_str, &end, 0);
+		if((end == align_str) || (align < 4) || (align & (align - 1)))
+		{
+			printf("MODPLACE: invalid alignment '%s'\n", align_str);
+			return -1;
+		}
+		module_align = align;
+	}
+
+	if(mod_count)
+		printf("MODPLACE: only affects modules loaded after it\n");
+
+	// Keep temporary buffers away from where the modules are going
+	chunk_set_scratch_top(module_place != MODULE_PLACE_TOP);
+	return 0;
+}
+
+// Give an uncompressed module its place in the modules region now, so that
+// the prefetcher reads it straight there
+static uint32_t module_reserve(FILE *fp)
+{
+	if(decompress_format(fp) != DECOMP_NONE)
+		return 0;
+	return module_alloc((uint32_t)fp->len);
+}
+
+// Read every kernel and module named between here and the next 'boot' line in
+// one pass, in the order they lie on the card; the lines that follow then
+// load them from memory.  Failing to prefetch only costs the speed up.
+int method_prefetch(char *args)
+{
+	(void)args;
+	char *b = arena_strdup(&transient_arena, cfg_rest);
+	char *line;
+	int count = 0;
+
+	while((line = read_line(&b)))
+	{
+		char *method, *margs, *file, *name;
+		split_string(line, &method, &margs);
+		for(char *l = method; *l; l++)
+			*l = (char)tolower(*l);
+
+		if(!strcmp(method, "boot"))
+			break;
+		if(strcmp(method, "multiboot") && strcmp(method, "kernel") &&
+				strcmp(method, "module"))
+			continue;
+
+		split_string(margs, &file, &name);
+		if(!strcmp(method, "module") && strcmp(name, empty_string))
+			file = name;
+		if(!strcmp(file, empty_string))
+			continue;
+
+		int ret = prefetch_add(file, strcmp(method, "module") ?
+				(void *)0 : module_reserve);
+		if(ret == 0)
+			count++;
+		else
+			printf("PREFETCH: cannot prefetch %s (%i)\n", file, ret);
+	}
+
+	if(count)
+	{
+		int ret = prefetch_run();
+		if(ret != 0)
+		{
+			printf("PREFETCH: failed (%i), loading files normally\n", ret);
+			module_region_trim();
+		}
+	}
+	return 0;
+}
@@ -96,6 +96,27 @@ struct multiboot_arm_functions
 
     // Timer functions
     int (*usleep)(useconds_t usec);
+    uint64_t (*timer_get_ticks)();
+    uint32_t (*timer_get_cycles)();
+    void (*delay_cycles)(uint32_t cycles);
+
+    // Boot log
+    const char *(*get_boot_log)(size_t *len);
+
+    // Formatting
+    int (*snprintf)(char *str, size_t size, const char *format, ...);
+
+    // Whole file loading
+    long (*vfs_load_file)(const char *path, void *dest, size_t max_len);
+
+    // Asynchronous reads
+    int (*aio_submit)(void *ptr, size_t len, FILE *stream);
+    int (*aio_poll)(int handle, size_t *bytes);
+    long (*aio_wait)(int handle);
+
+    // Deadlines
+    int (*register_timer)(struct timer_wait *tw, useconds_t usec);
+    int (*compare_timer)(struct timer_wait *tw);
 };
 
 #endif // __ARMEL__
@@ -0,0 +1,484 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Prefetching
+ *
+ * Loading a config line by line reads its files in config order, so the
+ * card is asked for the kernel, then each module in turn, wherever they
+ * happen to be.  With a 'prefetch' line the rest of the config is scanned
+ * first and each file it loads is mapped to its runs of blocks with
+ * fs->fmap() (prefetch_add()).  The caller may reserve the file's final
+ * place in memory there and then, as is done for uncompressed modules, so
+ * that it is read straight into it.  prefetch_run() lays the other files out
+ * in one staging chunk, in the order they are found on the card, and reads
+ * every run in block order, merging runs which are adjacent on the card and
+ * in memory.  Files which follow each other closely on the card are placed
+ * the same distance apart in the chunk so that they too are read in one
+ * transfer.
+ *
+ * The config is then run as usual; fopen() of a prefetched file returns a
+ * file reading from memory, and prefetch_in_place() tells the caller when
+ * the data is already where it asked for it.  The staging chunk is freed
+ * once every file in it has been opened and closed again, or at the latest
+ * by prefetch_release() before the kernel is started.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "prefetch.h"
+#include "block.h"
+#include "memchunk.h"
+#include "timer.h"
+#include "trace.h"
+#include "verify.h"
+#include "vfs.h"
+#include "fs.h"
+
+struct prefetch_file
+{
+	struct fs fs;		// reads from data; the parent is the file's device
+	char *path;		// as given in the config
+	char *def_dev;		// the default device then, if path names none
+	size_t len;
+	size_t offset;		// of the data in the chunk
+	uint8_t *dst;		// reserved by the caller, or null to stage it
+	uint32_t tail_block;	// partly used last block of a file read into dst
+	const uint8_t *data;
+	int first_run;
+	int run_count;
+	int opens;		// currently open
+	int closed;		// has been read; no longer served from memory
+};
+
+struct prefetch_run
+{
+	struct prefetch_file *file;
+	uint32_t block;
+	size_t file_offset;
+	size_t len;		// whole blocks
+	uint8_t *dst;
+};
+
+static struct prefetch_file files[PREFETCH_MAX_FILES];
+static int file_count = 0;
+static struct prefetch_run runs[PREFETCH_MAX_RUNS];
+static int run_count = 0;
+static int done = 0;
+static uint32_t staging = 0;
+static int staged_left = 0;	// staged files not yet read
+
+static size_t prefetch_fread(struct fs *fs, void *ptr, size_t size, size_t nmemb,
+		FILE *stream)
+{
+	struct prefetch_file *pf = (struct prefetch_file *)fs;
+	size_t len = size * nmemb;
+	memcpy(ptr, &pf->data[stream->pos], len);
+	return len;
+}
+
+static int prefetch_fclose(struct fs *fs, FILE *fp)
+{
+	struct prefetch_file *pf = (struct prefetch_file *)fs;
+	(void)fp;
+
+	if(--pf->opens)
+		return 0;
+	pf->closed = 1;
+	if(!pf->dst && !--staged_left && staging)
+	{
+		TRACE(MULTIBOOT, TRACE_DEBUG, "PREFETCH: all staged files read, freeing "
+				"0x%08x\n", staging);
+		chunk_free(staging);
+		staging = 0;
+	}
+	return 0;
+}
+
+static struct prefetch_file *find_file(const char *path)
+{
+	char *def = vfs_get_default();
+	for(int i = 0; i < file_count; i++)
+	{
+		struct prefetch_file *pf = &files[i];
+		if(pf->closed || strcmp(pf->path, path))
+			continue;
+		if(pf->def_dev && (!def || strcmp(pf->def_dev, def)))
+			continue;
+		return pf;
+	}
+	return (void *)0;
+}
+
+// Phase one: find where a file is.  Files which cannot be mapped are left
+// to be loaded normally.  If reserve is given it is called with the open file
+// and may return an address of at least its length, word aligned, to read
+// it into instead of the staging chunk, or 0.
+int prefetch_add(const char *path, uint32_t (*reserve)(FILE *fp))
+{
+	if(done || find_file(path))
+		return 0;
+	if(file_count == PREFETCH_MAX_FILES)
+		return PREFETCH_ERR_FULL;
+
+	FILE *fp = fopen(path, "r");
+	if(!fp)
+		return PREFETCH_ERR_OPEN;
+	if(fp->verify)
+		verify_cancel(fp);
+
+	struct block_device *dev = fp->fs->parent;
+	if(!fp->fs->fmap || !dev)
+	{
+		fclose(fp);
+		return PREFETCH_ERR_MAP;
+	}
+
+	struct prefetch_file *pf = &files[file_count];
+	memset(pf, 0, sizeof(struct prefetch_file));
+	pf->len = (size_t)fp->len;
+	if(!pf->len)
+	{
+		fclose(fp);
+		return 0;
+	}
+	pf->first_run = run_count;
+
+	size_t mapped_len = pf->len + (dev->block_size - 1);
+	mapped_len -= mapped_len % dev->block_size;
+	size_t offset = 0;
+	int ret = 0;
+	while(offset < mapped_len)
+	{
+		uint32_t block_no;
+		size_t len;
+		if(run_count == PREFETCH_MAX_RUNS)
+		{
+			ret = PREFETCH_ERR_FULL;
+			break;
+		}
+		if((fp->fs->fmap(fp->fs, fp, (long)offset, mapped_len - offset,
+						&block_no, &len) != 0) ||
+				(len < dev->block_size))
+		{
+			ret = PREFETCH_ERR_MAP;
+			break;
+		}
+		len -= len % dev->block_size;
+
+		struct prefetch_run *r = &runs[run_count++];
+		r->file = pf;
+		r->block = block_no;
+		r->file_offset = offset;
+		r->len = len;
+		offset += len;
+	}
+
+	if(ret != 0)
+	{
+		fclose(fp);
+		run_count = pf->first_run;
+		return ret;
+	}
+
+	if(reserve)
+		pf->dst = (uint8_t *)reserve(fp);
+	fclose(fp);
+
+	// Reads are of whole blocks, so the end of a file that does not fill its
+	// last block is read separately rather than past the end of dst
+	if(pf->dst && (pf->len % dev->block_size))
+	{
+		struct prefetch_run *last = &runs[run_count - 1];
+		last->len -= dev->block_size;
+		pf->tail_block = last->block + (uint32_t)(last->len / dev->block_size);
+		if(!last->len)
+			run_count--;
+	}
+
+	pf->fs.parent = dev;
+	pf->fs.fs_name = "prefetch";
+	pf->fs.fread = prefetch_fread;
+	pf->fs.fclose = prefetch_fclose;
+	pf->path = (char *)malloc(strlen(path) + 1);
+	strcpy(pf->path, path);
+	char *def = vfs_get_default();
+	if((path[0] != '(') && def)
+	{
+		pf->def_dev = (char *)malloc(strlen(def) + 1);
+		strcpy(pf->def_dev, def);
+	}
+	pf->run_count = run_count - pf->first_run;
+	file_count++;
+
+	TRACE(BLOCK, TRACE_DEBUG, "PREFETCH: %s: %i bytes in %i run(s)%s\n",
+			path, (int)pf->len, pf->run_count, pf->dst ? " in place" : "");
+	return 0;
+}
+
+// Order by device, then block
+static int run_before(struct prefetch_run *a, struct prefetch_run *b)
+{
+	if(a->file->fs.parent != b->file->fs.parent)
+		return (uint32_t)a->file->fs.parent < (uint32_t)b->file->fs.parent;
+	return a->block < b->block;
+}
+
+static void sort_runs()
+{
+	for(int i = 1; i < run_count; i++)
+	{
+		struct prefetch_run r = runs[i];
+		int j = i;
+		while((j > 0) && run_before(&r, &runs[j - 1]))
+		{
+			runs[j] = runs[j - 1];
+			j--;
+		}
+		runs[j] = r;
+	}
+}
+
+// The gap in bytes from the end of run a to the start of run b on the card,
+// or -1 if b is not a little way after a on the same device
+static long run_gap(struct prefetch_run *a, struct prefetch_run *b)
+{
+	struct block_device *dev = a->file->fs.parent;
+	if(dev != b->file->fs.parent)
+		return -1;
+	uint32_t a_end = a->block + (uint32_t)(a->len / dev->block_size);
+	if((b->block < a_end) ||
+			((size_t)(b->block - a_end) * dev->block_size > PREFETCH_MAX_GAP))
+		return -1;
+	return (long)(b->block - a_end) * (long)dev->block_size;
+}
+
+// Phase two: read everything added, in block order
+int prefetch_run()
+{
+	if(done || !file_count)
+		return 0;
+	done = 1;
+
+	// Lay the staged files out in the order of their first blocks.  A file
+	// which starts just after the previous one ends keeps the same gap in
+	// memory, so the two can be read as one.
+	struct prefetch_file *order[PREFETCH_MAX_FILES];
+	int staged = 0;
+	for(int i = 0; i < file_count; i++)
+	{
+		if(files[i].dst)
+			continue;
+		int j = staged++;
+		while((j > 0) && run_before(&runs[files[i].first_run],
+					&runs[order[j - 1]->first_run]))
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = &files[i];
+	}
+
+	size_t size = 0;
+	for(int i = 0; i < staged; i++)
+	{
+		struct prefetch_file *pf = order[i];
+		long gap = -1;
+		if(i > 0)
+		{
+			struct prefetch_file *prev = order[i - 1];
+			gap = run_gap(&runs[prev->first_run + prev->run_count - 1],
+					&runs[pf->first_run]);
+		}
+		if(gap >= 0)
+			size += (size_t)gap;
+		else
+			size = (size + 0xfff) & ~0xfff;
+		pf->offset = size;
+		struct prefetch_run *last = &runs[pf->first_run + pf->run_count - 1];
+		size += last->file_offset + last->len;
+	}
+
+	// Files without room are dropped and loaded individually later
+	if(staged)
+	{
+		staging = chunk_get_top_chunk((uint32_t)size);
+		if(!staging)
+			printf("PREFETCH: unable to allocate %u bytes, loading files "
+					"individually\n", size);
+	}
+	int kept = 0;
+	for(int i = 0; i < run_count; i++)
+	{
+		struct prefetch_file *pf = runs[i].file;
+		if(pf->dst)
+			runs[i].dst = pf->dst + runs[i].file_offset;
+		else if(staging)
+			runs[i].dst = (uint8_t *)(staging + pf->offset + runs[i].file_offset);
+		else
+			continue;
+		runs[kept++] = runs[i];
+	}
+	run_count = kept;
+	for(int i = 0; i < file_count; i++)
+	{
+		if(files[i].dst)
+			files[i].data = files[i].dst;
+		else if(staging)
+		{
+			files[i].data = (const uint8_t *)(staging + files[i].offset);
+			staged_left++;
+		}
+		else
+			files[i].closed = 1;
+	}
+	sort_runs();
+
+	// Read, merging each run with those which follow it on the card and in
+	// memory.  A gap is only read through between the end of one staged file
+	// and the start of the next, where it lands between their data.
+	uint64_t start = timer_get_ticks();
+	int transfers = 0;
+	size_t bytes = 0;
+	int ret = 0;
+	for(int i = 0; (i < run_count) && (ret == 0); )
+	{
+		struct prefetch_run *r = &runs[i];
+		struct block_device *dev = r->file->fs.parent;
+		size_t len = r->len;
+		int j = i + 1;
+		while(j < run_count)
+		{
+			struct prefetch_run *prev = &runs[j - 1];
+			struct prefetch_run *next = &runs[j];
+			long gap = run_gap(prev, next);
+			if(gap < 0)
+				break;
+			if(gap && (prev->file->dst || next->file->dst ||
+						(prev->file_offset + prev->len < prev->file->len) ||
+						(next->file_offset != 0)))
+				break;
+			if(next->dst != prev->dst + prev->len + gap)
+				break;
+			len += (size_t)gap + next->len;
+			j++;
+		}
+
+		for(size_t off = 0; off < len; off += BLOCK_ASYNC_MAX)
+		{
+			size_t n = len - off;
+			if(n > BLOCK_ASYNC_MAX)
+				n = BLOCK_ASYNC_MAX;
+			ret = block_read_start(dev, &r->dst[off], n,
+					r->block + (uint32_t)(off / dev->block_size));
+			if(ret >= 0)
+				ret = block_read_wait(dev);
+			if(ret < 0)
+				break;
+			transfers++;
+		}
+		bytes += len;
+		i = j;
+	}
+
+	// The ends of files read in place which stop part way through a block
+	for(int i = 0; (i < file_count) && (ret == 0); i++)
+	{
+		struct prefetch_file *pf = &files[i];
+		struct block_device *dev = pf->fs.parent;
+		size_t tail = pf->len % dev->block_size;
+		if(!pf->dst || !tail)
+			continue;
+		uint8_t *buf = (uint8_t *)malloc(dev->block_size);
+		ret = block_read(dev, buf, dev->block_size, pf->tail_block);
+		if(ret >= 0)
+		{
+			memcpy(&pf->dst[pf->len - tail], buf, tail);
+			ret = 0;
+			transfers++;
+			bytes += dev->block_size;
+		}
+		free(buf);
+	}
+	uint32_t elapsed = (uint32_t)(timer_get_ticks() - start);
+
+	if(ret < 0)
+	{
+		printf("PREFETCH: read error %i, loading files individually\n", ret);
+		prefetch_release();
+		return PREFETCH_ERR_READ;
+	}
+
+	TRACE(MULTIBOOT, TRACE_INFO, "PREFETCH: %i file(s), %u bytes in %i run(s), "
+			"%i transfer(s), %u us\n", file_count, bytes, run_count, transfers,
+			elapsed);
+	return 0;
+}
+
+// Free what the prefetched files which have not been read still hold, both
+// the staging chunk and any places reserved for them, and load them normally
+// from now on
+void prefetch_release()
+{
+	if(staging)
+	{
+		chunk_free(staging);
+		staging = 0;
+	}
+	for(int i = 0; i < file_count; i++)
+	{
+		struct prefetch_file *pf = &files[i];
+		if(pf->dst && !pf->closed && !pf->opens)
+			chunk_free((uint32_t)pf->dst);
+		pf->closed = 1;
+	}
+	staged_left = 0;
+}
+
+// The address a file from prefetch_fopen() was read into if the caller
+// reserved it in prefetch_add(), otherwise null
+void *prefetch_in_place(FILE *fp)
+{
+	if(!fp || (fp->fs->fclose != prefetch_fclose))
+		return (void *)0;
+	return ((struct prefetch_file *)fp->fs)->dst;
+}
+
+// Open a file read by prefetch_run().  Returns null if it was not.
+FILE *prefetch_fopen(const char *path, const char *mode)
+{
+	if(!done || (strcmp(mode, "r") && strcmp(mode, "rb")))
+		return (FILE *)0;
+	struct prefetch_file *pf = find_file(path);
+	if(!pf)
+		return (FILE *)0;
+
+	struct vfs_file *ret = (struct vfs_file *)malloc(sizeof(struct vfs_file));
+	memset(ret, 0, sizeof(struct vfs_file));
+	ret->fs = &pf->fs;
+	ret->pos = 0;
+	ret->len = (long)pf->len;
+	ret->opaque = pf;
+	pf->opens++;
+	return ret;
+}
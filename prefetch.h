@@ -0,0 +1,49 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "block.h"
+
+#define PREFETCH_MAX_FILES	64
+#define PREFETCH_MAX_RUNS	1024
+
+// Runs this close together on the card are read as one transfer, along
+// with the blocks between them
+#define PREFETCH_MAX_GAP	0x10000
+
+#define PREFETCH_ERR_OPEN	-1
+#define PREFETCH_ERR_MAP	-2
+#define PREFETCH_ERR_FULL	-3
+#define PREFETCH_ERR_NO_MEMORY	-4
+#define PREFETCH_ERR_READ	-5
+
+int prefetch_add(const char *path, uint32_t (*reserve)(FILE *fp));
+int prefetch_run();
+void prefetch_release();
+FILE *prefetch_fopen(const char *path, const char *mode);
+void *prefetch_in_place(FILE *fp);
+
+#endif
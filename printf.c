@@ -35,6 +35,7 @@
 
 #define putchar putc
 void putc(int c, void *stream);
+int fflush(void *stream);
 
 typedef unsigned long size_t;
 typedef long ssize_t;
@@ -80,8 +81,30 @@ strlen(const char *s)
  * written in the buffer (i.e., the first character of the string).
  * The buffer pointed to by `nbuf' must have length >= MAXNBUF.
  */
+/*
+ * The ARM1176 has no divide instruction, so each / or % is a libgcc call.
+ * Power of two bases are converted with shifts and masks, and decimal two
+ * digits at a time using a reciprocal multiply for the division by 100
+ * (exact for all 32 bit values) and a table of digit pairs.
+ */
+static const char dec_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+#ifdef BENCHMARK
+static int ksprintn_use_div = 0;
+#endif
+
 static char *
-ksprintn(char *nbuf, uintmax_t num, int base, int *lenp, int upper)
+ksprintn_div(char *nbuf, uintmax_t num, int base, int *lenp, int upper)
 {
 	char *p, c;
 
@@ -96,6 +119,62 @@ ksprintn(char *nbuf, uintmax_t num, int base, int *lenp, int upper)
 	return (p);
 }
 
+static char *
+ksprintn(char *nbuf, uintmax_t num, int base, int *lenp, int upper)
+{
+	char *p, c;
+	int shift;
+
+#ifdef BENCHMARK
+	if (ksprintn_use_div)
+		return ksprintn_div(nbuf, num, base, lenp, upper);
+#endif
+
+	switch (base) {
+	case 16:
+		shift = 4;
+		break;
+	case 8:
+		shift = 3;
+		break;
+	case 2:
+		shift = 1;
+		break;
+	case 10:
+		shift = 0;
+		break;
+	default:
+		return ksprintn_div(nbuf, num, base, lenp, upper);
+	}
+
+	p = nbuf;
+	*p = '\0';
+	if (shift) {
+		do {
+			c = hex2ascii(num & (base - 1));
+			*++p = upper ? toupper(c) : c;
+		} while (num >>= shift);
+	} else {
+		u_int n = (u_int)num, q, r;
+
+		while (n >= 100) {
+			q = (u_int)(((unsigned long long)n * 0x51EB851FU) >> 37);
+			r = n - q * 100;
+			*++p = dec_pairs[r * 2 + 1];
+			*++p = dec_pairs[r * 2];
+			n = q;
+		}
+		if (n >= 10) {
+			*++p = dec_pairs[n * 2 + 1];
+			*++p = dec_pairs[n * 2];
+		} else
+			*++p = (char)('0' + n);
+	}
+	if (lenp)
+		*lenp = p - nbuf;
+	return (p);
+}
+
 /*
  * Scaled down version of printf(3).
  *
@@ -434,14 +513,86 @@ number:
 #undef PCHAR
 }
 
-void
+int
 printf(const char *fmt, ...)
 {
 	/* http://www.pagetable.com/?p=298 */
 	va_list ap;
+	int retval;
 
 	va_start(ap, fmt);
-	kvprintf(fmt, putchar, (void*)1, 10, ap);
+	retval = kvprintf(fmt, putchar, (void*)1, 10, ap);
+	va_end(ap);
+
+	fflush((void*)1);
+	return (retval);
+}
+
+struct snprintf_arg {
+	char	*str;
+	size_t	remain;
+};
+
+static void
+snprintf_func(int ch, void *arg)
+{
+	struct snprintf_arg *const info = arg;
+
+	if (info->remain >= 2) {
+		*info->str++ = ch;
+		info->remain--;
+	}
+}
+
+/*
+ * Format into a buffer of the given size, always NUL terminating it if size
+ * is non-zero.  Returns the length the output would have had.
+ */
+int
+vsnprintf(char *str, size_t size, const char *format, va_list ap)
+{
+	struct snprintf_arg info;
+	int retval;
+
+	info.str = str;
+	info.remain = size;
+	retval = kvprintf(format, snprintf_func, &info, 10, ap);
+	if (info.remain >= 1)
+		*info.str++ = '\0';
+	return (retval);
+}
+
+int
+snprintf(char *str, size_t size, const char *format, ...)
+{
+	va_list ap;
+	int retval;
+
+	va_start(ap, format);
+	retval = vsnprintf(str, size, format, ap);
 	va_end(ap);
+	return (retval);
 }
 
+int
+sprintf(char *buf, const char *cfmt, ...)
+{
+	int retval;
+	va_list ap;
+
+	va_start(ap, cfmt);
+	retval = kvprintf(cfmt, NULL, (void *)buf, 10, ap);
+	buf[retval] = '\0';
+	va_end(ap);
+	return (retval);
+}
+
+#ifdef BENCHMARK
+/* Choose plain division for number formatting, for printf_bench() */
+void
+printf_set_divide(int use_div)
+{
+	ksprintn_use_div = use_div;
+}
+#endif
+
@@ -23,20 +23,102 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include "stdio.h"
+#include "string.h"
+#ifdef BENCHMARK
+#include "timer.h"
+#endif
 
 const char lowercase[] = "0123456789abcdef";
 const char uppercase[] = "0123456789abcdef";
 
-int (*stderr_putc)(int c);
-int (*stdout_putc)(int c);
 int (*stream_putc)(int c, FILE *stream);
 
+/* stdout and stderr share a small line buffer which is passed in spans to
+ * each registered output sink when a newline is written, when it fills, on
+ * fflush() and at the end of every printf().
+ */
+#define STDIO_LINE_BUF		128
+#define STDIO_MAX_SINKS		4
+
+static char line_buf[STDIO_LINE_BUF];
+static size_t line_len = 0;
+
+static struct output_sink *sinks[STDIO_MAX_SINKS];
+static int sink_count = 0;
+
+int stdio_add_sink(struct output_sink *sink)
+{
+	if(sink_count == STDIO_MAX_SINKS)
+		return -1;
+	sinks[sink_count++] = sink;
+	return 0;
+}
+
+int stdio_remove_sink(struct output_sink *sink)
+{
+	for(int i = 0; i < sink_count; i++)
+	{
+		if(sinks[i] == sink)
+		{
+			fflush(stdout);
+			for(; i < sink_count - 1; i++)
+				sinks[i] = sinks[i + 1];
+			sink_count--;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int stdio_set_sink_enabled(const char *name, int enabled)
+{
+	for(int i = 0; i < sink_count; i++)
+	{
+		if(!strcmp(sinks[i]->name, name))
+		{
+			sinks[i]->disabled = !enabled;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void stdio_write_sinks(const char *buf, size_t len)
+{
+	for(int i = 0; i < sink_count; i++)
+	{
+		if(!sinks[i]->disabled)
+			sinks[i]->write(buf, len);
+	}
+}
+
+int fflush(FILE *stream)
+{
+	if((stream == stdout) || (stream == stderr))
+	{
+		if(line_len)
+		{
+			// Sinks may themselves produce output (e.g. when setting up the
+			// framebuffer), so hand them a copy and empty the buffer first
+			char buf[STDIO_LINE_BUF];
+			size_t len = line_len;
+			memcpy(buf, line_buf, len);
+			line_len = 0;
+			stdio_write_sinks(buf, len);
+		}
+	}
+	return 0;
+}
+
 int fputc(int c, FILE *stream)
 {
-	if(stream == stdout)
-		return stdout_putc(c);
-	else if(stream == stderr)
-		return stderr_putc(c);
+	if((stream == stdout) || (stream == stderr))
+	{
+		line_buf[line_len++] = (char)c;
+		if((c == '\n') || (line_len == STDIO_LINE_BUF))
+			fflush(stream);
+		return c;
+	}
 	else
 		return stream_putc(c, stream);
 }
@@ -53,6 +135,29 @@ int putchar(int c)
 
 int fputs(const char *s, FILE *stream)
 {
+	if((stream == stdout) || (stream == stderr))
+	{
+		// Pass whole lines straight to the sinks
+		while(*s)
+		{
+			const char *nl = s;
+			while(*nl && (*nl != '\n'))
+				nl++;
+			if(*nl == '\n')
+			{
+				fflush(stream);
+				stdio_write_sinks(s, (size_t)(nl - s + 1));
+				s = nl + 1;
+			}
+			else
+			{
+				while(*s)
+					fputc(*s++, stream);
+			}
+		}
+		return 0;
+	}
+
 	while(*s)
 		fputc(*s++, stream);
 	return 0;
@@ -67,8 +172,11 @@ int puts(const char *s)
 
 void puthex(uint32_t val)
 {
-	for(int i = 7; i >= 0; i--)
-		putchar(lowercase[(val >> (i * 4)) & 0xf]);
+	char buf[9];
+	for(int i = 0; i < 8; i++)
+		buf[i] = lowercase[(val >> ((7 - i) * 4)) & 0xf];
+	buf[8] = 0;
+	fputs(buf, stdout);
 }
 
 void putval(uint32_t val, int base, char *dest, int dest_size, int dest_start, int padding, char *case_str)
@@ -81,230 +189,50 @@ void putval(uint32_t val, int base, char *dest, int dest_size, int dest_start, i
 	for(i = 0; i < padding; i++)
 		dest[i + dest_start] = '0';
 
+	// Avoid division for power of two bases
+	int shift = 0;
+	if((base & (base - 1)) == 0)
+	{
+		while((1 << shift) < base)
+			shift++;
+	}
+
 	i = 0;
 	while((val != 0) && (i < (dest_size - dest_start)))
 	{
-		uint32_t digit = val % base;
+		uint32_t digit = shift ? (val & (uint32_t)(base - 1)) : (val % base);
 		dest[dest_size - i - 1 + dest_start] = case_str[digit];
 		i++;
-		val /= base;
+		val = shift ? (val >> shift) : (val / base);
 	}
 }
 
-#define __O_WRITE(c) { s[o] = c; if(++o >= (int)n) return o; }
+#ifdef BENCHMARK
+#define PRINTF_BENCH_ITERATIONS	2000
 
-#if 0
-int vsnprintf(char *s, size_t n, const char *format, va_list arg)
+static uint32_t printf_bench_run()
 {
-	int reading_escape = 0;
-	int reading_field = 0;
-	int escape_start = -1;
-	int field_start = -1;
-
-	int i = 0;
-	int o = 0;
-
-	while(format[i])
-	{
-		if(reading_escape)
-		{
-			switch(format[i])
-			{
-				case '\\':
-				case 'n':
-				case 't':
-					__O_WRITE('\\');
-					__O_WRITE(format[i]);
-					i++;
-					reading_escape = 0;
-					continue;
-			}
-
-		}
-		else
-		{
-			if(format[i] == '%')
-			{
-				int alt_form = 0;
-				int zero_pad = 0;
-				int left_adj = 0;
-				int leave_space = 0;
-				int always_sign = 0;
-				
-				reading_field = 1;
-				field_start = i;
-
-				i++;
-
-				if(format[i] == '#')
-				{
-					alt_form = 1;
-					i++;
-				}
-				if(format[i] == '0')
-				{
-					zero_pad = 1;
-					i++;
-				}
-				if(format[i] == '-')
-				{
-					left_adj = 1;
-					i++;
-				}
-				if(format[i] == ' ')
-				{
-					leave_space = 1;
-					i++;
-				}
-				if(format[i] == '+')
-				{
-					always_sign = 1;
-					i++;
-				}
-
-				// Read field width
-				int field_width_start = i;
-				while((format[i] >= '0') && (format[i] <= '9'))
-					i++;
-				int field_width_end = i;
-
-				int field_width = -1;
+	char buf[64];
+	uint64_t start = timer_get_ticks();
 
-				if(field_width_start != field_width_end)
-				{
-					int field_width_base = 1;
-					field_width = 0;
-
-					for(int j = field_width_end - 1; j >= field_width_start; j++)
-					{
-						field_width += field_width_base * (format[j] - '0');
-						field_width_base *= 10;
-					}
-				}
-
-				// Read precision
-				int precision = -1;
-				if(format[i] == '.')
-				{
-					int precision_negative = 0;
-					i++;
-					if(format[i] == '-')
-					{
-						precision_negative = 1;
-						i++;
-					}
-					int precision_start = i;
-					while((format[i] >= '0') && (format[i] <= '9'))
-						i++;
-					int precision_end = i;
-
-					if(precision_start != precision_end)
-					{
-						int precision_base = 1;
-						precision = 0;
-
-						for(int j = precision_end - 1; j >= precision_start; j++)
-						{
-							precision += precision_base * (format[j] - '0');
-							precision_base *= 10;
-						}
-
-						if(precision_negative)
-							precision = -precision;
-					}
-				}
-
-				// Read length modifier
-				int length = 0;
-
-#define __L_HH	1
-#define __L_H	2
-#define __L_L	3
-#define __L_LL	4
-#define __L_LD	5
-#define __L_J	6
-#define __L_Z	7
-#define __L_T	8
-
-				if(format[i] == 'h')
-				{
-					i++;
-					if(format[i] == 'h')
-					{
-						length = __L_HH;
-						i++;
-					}
-					else
-						length = __L_H;
-				}
-				else if(format[i] == 'l')
-				{
-					i++;
-					if(format[i] == 'l')
-					{
-						length = __L_LL;
-						i++;
-					}
-					else
-						length = __L_L;
-				}
-				else if(format[i] == 'L')
-				{
-					i++;
-					length = __L_LD;
-				}
-				else if(format[i] == 'q')
-				{
-					i++;
-					length = __L_LL;
-				}
-				else if(format[i] == 'j')
-				{
-					i++;
-					length = __L_J;
-				}
-				else if(format[i] == 'z')
-				{
-					i++;
-					length = __L_Z;
-				}
-				else if(format[i] == 't')
-				{
-					i++;
-					length = __L_T;
-				}
-
-				// read conversion specifier
-				char conv = format[i];
-				i++;
-
-				
-				
-				continue;
-			}
-			else if(format[i] == '\\')
-			{
-				reading_escape = 1;
-				escape_start = i;
-				i++;
-				continue;
-			}
-			else
-			{
-				__O_WRITE(format[i]);
-				i++;
-				continue;
-			}
-		}
-	}
-
-	return o;
+	for(int i = 0; i < PRINTF_BENCH_ITERATIONS; i++)
+		snprintf(buf, sizeof(buf), "%u %i %x %08x", 123456789U * i, -i * 7919,
+				0xdeadbeefU ^ i, i);
+	return (uint32_t)(timer_get_ticks() - start);
 }
 
-int snprintf(char *str, size_t size, const char *format, ...)
+// Compare the shift/reciprocal number formatting in printf.c with plain
+// division
+void printf_bench(void)
 {
-	
+	printf_set_divide(1);
+	uint32_t slow = printf_bench_run();
+	printf_set_divide(0);
+	uint32_t fast = printf_bench_run();
+
+	printf("PRINTF: benchmark %i snprintf calls with 4 conversions\n",
+			PRINTF_BENCH_ITERATIONS);
+	printf("PRINTF:  divide:     %u us\n", slow);
+	printf("PRINTF:  shift/mul:  %u us\n", fast);
 }
-
 #endif
-
@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdarg.h>
 
 // Include vfs.h to get the FILE definition
 #include "vfs.h"
@@ -32,6 +33,19 @@
 #define stdout ((FILE *)1)
 #define stderr ((FILE *)2)
 
+// A destination for stdout/stderr output
+struct output_sink
+{
+	const char *name;
+	int (*write)(const char *buf, size_t len);
+	int disabled;
+};
+
+int stdio_add_sink(struct output_sink *sink);
+int stdio_remove_sink(struct output_sink *sink);
+int stdio_set_sink_enabled(const char *name, int enabled);
+
+int fflush(FILE *stream);
 int fputc(int c, FILE *stream);
 int fputs(const char *, FILE *stream);
 int putc(int c, FILE *stream);
@@ -42,8 +56,14 @@ int printf(const char *format, ...);
 int fprintf(FILE *stream, const char *format, ...);
 int sprintf(char *str, const char *format, ...);
 int snprintf(char *str, size_t size, const char *format, ...);
+int vsnprintf(char *str, size_t size, const char *format, va_list ap);
 
 void puthex(uint32_t val);
 
+#ifdef BENCHMARK
+void printf_bench(void);
+void printf_set_divide(int use_div);
+#endif
+
 #endif
 
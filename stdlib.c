@@ -23,6 +23,8 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "console.h"
+#include "uart.h"
 
 int errno;
 
@@ -51,8 +53,12 @@ void *memset(void *s, int c, size_t n)
 
 void abort(void)
 {
+	uart_sync_mode();
 	fputs("abort() called", stdout);
 	fputs("abort() called", stderr);
+	fflush(stdout);
+	console_start();
+	console_flush();
 
 	while(1);
 }
@@ -109,11 +115,55 @@ int strcmp(const char *s1, const char *s2)
 
 int raise(int sig)
 {
+    uart_sync_mode();
     printf("ERROR: signal %i raised.  Halted.\n", sig);
+    console_start();
+    console_flush();
     while(1);
     return 0;
 }
 
+unsigned long strtoul(const char *nptr, char **endptr, int base)
+{
+	unsigned long ret = 0;
+
+	while((*nptr == ' ') || (*nptr == '\t'))
+		nptr++;
+
+	if(((base == 0) || (base == 16)) && (nptr[0] == '0') &&
+			((nptr[1] == 'x') || (nptr[1] == 'X')))
+	{
+		nptr += 2;
+		base = 16;
+	}
+	else if((base == 0) && (nptr[0] == '0'))
+		base = 8;
+	else if(base == 0)
+		base = 10;
+
+	while(*nptr)
+	{
+		int digit;
+		if((*nptr >= '0') && (*nptr <= '9'))
+			digit = *nptr - '0';
+		else if((*nptr >= 'a') && (*nptr <= 'z'))
+			digit = *nptr - 'a' + 10;
+		else if((*nptr >= 'A') && (*nptr <= 'Z'))
+			digit = *nptr - 'A' + 10;
+		else
+			break;
+		if(digit >= base)
+			break;
+
+		ret = ret * (unsigned long)base + (unsigned long)digit;
+		nptr++;
+	}
+
+	if(endptr)
+		*endptr = (char *)nptr;
+	return ret;
+}
+
 int tolower(int c)
 {
 	if((c >= 'A') && (c <= 'Z'))
@@ -27,6 +27,7 @@
 void abort(void);
 void *malloc(size_t size);
 void free(void *ptr);
+unsigned long strtoul(const char *nptr, char **endptr, int base);
 
 #endif
 
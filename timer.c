@@ -23,48 +23,103 @@
 #include "mmio.h"
 #include <errno.h>
 #include <stdint.h>
-#include <stdlib.h>
 
 #define TIMER_CLO		0x20003004
+#define TIMER_CHI		0x20003008
 
-int usleep(useconds_t usec)
+// ARM1176 performance monitor control register bits
+#define PMNC_ENABLE		(1 << 0)
+#define PMNC_RESET_CCNT		(1 << 2)
+
+// Set if the cycle counter is usable (it reads as zero under some emulators)
+static int ccnt_available = 0;
+
+static inline uint32_t read_ccnt()
 {
-	struct timer_wait *tw = register_timer(usec);
-	while(!compare_timer(tw));
-    free(tw);
-	return 0;	
+	uint32_t ccnt;
+	asm volatile("mrc p15, 0, %[ccnt], c15, c12, 1" : [ccnt]"=r"(ccnt));
+	return ccnt;
 }
 
-struct timer_wait *register_timer(useconds_t usec)
+void timer_init()
 {
-	if(usec < 0)
+	// Enable the cycle counter
+	uint32_t pmnc = PMNC_ENABLE | PMNC_RESET_CCNT;
+	asm volatile("mcr p15, 0, %[pmnc], c15, c12, 0" : : [pmnc]"r"(pmnc));
+
+	// Check it is actually counting
+	uint32_t start = read_ccnt();
+	for(volatile int i = 0; i < 16; i++);
+	ccnt_available = (read_ccnt() != start);
+}
+
+// Returns the 64-bit free running microsecond counter of the system timer
+//
+// This is fenced on both sides so it can be freely mixed with relaxed accesses
+// to other peripherals, e.g. within TIMEOUT_WAIT
+uint64_t timer_get_ticks()
+{
+	mmio_barrier();
+	uint32_t hi = mmio_read_relaxed(TIMER_CHI);
+	uint32_t lo = mmio_read_relaxed(TIMER_CLO);
+	uint32_t hi2 = mmio_read_relaxed(TIMER_CHI);
+
+	// If CLO rolled over between the reads then CHI has changed - the
+	// second read of CHI matches a fresh read of CLO
+	if(hi != hi2)
+		lo = mmio_read_relaxed(TIMER_CLO);
+	mmio_barrier();
+
+	return ((uint64_t)hi2 << 32) | (uint64_t)lo;
+}
+
+// Returns the ARM cycle counter, or 0 if it is unavailable
+uint32_t timer_get_cycles()
+{
+	if(!ccnt_available)
+		return 0;
+	return read_ccnt();
+}
+
+// Busy wait for the given number of ARM cycles
+void delay_cycles(uint32_t cycles)
+{
+	if(ccnt_available)
 	{
-		errno = EINVAL;
-		return (void*)0;
+		uint32_t start = read_ccnt();
+		while((read_ccnt() - start) < cycles);
 	}
-	uint32_t cur_timer = mmio_read(TIMER_CLO);
-	uint32_t trig = cur_timer + (uint32_t)usec;
-	struct timer_wait *tw = malloc(sizeof(struct timer_wait));
-	tw->trigger_value = trig;
-	if(trig > cur_timer)
-		tw->rollover = 0;
 	else
-		tw->rollover = 1;
-	return tw;
+	{
+		// Fall back to a loop of roughly two cycles per iteration
+		uint32_t count = (cycles >> 1) + 1;
+		asm volatile("__delay_%=: subs %[count], %[count], #1; bne __delay_%=\n"
+				: [count]"+r"(count) : : "cc");
+	}
 }
 
-int compare_timer(struct timer_wait *tw)
+int usleep(useconds_t usec)
 {
-	uint32_t cur_timer = mmio_read(TIMER_CLO);
+	struct timer_wait tw;
+	if(register_timer(&tw, usec) != 0)
+		return -1;
+	while(!compare_timer(&tw));
+	return 0;	
+}
 
-	if(cur_timer < tw->trigger_value)
+int register_timer(struct timer_wait *tw, useconds_t usec)
+{
+	tw->trigger_value = timer_get_ticks();
+	if(usec < 0)
 	{
-		if(tw->rollover)
-			tw->rollover = 0;
+		errno = EINVAL;
+		return -1;
 	}
-	else if(!tw->rollover)
-		return 1;
-
+	tw->trigger_value += (uint64_t)usec;
 	return 0;
 }
 
+int compare_timer(struct timer_wait *tw)
+{
+	return timer_get_ticks() >= tw->trigger_value;
+}
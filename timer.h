@@ -22,31 +22,35 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include <stdlib.h>
 #include <stdint.h>
 
 typedef int useconds_t;
 
+// A deadline.  These are cheap to set up and are intended to live on the
+// caller's stack.
 struct timer_wait
 {
-	uint32_t trigger_value;
-	int rollover;
+	uint64_t trigger_value;
 };
 
+void timer_init();
+uint64_t timer_get_ticks();
+uint32_t timer_get_cycles();
+void delay_cycles(uint32_t cycles);
+
 int usleep(useconds_t usec);
-struct timer_wait *register_timer(useconds_t usec);
+int register_timer(struct timer_wait *tw, useconds_t usec);
 int compare_timer(struct timer_wait *tw);
 
 #define TIMEOUT_WAIT(stop_if_true, usec) 		\
 do {							\
-	struct timer_wait *tw = register_timer(usec);	\
+	struct timer_wait timeout_tw;			\
+	register_timer(&timeout_tw, usec);		\
 	do						\
 	{						\
 		if(stop_if_true)			\
 			break;				\
-	} while(!compare_timer(tw));			\
-	free(tw);					\
-} while(0);
+	} while(!compare_timer(&timeout_tw));		\
+} while(0)
 
 #endif
-
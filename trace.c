@@ -0,0 +1,136 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "trace.h"
+#include "timer.h"
+
+#define TRACE_RING_SIZE		256	// records, must be a power of 2
+
+// The run time levels start below the compile time ceiling so that a normal
+// boot only prints its own messages and errors.  The info sites are still
+// compiled in and can be turned on with a 'trace' config line.
+#ifdef DEBUG2
+#define TRACE_DEFAULT_LEVEL	TRACE_DEBUG
+#elif defined(DEBUG)
+#define TRACE_DEFAULT_LEVEL	TRACE_INFO
+#else
+#define TRACE_DEFAULT_LEVEL	TRACE_ERROR
+#endif
+
+struct trace_record
+{
+	uint32_t timestamp;
+	uint32_t ev;
+	uint32_t a;
+	uint32_t b;
+};
+
+static const char *subsystem_names[TRACE_SS_COUNT] =
+{
+	"cfg", "multiboot", "emmc", "block", "mbr", "fat", "ext2", "dma"
+};
+
+static const char *event_names[TRACE_EV_COUNT] =
+{
+	"block_read", "emmc_read", "emmc_done", "emmc_cmd", "fat_cluster",
+	"elf_read"
+};
+
+uint8_t trace_levels[TRACE_SS_COUNT] =
+{
+	TRACE_DEFAULT_LEVEL, TRACE_DEFAULT_LEVEL, TRACE_DEFAULT_LEVEL,
+	TRACE_DEFAULT_LEVEL, TRACE_DEFAULT_LEVEL, TRACE_DEFAULT_LEVEL,
+	TRACE_DEFAULT_LEVEL, TRACE_DEFAULT_LEVEL
+};
+
+int trace_binary = 0;
+
+static struct trace_record trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head = 0;		// total records written
+
+void trace_event(uint32_t ev, uint32_t a, uint32_t b)
+{
+	uint32_t timestamp = (uint32_t)timer_get_ticks();
+
+	if(!trace_binary)
+	{
+		printf("trace: %u %s %08x %08x\n", timestamp,
+				(ev < TRACE_EV_COUNT) ? event_names[ev] : "?", a, b);
+		return;
+	}
+
+	struct trace_record *r = &trace_ring[trace_head & (TRACE_RING_SIZE - 1)];
+	r->timestamp = timestamp;
+	r->ev = ev;
+	r->a = a;
+	r->b = b;
+	trace_head++;
+}
+
+// Set the run time level of a subsystem, or of all of them if subsystem is
+// "all".  Returns -1 if the subsystem is unknown.
+int trace_set_level(const char *subsystem, int level)
+{
+	if(level < TRACE_NONE)
+		level = TRACE_NONE;
+	if(level > TRACE_DEBUG)
+		level = TRACE_DEBUG;
+
+	if(!strcmp(subsystem, "all"))
+	{
+		for(int i = 0; i < TRACE_SS_COUNT; i++)
+			trace_levels[i] = (uint8_t)level;
+		return 0;
+	}
+
+	for(int i = 0; i < TRACE_SS_COUNT; i++)
+	{
+		if(!strcmp(subsystem, subsystem_names[i]))
+		{
+			trace_levels[i] = (uint8_t)level;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Print the contents of the binary trace ring, oldest first
+void trace_dump()
+{
+	uint32_t count = trace_head;
+	uint32_t start = 0;
+	if(count > TRACE_RING_SIZE)
+	{
+		start = count - TRACE_RING_SIZE;
+		printf("trace: %u older records lost\n", start);
+	}
+
+	for(uint32_t i = start; i < count; i++)
+	{
+		struct trace_record *r = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+		printf("trace: %u %s %08x %08x\n", r->timestamp,
+				(r->ev < TRACE_EV_COUNT) ? event_names[r->ev] : "?",
+				r->a, r->b);
+	}
+}
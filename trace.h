@@ -0,0 +1,132 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Tracing
+ *
+ * Each trace site belongs to a subsystem and has a level.  A site is only
+ * compiled in if its level is at or below the subsystem's compile time
+ * ceiling (TRACE_LEVEL_<subsystem>, which can be overridden on the command
+ * line); otherwise the condition is a constant 0 and the site disappears.
+ * Compiled in sites are further filtered at run time by trace_levels[],
+ * which costs one byte load and compare per site.
+ *
+ * TRACE() formats text through printf.  TRACE_EVENT() records a fixed size
+ * (timestamp, event, arg, arg) entry in a ring buffer when binary mode is
+ * enabled and only formats it when the ring is dumped, so it is cheap enough
+ * to leave in hot paths such as block reads.  Event sites have their own
+ * compile time ceiling, TRACE_EVENT_CEILING, which keeps them all by
+ * default.  In binary mode they are recorded whatever the run time level;
+ * in text mode they are printed like TRACE() sites.
+ */
+
+#define TRACE_NONE		0
+#define TRACE_ERROR		1
+#define TRACE_INFO		2
+#define TRACE_DEBUG		3
+
+// Subsystems
+#define TRACE_SS_CFG		0
+#define TRACE_SS_MULTIBOOT	1
+#define TRACE_SS_EMMC		2
+#define TRACE_SS_BLOCK		3
+#define TRACE_SS_MBR		4
+#define TRACE_SS_FAT		5
+#define TRACE_SS_EXT2		6
+#define TRACE_SS_DMA		7
+#define TRACE_SS_COUNT		8
+
+// Compile time ceilings
+#ifdef DEBUG2
+#define TRACE_DEFAULT_CEILING	TRACE_DEBUG
+#else
+#define TRACE_DEFAULT_CEILING	TRACE_INFO
+#endif
+
+#ifndef TRACE_EVENT_CEILING
+#define TRACE_EVENT_CEILING	TRACE_DEBUG
+#endif
+
+#ifndef TRACE_LEVEL_CFG
+#define TRACE_LEVEL_CFG		TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_MULTIBOOT
+#define TRACE_LEVEL_MULTIBOOT	TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_EMMC
+#define TRACE_LEVEL_EMMC	TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_BLOCK
+#define TRACE_LEVEL_BLOCK	TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_MBR
+#define TRACE_LEVEL_MBR		TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_FAT
+#define TRACE_LEVEL_FAT		TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_EXT2
+#define TRACE_LEVEL_EXT2	TRACE_DEFAULT_CEILING
+#endif
+#ifndef TRACE_LEVEL_DMA
+#define TRACE_LEVEL_DMA		TRACE_DEFAULT_CEILING
+#endif
+
+// Binary trace events
+#define TRACE_EV_BLOCK_READ	0	// block number, byte count
+#define TRACE_EV_EMMC_READ	1	// block number, block count
+#define TRACE_EV_EMMC_DONE	2	// block number, interrupt register
+#define TRACE_EV_EMMC_CMD	3	// command index, response
+#define TRACE_EV_FAT_CLUSTER	4	// cluster, sector
+#define TRACE_EV_ELF_READ	5	// file offset, length
+#define TRACE_EV_COUNT		6
+
+extern uint8_t trace_levels[TRACE_SS_COUNT];
+extern int trace_binary;
+
+#define TRACE_ON(ss, lvl) (((lvl) <= TRACE_LEVEL_##ss) && \
+		((lvl) <= trace_levels[TRACE_SS_##ss]))
+
+#define TRACE(ss, lvl, ...)						\
+do {									\
+	if(TRACE_ON(ss, lvl))						\
+		printf(__VA_ARGS__);					\
+} while(0)
+
+#define TRACE_EVENT_ON(ss, lvl) (((lvl) <= TRACE_EVENT_CEILING) && \
+		(trace_binary || ((lvl) <= trace_levels[TRACE_SS_##ss])))
+
+#define TRACE_EVENT(ss, lvl, ev, a, b)					\
+do {									\
+	if(TRACE_EVENT_ON(ss, lvl))					\
+		trace_event(TRACE_EV_##ev, (uint32_t)(a), (uint32_t)(b));	\
+} while(0)
+
+void trace_event(uint32_t ev, uint32_t a, uint32_t b);
+int trace_set_level(const char *subsystem, int level);
+void trace_dump();
+
+#endif
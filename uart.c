@@ -22,6 +22,9 @@
 #include <stdint.h>
 #include "mmio.h"
 #include "uart.h"
+#include "timer.h"
+#include "dma.h"
+#include "clock.h"
 
 #define GPIO_BASE 			0x20200000
 #define GPPUD 				(GPIO_BASE + 0x94)
@@ -46,10 +49,187 @@
 #define UART0_ITOP			(UART0_BASE + 0x88)
 #define UART0_TDR			(UART0_BASE + 0x8C)
 
-// delay function
-static void delay(int32_t count)
+#define UART_FR_BUSY			(1 << 3)
+#define UART_FR_TXFF			(1 << 5)
+#define UART_DMACR_TXDMAE		(1 << 1)
+
+/* Transmit buffering
+ *
+ * Output is placed in a ring buffer and drained to the UART by a DMA channel
+ * paced by the UART TX DREQ, so the CPU does not wait for the line.  There
+ * are no interrupts in the loader, so the ring is pumped each time a
+ * character is written: if the previous DMA transfer has completed, the
+ * next contiguous run of the ring is started.
+ *
+ * The DMA engine writes a whole word to the data register per transfer, so
+ * each character occupies a word in the ring.
+ *
+ * If the ring fills, the writer pumps it until the DMA engine makes room,
+ * which at worst takes as long as sending the whole ring.  Characters are
+ * only dropped if the engine has stopped draining it for
+ * UART_FLUSH_TIMEOUT, and the number lost is reported once space is
+ * available.  uart_sync_mode() flushes the ring and switches
+ * to synchronous, lossless output; it is used before handing over to the
+ * kernel and when halting on an error.  If no DMA channel is available
+ * output is always synchronous.
+ */
+
+#define UART_RING_SIZE			4096		// characters, must be a power of 2
+#define UART_FLUSH_TIMEOUT		2000000
+
+static uint32_t tx_ring[UART_RING_SIZE] __attribute__((aligned(32)));
+static volatile uint32_t tx_head = 0;		// next free slot
+static volatile uint32_t tx_tail = 0;		// first slot not yet completed
+static uint32_t tx_dma_len = 0;			// length of the transfer in progress
+static uint32_t tx_dropped = 0;
+static int tx_stalled = 0;			// timed out waiting for room
+static int tx_chan = DMA_ERR_NO_CHANNEL;
+static int tx_sync = 1;
+static struct dma_cb tx_cb;
+
+static uint32_t uart_baud = UART_DEFAULT_BAUD;
+
+static void uart_putc_sync(int byte)
+{
+	mmio_barrier();
+	while(mmio_read_relaxed(UART0_FR) & UART_FR_TXFF);
+	mmio_write_relaxed(UART0_DR, (uint8_t)(byte & 0xff));
+	mmio_barrier();
+}
+
+// Retire a completed transfer and start the next one
+static void uart_pump()
+{
+	if(tx_dma_len)
+	{
+		if(dma_busy(tx_chan))
+			return;
+		dma_wait(tx_chan, 0);
+		tx_tail = (tx_tail + tx_dma_len) & (UART_RING_SIZE - 1);
+		tx_dma_len = 0;
+	}
+
+	if(tx_head == tx_tail)
+		return;
+
+	// Send up to the end of the ring, the rest goes next time
+	uint32_t len = (tx_head > tx_tail) ? (tx_head - tx_tail) : (UART_RING_SIZE - tx_tail);
+
+	tx_cb.ti = DMA_TI_SRC_INC | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_DREQ_UART_TX) |
+		DMA_TI_WAIT_RESP;
+	tx_cb.source_ad = DMA_BUS_ADDR(&tx_ring[tx_tail]);
+	tx_cb.dest_ad = DMA_PERIPH_BUS_ADDR(UART0_DR);
+	tx_cb.txfr_len = len * 4;
+	tx_cb.stride = 0;
+	tx_cb.nextconbk = 0;
+
+	tx_dma_len = len;
+	dma_start(tx_chan, &tx_cb);
+}
+
+// Build the message reporting dropped characters
+static const char *dropped_msg(char *buf)
+{
+	char digits[12];
+	int n = 0;
+	uint32_t v = tx_dropped;
+	do
+	{
+		digits[n++] = (char)('0' + (v % 10));
+		v /= 10;
+	} while(v);
+
+	const char *pre = "\n[uart: ";
+	const char *post = " characters dropped]\n";
+	char *p = buf;
+	while(*pre)
+		*p++ = *pre++;
+	while(n)
+		*p++ = digits[--n];
+	while(*post)
+		*p++ = *post++;
+	*p = 0;
+
+	tx_dropped = 0;
+	return buf;
+}
+
+static void uart_enqueue(int byte)
+{
+	uint32_t next = (tx_head + 1) & (UART_RING_SIZE - 1);
+	if(next == tx_tail)
+	{
+		// Wait for room, but not again once the DMA engine has stalled
+		struct timer_wait tw;
+		register_timer(&tw, tx_stalled ? 0 : UART_FLUSH_TIMEOUT);
+		do
+		{
+			uart_pump();
+			if((next == tx_tail) && compare_timer(&tw))
+			{
+				tx_stalled = 1;
+				tx_dropped++;
+				return;
+			}
+		} while(next == tx_tail);
+	}
+	tx_stalled = 0;
+	tx_ring[tx_head] = (uint8_t)(byte & 0xff);
+	tx_head = next;
+}
+
+// Wait for everything buffered to be sent.  Returns 0 on success.
+int uart_flush()
+{
+	if(!tx_sync)
+	{
+		struct timer_wait tw;
+		register_timer(&tw, UART_FLUSH_TIMEOUT);
+		while(tx_dma_len || (tx_head != tx_tail))
+		{
+			uart_pump();
+			if(compare_timer(&tw))
+				return -1;
+		}
+	}
+
+	TIMEOUT_WAIT(!(mmio_read_relaxed(UART0_FR) & UART_FR_BUSY), UART_FLUSH_TIMEOUT);
+	mmio_barrier();
+	return 0;
+}
+
+// Flush and then write all further output synchronously
+void uart_sync_mode()
 {
-	asm volatile("__delay_%=: subs %[count], %[count], #1; bne __delay_%=\n" : : [count]"r"(count) : "cc");
+	if(tx_sync)
+		return;
+
+	if(uart_flush() != 0)
+	{
+		// The DMA engine has stopped draining the ring: abandon it
+		tx_head = tx_tail;
+		tx_dma_len = 0;
+	}
+	tx_sync = 1;
+	mmio_write(UART0_DMACR, 0);
+
+	if(tx_dropped)
+	{
+		char buf[48];
+		uart_puts(dropped_msg(buf));
+	}
+}
+
+static void uart_set_divisor()
+{
+	// The divisor is clock / (16 * baud) as a 16.6 fixed point value
+	uint32_t clk = clock_get_rate(CLOCK_UART);
+	if(!clk)
+		clk = UART_DEFAULT_CLOCK;
+	uint32_t div = (uint32_t)(((uint64_t)clk * 4 + uart_baud / 2) / uart_baud);
+
+	mmio_write(UART0_IBRD, div >> 6);
+	mmio_write(UART0_FBRD, div & 0x3f);
 }
 
 void uart_init()
@@ -57,17 +237,16 @@ void uart_init()
 	mmio_write(UART0_CR, 0x0);
 
 	mmio_write(GPPUD, 0x0);
-	delay(150);
+	delay_cycles(150);
 
 	mmio_write(GPPUDCLK0, (1 << 14) | (1 << 15));
-	delay(150);
+	delay_cycles(150);
 
 	mmio_write(GPPUDCLK0, 0x0);
 
 	mmio_write(UART0_ICR, 0x7ff);
 
-	mmio_write(UART0_IBRD, 1);
-	mmio_write(UART0_FBRD, 40);
+	uart_set_divisor();
 
 	mmio_write(UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
 
@@ -75,18 +254,80 @@ void uart_init()
 				(1 << 8) | (1 << 9) | (1 << 10));
 
 	mmio_write(UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
+
+	// Set up buffered transmit
+	if(tx_chan < 0)
+		tx_chan = dma_alloc_channel(0);
+	if(tx_chan >= 0)
+	{
+		mmio_write(UART0_DMACR, UART_DMACR_TXDMAE);
+		tx_sync = 0;
+	}
+}
+
+// Change the baud rate, waiting for pending output to be sent first
+int uart_set_baud(uint32_t baud)
+{
+	if((baud < 300) || (baud > 4000000))
+		return -1;
+
+	uart_flush();
+	uart_baud = baud;
+
+	uint32_t cr = mmio_read(UART0_CR);
+	mmio_write(UART0_CR, 0);
+	uart_set_divisor();
+	// The divisor is only latched by a write to LCRH
+	mmio_write(UART0_LCRH, mmio_read(UART0_LCRH));
+	mmio_write(UART0_CR, cr);
+	return 0;
+}
+
+// Report lost output once there is room again
+static void uart_report_dropped()
+{
+	if(tx_dropped && (((tx_tail - tx_head - 1) & (UART_RING_SIZE - 1)) > 64))
+	{
+		char buf[48];
+		const char *msg = dropped_msg(buf);
+		while(*msg)
+			uart_enqueue(*msg++);
+	}
 }
 
 int uart_putc(int byte)
 {
-	while(1) {
-		if (!(mmio_read(UART0_FR) & (1 << 5)))
-			break;
+	if(tx_sync)
+	{
+		uart_putc_sync(byte);
+		return byte;
 	}
-	mmio_write(UART0_DR, (uint8_t)(byte & 0xff));
+
+	uart_report_dropped();
+	uart_enqueue(byte);
+	uart_pump();
 	return byte;
 }
 
+// Bulk write, used as an output sink
+int uart_write(const char *buf, size_t len)
+{
+	if(tx_sync)
+	{
+		for(size_t i = 0; i < len; i++)
+			uart_putc_sync(buf[i]);
+		return (int)len;
+	}
+
+	uart_report_dropped();
+	for(size_t i = 0; i < len; i++)
+	{
+		uart_enqueue(buf[i]);
+		uart_pump();
+	}
+	return (int)len;
+}
+
 void uart_puts(const char *str)
 {
 	while(*str)
@@ -23,10 +23,22 @@
 #define UART_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#ifndef UART_DEFAULT_BAUD
+#define UART_DEFAULT_BAUD	115200
+#endif
+
+// UART reference clock assumed if the firmware cannot tell us
+#define UART_DEFAULT_CLOCK	3000000
 
 void uart_init();
 int uart_putc(int byte);
+int uart_write(const char *buf, size_t len);
 void uart_puts(const char *str);
+int uart_flush();
+void uart_sync_mode();
+int uart_set_baud(uint32_t baud);
 
 #endif
 
@@ -71,7 +71,7 @@ int usb_init()
 
 	// Wait for the port connected bit to be set
 	printf("USB: waiting for port connected bit\n");
-	TIMEOUT_WAIT(mmio_read(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTCONNDET, 500000);
+	TIMEOUT_WAIT(mmio_read_relaxed(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTCONNDET, 500000);
 	if(!(mmio_read(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTCONNDET))
 		return -1;
 
@@ -91,7 +91,7 @@ int usb_init()
 
 	// Wait for the port enable disable change bit to be set
 	printf("USB: waiting for port enable disable change bit\n");
-	TIMEOUT_WAIT(mmio_read(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTENCHNG, 500000);
+	TIMEOUT_WAIT(mmio_read_relaxed(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTENCHNG, 500000);
 	if(!(mmio_read(USB_HOST_PORT_CTRL_STATUS) & USB_HPCS_PRTENCHNG))
 		return -1;
 
@@ -0,0 +1,293 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Image verification
+ *
+ * Files named by 'verify' config lines are hashed (SHA-256 or CRC32) as
+ * they are loaded rather than in a second pass: vfs fread() and the load
+ * pipe pass each piece of the file to verify_update() as it arrives.  The
+ * hash can only be extended from the front of the file, so pieces read
+ * ahead of it are not counted; a small gap before a piece is read and
+ * hashed on the spot, and whatever is left when the file is closed is read
+ * then.  method_boot() refuses to start a kernel unless every listed file
+ * was loaded and matched.
+ *
+ * Only data hashed as it arrives is checked as loaded.  Gaps, and anything
+ * which arrived ahead of the hash, are hashed from a second read of the
+ * card, so for a file not read from front to back the result says the file
+ * on the card is intact rather than that the copy in memory is.  Plain
+ * binaries, modules and compressed files are read front to back; an ELF
+ * kernel's headers and segments may be read out of order.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "verify.h"
+#include "sha256.h"
+#include "crc32.h"
+#include "timer.h"
+#include "trace.h"
+#include "vfs.h"
+#include "fs.h"
+
+static struct verify_entry *entries = (void *)0;
+
+static int hex_digit(char c)
+{
+	if((c >= '0') && (c <= '9'))
+		return c - '0';
+	if((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+// Register a file to verify.  The hash is 64 hex digits for SHA-256 or 8
+// for CRC32.
+int verify_add(const char *path, const char *hash)
+{
+	size_t len = strlen(hash);
+	int type;
+	if(len == SHA256_DIGEST_LEN * 2)
+		type = VERIFY_SHA256;
+	else if(len == 8)
+		type = VERIFY_CRC32;
+	else
+		return -1;
+
+	struct verify_entry *e = (struct verify_entry *)malloc(sizeof(struct verify_entry));
+	memset(e, 0, sizeof(struct verify_entry));
+	for(size_t i = 0; i < len; i += 2)
+	{
+		int hi = hex_digit(hash[i]);
+		int lo = hex_digit(hash[i + 1]);
+		if((hi < 0) || (lo < 0))
+		{
+			free(e);
+			return -1;
+		}
+		e->digest[i / 2] = (uint8_t)((hi << 4) | lo);
+	}
+
+	e->path = (char *)malloc(strlen(path) + 1);
+	strcpy(e->path, path);
+	e->type = type;
+	e->status = VERIFY_PENDING;
+	e->next = entries;
+	entries = e;
+	return 0;
+}
+
+// Register the CRC32 of a file read through the boot manifest, unless the
+// file is already listed.  Unlike a 'verify' line it is not an error if the
+// file is never loaded or does not match: the manifest has checked the file
+// reads as it would through its filesystem, so a mismatch only means the
+// file was rewritten in place since the manifest was made.
+int verify_add_crc32(const char *path, uint32_t crc)
+{
+	for(struct verify_entry *e = entries; e; e = e->next)
+	{
+		if(!strcmp(e->path, path))
+			return 0;
+	}
+
+	char hash[9];
+	sprintf(hash, "%08x", crc);
+	if(verify_add(path, hash) != 0)
+		return -1;
+	entries->optional = 1;
+	return 0;
+}
+
+// Called by fopen(): start hashing fp if path is to be verified
+void verify_open(FILE *fp, const char *path)
+{
+	struct verify_entry *e = entries;
+	while(e && strcmp(e->path, path))
+		e = e->next;
+	if(!e)
+		return;
+
+	struct verify_state *vs = (struct verify_state *)malloc(sizeof(struct verify_state));
+	memset(vs, 0, sizeof(struct verify_state));
+	vs->entry = e;
+	if(e->type == VERIFY_SHA256)
+		sha256_init(&vs->sha);
+	vs->open_time = timer_get_ticks();
+	fp->verify = vs;
+}
+
+static void verify_hash(struct verify_state *vs, const void *data, size_t len)
+{
+	if(vs->entry->type == VERIFY_SHA256)
+		sha256_update(&vs->sha, data, len);
+	else
+		vs->crc = crc32(vs->crc, data, len);
+	vs->done += (long)len;
+}
+
+// Read and hash the file up to offset 'upto'.  The file position is left
+// unchanged.
+static int verify_fill(FILE *fp, struct verify_state *vs, long upto)
+{
+	uint8_t *buf = (uint8_t *)malloc(VERIFY_FILL_SIZE);
+	long pos = fp->pos;
+	int ret = 0;
+
+	while(vs->done < upto)
+	{
+		size_t n = (size_t)(upto - vs->done);
+		if(n > VERIFY_FILL_SIZE)
+			n = VERIFY_FILL_SIZE;
+		fp->pos = vs->done;
+		size_t bytes_read = fp->fs->fread(fp->fs, buf, 1, n, fp);
+		if(bytes_read != n)
+		{
+			ret = -1;
+			break;
+		}
+		verify_hash(vs, buf, n);
+	}
+
+	fp->pos = pos;
+	free(buf);
+	return ret;
+}
+
+// Called as len bytes at file offset 'offset' arrive
+void verify_update(FILE *fp, long offset, const void *data, size_t len)
+{
+	struct verify_state *vs = fp->verify;
+	uint64_t start = timer_get_ticks();
+
+	if((offset > vs->done) && (offset - vs->done <= VERIFY_MAX_GAP))
+		verify_fill(fp, vs, offset);
+	if((offset <= vs->done) && (offset + (long)len > vs->done))
+	{
+		size_t skip = (size_t)(vs->done - offset);
+		verify_hash(vs, (const uint8_t *)data + skip, len - skip);
+	}
+
+	vs->time += (uint32_t)(timer_get_ticks() - start);
+}
+
+// Called by fclose(): hash anything not yet seen and check the result
+void verify_close(FILE *fp)
+{
+	struct verify_state *vs = fp->verify;
+	struct verify_entry *e = vs->entry;
+	fp->verify = (void *)0;
+
+	uint64_t start = timer_get_ticks();
+	int ret = verify_fill(fp, vs, fp->len);
+
+	uint8_t digest[SHA256_DIGEST_LEN];
+	size_t digest_len;
+	if(e->type == VERIFY_SHA256)
+	{
+		sha256_final(&vs->sha, digest);
+		digest_len = SHA256_DIGEST_LEN;
+	}
+	else
+	{
+		digest[0] = (uint8_t)(vs->crc >> 24);
+		digest[1] = (uint8_t)(vs->crc >> 16);
+		digest[2] = (uint8_t)(vs->crc >> 8);
+		digest[3] = (uint8_t)vs->crc;
+		digest_len = 4;
+	}
+	uint64_t end = timer_get_ticks();
+	vs->time += (uint32_t)(end - start);
+
+	for(size_t i = 0; (ret == 0) && (i < digest_len); i++)
+	{
+		if(digest[i] != e->digest[i])
+			ret = -1;
+	}
+	if(ret == 0)
+		e->status = VERIFY_OK;
+	else
+	{
+		e->status = VERIFY_FAILED;
+		if(e->optional)
+			printf("VERIFY: %s has changed since the boot manifest was made, "
+					"re-run mkmanifest\n", e->path);
+		else
+			printf("VERIFY: %s does not match its %s hash\n", e->path,
+					(e->type == VERIFY_SHA256) ? "sha256" : "crc32");
+	}
+	e->bytes = (uint32_t)fp->len;
+	e->load_time = (uint32_t)(end - vs->open_time);
+	e->verify_time = vs->time;
+
+	TRACE(MULTIBOOT, TRACE_INFO, "VERIFY: %s %s, %u us\n", e->path,
+			(e->status == VERIFY_OK) ? "ok" : "FAILED", e->verify_time);
+	free(vs);
+}
+
+// Stop hashing fp without recording a result, for files opened only to find
+// out where they are
+void verify_cancel(FILE *fp)
+{
+	free(fp->verify);
+	fp->verify = (void *)0;
+}
+
+static uint32_t percent(uint32_t part, uint32_t whole)
+{
+	if(!whole)
+		return 0;
+	return (uint32_t)((uint64_t)part * 100 / whole);
+}
+
+// Print the verification results.  Returns 0 if every listed file was
+// loaded and matched.
+int verify_report()
+{
+	if(!entries)
+		return 0;
+
+	int ret = 0;
+	uint32_t load_time = 0, verify_time = 0;
+	printf("VERIFY: file                 hash   result   bytes  load us  verify us\n");
+	for(struct verify_entry *e = entries; e; e = e->next)
+	{
+		if(e->optional && (e->status == VERIFY_PENDING))
+			continue;
+		static const char *results[] = { "not read", "ok", "FAILED" };
+		printf("VERIFY: %-20s %-6s %-8s %7u %8u %10u (%u%%)\n", e->path,
+				(e->type == VERIFY_SHA256) ? "sha256" : "crc32",
+				(e->optional && (e->status == VERIFY_FAILED)) ? "changed" :
+				results[e->status], e->bytes, e->load_time, e->verify_time,
+				percent(e->verify_time, e->load_time));
+		if((e->status != VERIFY_OK) && !e->optional)
+			ret = -1;
+		load_time += e->load_time;
+		verify_time += e->verify_time;
+	}
+	printf("VERIFY: hashing took %u%% of load time\n",
+			percent(verify_time, load_time));
+	return ret;
+}
@@ -0,0 +1,76 @@
+/* Copyright (C) 2013 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "sha256.h"
+
+#define VERIFY_SHA256		1
+#define VERIFY_CRC32		2
+
+#define VERIFY_PENDING		0	// not loaded yet
+#define VERIFY_OK		1
+#define VERIFY_FAILED		2
+
+// Files not read from front to back are hashed by reading gaps of up to
+// this size when the load skips ahead; larger gaps are read at fclose().
+// Either way those parts are hashed from the card, not from the memory the
+// load delivered them to.
+#define VERIFY_MAX_GAP		0x10000
+#define VERIFY_FILL_SIZE	0x8000
+
+struct verify_entry
+{
+	struct verify_entry *next;
+	char *path;
+	int type;
+	int status;
+	uint8_t digest[SHA256_DIGEST_LEN];
+	uint32_t bytes;
+	uint32_t load_time;	// microseconds from fopen() to fclose()
+	uint32_t verify_time;	// of which spent hashing
+	int optional;		// from the boot manifest: never fails the boot
+};
+
+// Hash state of an open file
+struct verify_state
+{
+	struct verify_entry *entry;
+	struct sha256 sha;
+	uint32_t crc;
+	long done;		// bytes hashed from the start of the file
+	uint64_t open_time;
+	uint32_t time;
+};
+
+int verify_add(const char *path, const char *hash);
+int verify_add_crc32(const char *path, uint32_t crc);
+void verify_open(FILE *fp, const char *path);
+void verify_update(FILE *fp, long offset, const void *data, size_t len);
+void verify_close(FILE *fp);
+void verify_cancel(FILE *fp);
+int verify_report();
+
+#endif
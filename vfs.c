@@ -23,6 +23,12 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "arena.h"
+#include "verify.h"
+#include "manifest.h"
+#include "prefetch.h"
+#include "loadpipe.h"
+#include "aio.h"
 
 static struct vfs_entry *first = (void*)0;
 static struct vfs_entry *def = (void*)0;
@@ -72,15 +78,9 @@ int vfs_set_default(char *dev_name)
 	return -1;
 }
 
-static void free_split_dir(char **sp)
+char *vfs_get_default()
 {
-	char **s = sp;
-	while(*s)
-	{
-		free(*s);
-		s++;
-	}
-	free(sp);
+	return def ? def->device_name : (void *)0;
 }
 
 static void free_dirent_list(struct dirent *d)
@@ -93,6 +93,9 @@ static void free_dirent_list(struct dirent *d)
 	}
 }
 
+// Split a path into its components.  The returned array and strings are
+// allocated from the transient arena - callers should take a mark first and
+// release it when done with the result.
 static char **split_dir(const char *path, struct vfs_entry **ve)
 {
 	int dir_start = 0;
@@ -126,7 +129,7 @@ static char **split_dir(const char *path, struct vfs_entry **ve)
 				return (void*)0;
 			}
 			// The device name runs from position 1 to 'i'
-			char *dev_name = (char *)malloc(i);
+			char *dev_name = (char *)arena_alloc(&transient_arena, i);
 			strncpy(dev_name, &path[1], i - 1);
 			dev_name[i - 1] = 0;
 			*ve = find_ve(dev_name);
@@ -159,7 +162,8 @@ static char **split_dir(const char *path, struct vfs_entry **ve)
 
 	// Now iterate through again assigning to the path array
 	int cur_dir = 0;
-	char **ret = (char **)malloc((dir_count + 1) * sizeof(char *));
+	char **ret = (char **)arena_alloc(&transient_arena,
+			(dir_count + 1) * sizeof(char *));
 	ret[dir_count] = 0;	// null terminate
 	int cur_idx = dir_start;
 	int cur_dir_start = dir_start;
@@ -169,7 +173,8 @@ static char **split_dir(const char *path, struct vfs_entry **ve)
 			cur_idx++;
 		// Found a '/'
 		int path_bit_length = cur_idx - cur_dir_start;
-		char *pb = (char *)malloc((path_bit_length + 1) * sizeof(char));
+		char *pb = (char *)arena_alloc(&transient_arena,
+				(path_bit_length + 1) * sizeof(char));
 		for(int i = 0; i < path_bit_length; i++)
 			pb[i] = path[cur_dir_start + i];
 		pb[path_bit_length] = 0;
@@ -216,12 +221,16 @@ static struct dirent *read_directory(const char *path)
 {
 	char **p;
 	struct vfs_entry *ve;
+	struct arena_mark mark = arena_mark(&transient_arena);
 	p = split_dir(path, &ve);
 	if(p == (void *)0)
+	{
+		arena_release(&transient_arena, mark);
 		return (void *)0;
+	}
 
 	struct dirent *ret = ve->fs->read_directory(ve->fs, p);
-	free_split_dir(p);
+	arena_release(&transient_arena, mark);
 	return ret;
 }
 
@@ -270,14 +279,24 @@ size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
 	size_t nmemb_to_read = bytes_to_read / size;
 	bytes_to_read = nmemb_to_read * size;
 
-	bytes_to_read = stream->fs->fread(stream->fs, ptr, 1, bytes_to_read, stream);
-	return bytes_to_read / size;
+	size_t bytes_read = stream->fs->fread(stream->fs, ptr, 1, bytes_to_read, stream);
+	if(bytes_read > bytes_to_read)
+		return 0;
+	if(stream->verify)
+		verify_update(stream, stream->pos, ptr, bytes_read);
+	stream->pos += (long)bytes_read;
+	return bytes_read / size;
 }
 
 int fclose(FILE *fp)
 {
 	if(fp)
 	{
+		aio_fclose(fp);
+		if(fp->verify)
+			verify_close(fp);
+		if(fp->fs && fp->fs->fclose)
+			fp->fs->fclose(fp->fs, fp);
 		free(fp);
 		return 0;
 	}
@@ -314,11 +333,26 @@ int fseek(FILE *stream, long offset, int whence)
 
 FILE *fopen(const char *path, const char *mode)
 {
+	// Files already read by the prefetcher come from memory, and those
+	// listed in the boot manifest need no directory walk
+	FILE *ret = prefetch_fopen(path, mode);
+	if(!ret)
+		ret = manifest_fopen(path, mode);
+	if(ret)
+	{
+		verify_open(ret, path);
+		return ret;
+	}
+
 	char **p;
 	struct vfs_entry *ve;
+	struct arena_mark mark = arena_mark(&transient_arena);
 	p = split_dir(path, &ve);
 	if(p == (void *)0)
+	{
+		arena_release(&transient_arena, mark);
 		return (void *)0;
+	}
 
 	// Trim off the last entry
 	char **p_iter = p;
@@ -332,8 +366,7 @@ FILE *fopen(const char *path, const char *mode)
 	struct dirent *dir_start = dir;
 	if(dir == (void*)0)
 	{
-		free_split_dir(p);
-		free(fname);
+		arena_release(&transient_arena, mark);
 		return (void*)0;
 	}
 
@@ -348,8 +381,7 @@ FILE *fopen(const char *path, const char *mode)
 		dir = dir->next;
 	}
 
-	free_split_dir(p);
-	free(fname);
+	arena_release(&transient_arena, mark);
 
 	if(!file)
 	{
@@ -358,8 +390,45 @@ FILE *fopen(const char *path, const char *mode)
 	}
 
 	// Read the file
-	FILE *ret = ve->fs->fopen(ve->fs, file, mode);
+	ret = ve->fs->fopen(ve->fs, file, mode);
 	free_dirent_list(dir_start);
+	if(ret)
+		verify_open(ret, path);
+	return ret;
+}
+
+// Read the rest of fp into dest.  Where the filesystem can map the file to
+// device blocks each extent is read straight into dest in transfers of up to
+// BLOCK_ASYNC_MAX bytes, without going through fread().  Nothing is read if
+// the data does not fit in max_len.  Returns the number of bytes loaded or a
+// negative error; name is only used in the timing trace.
+long vfs_fload(FILE *fp, void *dest, size_t max_len, const char *name)
+{
+	if(fp == (void *)0)
+		return VFS_ERR_OPEN;
+
+	size_t len = (size_t)(fp->len - fp->pos);
+	if(len > max_len)
+		return VFS_ERR_TOO_BIG;
+	if(loadpipe_read(fp, dest, len, name) != len)
+		return VFS_ERR_READ;
+	return (long)len;
+}
+
+// Load the whole of the file at path into dest.  Returns the length of the
+// file or a negative error.
+long vfs_load_file(const char *path, void *dest, size_t max_len)
+{
+	FILE *fp = fopen(path, "r");
+	if(!fp)
+		return VFS_ERR_OPEN;
+
+	long ret = vfs_fload(fp, dest, max_len, path);
+
+	// Don't read a file which was not loaded just to hash it
+	if((ret == VFS_ERR_TOO_BIG) && fp->verify)
+		verify_cancel(fp);
+	fclose(fp);
 	return ret;
 }
 
@@ -23,6 +23,7 @@
 #define VFS_H
 
 struct vfs_file;
+struct verify_state;
 
 #include "dirent.h"
 #include "multiboot.h"
@@ -34,6 +35,10 @@ struct vfs_file;
 
 #include "fs.h"
 
+#define VFS_ERR_OPEN		-1
+#define VFS_ERR_TOO_BIG		-2
+#define VFS_ERR_READ		-3
+
 struct vfs_entry
 {
 	char *device_name;
@@ -47,6 +52,7 @@ struct vfs_file
 	long pos;
 	void *opaque;
 	long len;
+	struct verify_state *verify;	// set if the file is being hashed
 };
 
 int fseek(FILE *stream, long offset, int whence);
@@ -62,6 +68,8 @@ char *vfs_get_default();
 size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
 FILE *fopen(const char *path, const char *mode);
 int fclose(FILE *fp);
+long vfs_fload(FILE *fp, void *dest, size_t max_len, const char *name);
+long vfs_load_file(const char *path, void *dest, size_t max_len);
 DIR *opendir(const char *name);
 struct dirent *readdir(DIR *dirp);
 int closedir(DIR *dirp);